@@ -0,0 +1,653 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Animator.h"
+#include "ArgParser.h"
+#include "Clock.h"
+#include "ColorCorrection.h"
+#include "Compositor.h"
+#include "Config.h"
+#include "LedBackend.h"
+#include "LedStrip.h"
+#include "Logger.h"
+#include "MidiClient.h"
+#include "MidiSource.h"
+#include "NoteMapper.h"
+#include "NoteName.h"
+#include "PianoTutorPlusConfig.h"
+
+
+#define PROGRAM		"pianotutor+-bench"
+#define DESCRIPTION	"Microbenchmarks of the config, mapping and render paths of PianoTutor+"
+
+#define MIN_RUN_NS			(20 * NS_PER_MS)	// a run must last at least this long
+#define REPEATS				5					// the fastest run is reported
+#define DEFAULT_THRESHOLD	10.0				// % of slowdown flagged by the compare mode
+
+#define ERR_ARGUMENTS	-1
+#define ERR_BASELINE	-2
+#define ERR_MISMATCH	-3
+#define ERR_SLOWDOWN	1
+
+
+/**
+ * Outcome of a benchmark
+ */
+struct Result {
+	std::string name;
+	uint64_t iterations;	// operations of the fastest run
+	double nsPerOp;
+};
+
+/**
+ * A benchmark: the body performs the requested number of operations
+ */
+struct Benchmark {
+	std::string name;
+	std::function<void(uint64_t)> body;
+};
+
+// keeps the compiler from optimizing away the results of the operations
+static volatile uint64_t sink;
+
+
+/**
+ * Utility function to print help messages about the usage of this program
+ */
+static inline void printUsage() {
+	std::cout << std::endl;
+	std::cout << DESCRIPTION << std::endl;
+	std::cout << std::endl;
+	std::cout << "Usage:" << std::endl;
+	std::cout << "    " << PROGRAM << " [--json] [--filter <text>]" << std::endl;
+	std::cout << "    " << PROGRAM << " --compare <baseline.csv> [--threshold <percent>] [--filter <text>]" << std::endl;
+	std::cout << "    " << PROGRAM << " (-h | --help)" << std::endl;
+	std::cout << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "    " << "-j, --json\t\t\tPrint JSON instead of CSV" << std::endl;
+	std::cout << "    " << "-F <text>, --filter <text>\tRun only the benchmarks whose name contains <text>" << std::endl;
+	std::cout << "    " << "-c <file>, --compare <file>\tCompare with a baseline saved from the CSV output" << std::endl;
+	std::cout << "    " << "-t <pct>, --threshold <pct>\tSlowdown flagged by --compare (default " << DEFAULT_THRESHOLD << "%)" << std::endl;
+	std::cout << "    " << "-h, --help\t\t\tShow this screen" << std::endl;
+	std::cout << std::endl;
+	std::cout << "With --compare the exit status is " << ERR_SLOWDOWN << " if any benchmark got slower" << std::endl;
+	std::cout << std::endl;
+}
+
+/**
+ * Time a benchmark: the number of operations is doubled until a run lasts at
+ * least MIN_RUN_NS, then the run is repeated and the fastest one is kept
+ * 
+ * @param	benchmark	benchmark to run
+ * 
+ * @return	the fastest run
+ */
+static Result measure(const Benchmark& benchmark) {
+	uint64_t iterations = 1;
+	uint64_t elapsed;
+
+	while(true) {
+		uint64_t begin = Clock::now();
+		benchmark.body(iterations);
+		elapsed = Clock::now() - begin;
+		if(elapsed >= MIN_RUN_NS)
+			break;
+		iterations *= 2;
+	}
+
+	double best = (double) elapsed / iterations;
+	for(int repeat = 1; repeat < REPEATS; repeat++) {
+		uint64_t begin = Clock::now();
+		benchmark.body(iterations);
+		best = std::min(best, (double) (Clock::now() - begin) / iterations);
+	}
+
+	return Result({benchmark.name, iterations, best});
+}
+
+/**
+ * Write a text file. In case of error an OpenFileException is thrown
+ * 
+ * @param	filename	name of the file
+ * @param	content		content of the file
+ */
+static void writeFile(const std::string& filename, const std::string& content) {
+	std::ofstream file(filename);
+	if(!file.is_open())
+		throw OpenFileException(filename);
+	file << content;
+}
+
+/**
+ * Build a configuration file with the provided number of lines: one third are
+ * comments, the others are (key, value) pairs, half of them with a trailing comment
+ * 
+ * @param	lines	number of lines
+ * 
+ * @return	content of the file
+ */
+static std::string largeConfig(unsigned int lines) {
+	std::ostringstream content;
+	for(unsigned int line = 0; line < lines; line++) {
+		if(line % 3 == 0)
+			content << "# Comment line number " << line << std::endl;
+		else if(line % 3 == 1)
+			content << "KEY_" << line << "\t= value_" << line << "    # trailing comment" << std::endl;
+		else
+			content << "OTHER_KEY_" << line << " = " << line * 7 << std::endl;
+	}
+	return content.str();
+}
+
+/**
+ * Build a complete program configuration for a 88-key keyboard, using the null
+ * LED backend
+ * 
+ * @param	ledCount	number of LEDs in the strip
+ * 
+ * @return	content of the file
+ */
+static std::string programConfig(unsigned int ledCount) {
+	std::ostringstream content;
+	content << "FREQUENCY = 800000" << std::endl
+			<< "GPIO_PIN = 10" << std::endl
+			<< "DMA_CHANNEL = 10" << std::endl
+			<< "LED_BACKEND = null" << std::endl
+			<< "MIDI_SOURCE = synthetic" << std::endl
+			<< "KEYBOARD_MIN_NOTE = A0" << std::endl
+			<< "KEYBOARD_MAX_NOTE = C8" << std::endl
+			<< "LED_COUNT = " << ledCount << std::endl
+			<< "LED_PER_KEY = " << ledCount / 88.0 << std::endl
+			<< "LED_ORDER = DIR" << std::endl
+			<< "LED_TYPE = GRB" << std::endl
+			<< "COLOR_RIGHT_HAND = orange" << std::endl
+			<< "COLOR_LEFT_HAND = green" << std::endl;
+	return content.str();
+}
+
+/**
+ * Build a sequence of note events on a 88-key keyboard: chords of 4 random notes,
+ * each one released when the following is pressed
+ * 
+ * @param	count	number of events
+ * 
+ * @return	vector of events
+ */
+static std::vector<MidiEvent> noteEvents(unsigned int count) {
+	std::vector<MidiEvent> events;
+	std::vector<MidiEvent> held;
+	uint32_t seed = 0x9E3779B9u;
+
+	while(events.size() < count) {
+		for(const MidiEvent& event : held) {
+			events.push_back(event);
+			events.back().type = MidiEvent::Type::NOTE_OFF;
+		}
+		held.clear();
+
+		for(int note = 0; note < 4; note++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			MidiEvent event;
+			event.note = 21 + seed % 88;
+			event.type = MidiEvent::Type::NOTE_ON;
+			event.hand = (seed >> 8) & 1 ? MidiEvent::Hand::LEFT : MidiEvent::Hand::RIGHT;
+			event.channel = event.hand == MidiEvent::Hand::LEFT ? 1 : 0;
+			event.velocity = 1 + (seed >> 9) % 127;
+			event.port = 0;
+			event.track = MIDI_NO_TRACK;
+			event.timestamp = 0;
+			events.push_back(event);
+			held.push_back(event);
+		}
+	}
+
+	events.resize(count);
+	return events;
+}
+
+/**
+ * Reference parser of the note names, as it was before the hand-written one:
+ * a regular expression built on every call, then a chain of comparisons
+ * 
+ * @param	note	name of the note, octaves 0 to 9 and sharps only
+ * 
+ * @return	MIDI note, -1 if the name is not valid
+ */
+static int note2midiRegex(std::string note) {
+	static const char* const pitches[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+
+	std::transform(note.begin(), note.end(), note.begin(), ::toupper);
+
+	std::regex expr("^([A-G]|[A|C|D|F|G][\\#])([0-9])$");
+	std::cmatch cm;
+	if(!std::regex_match(note.c_str(), cm, expr))
+		return -1;
+
+	int ret = 0;
+	while(ret < 12 && cm[1] != pitches[ret])
+		ret++;
+	return ret + (std::stoi(cm[2]) + 1) * 12;
+}
+
+/**
+ * Parse a baseline saved from the CSV output. In case of error an
+ * OpenFileException or a ParsingException is thrown
+ * 
+ * @param	filename	name of the baseline
+ * 
+ * @return	ns per operation of each benchmark
+ */
+static std::map<std::string, double> readBaseline(const std::string& filename) {
+	std::map<std::string, double> baseline;
+	std::ifstream file(filename);
+	std::string line;
+
+	if(!file.is_open())
+		throw OpenFileException(filename);
+
+	// skip the header
+	std::getline(file, line);
+
+	while(std::getline(file, line)) {
+		std::istringstream fields(line);
+		std::string name, iterations, nsPerOp;
+
+		if(!std::getline(fields, name, ',') || !std::getline(fields, iterations, ',') ||
+				!std::getline(fields, nsPerOp, ','))
+			throw ParsingException();
+		baseline[name] = Config::parseDouble(nsPerOp);
+	}
+
+	return baseline;
+}
+
+
+/**
+ * Benchmark entry-point. It builds the list of benchmarks, runs the selected ones
+ * and prints the results as CSV or JSON, or compares them with a baseline
+ * 
+ * @param	argc	number of arguments
+ * @param	argv	vector of arguments
+ */
+int main(int argc, char* argv[]) {
+
+	bool json = false;
+	std::string filter;
+	std::string baselineFile;
+	double threshold = DEFAULT_THRESHOLD;
+
+	try {
+		ArgParser parser;
+		parser.addOption("help", 'h', ArgParser::ArgumentType::NO_ARGUMENT, [](const char* arg) {
+			printUsage();
+			exit(EXIT_SUCCESS);
+		})
+		.addOption("json", 'j', ArgParser::ArgumentType::NO_ARGUMENT, [&json](const char* arg) {
+			json = true;
+		})
+		.addOption("filter", 'F', ArgParser::ArgumentType::REQUIRED, [&filter](const char* arg) {
+			filter = std::string(arg);
+		})
+		.addOption("compare", 'c', ArgParser::ArgumentType::REQUIRED, [&baselineFile](const char* arg) {
+			baselineFile = std::string(arg);
+		})
+		.addOption("threshold", 't', ArgParser::ArgumentType::REQUIRED, [&threshold](const char* arg) {
+			threshold = Config::parseDouble(arg);
+		})
+		.parse(argc, argv);
+	} catch(std::exception& e) {
+		printUsage();
+		exit(ERR_ARGUMENTS);
+	}
+
+	char dirTemplate[] = "/tmp/" PROGRAM "-XXXXXX";
+	if(!mkdtemp(dirTemplate)) {
+		std::cerr << "Unable to create a temporary directory" << std::endl;
+		exit(ERR_ARGUMENTS);
+	}
+	const std::string dir(dirTemplate);
+	std::vector<std::string> files;
+	std::vector<Benchmark> benchmarks;
+
+	// configuration parsing, on files of growing size
+	for(unsigned int lines : {1000u, 10000u, 100000u}) {
+		std::string filename = dir + "/large-" + std::to_string(lines) + ".conf";
+		writeFile(filename, largeConfig(lines));
+		files.push_back(filename);
+
+		benchmarks.push_back({"config_parse_" + std::to_string(lines) + "_lines", [filename](uint64_t n) {
+			for(uint64_t i = 0; i < n; i++)
+				sink = Config::parse(filename).get("KEY_1", "").size();
+		}});
+	}
+
+	std::string configFile = dir + "/program.conf";
+	writeFile(configFile, programConfig(120));
+	files.push_back(configFile);
+
+	benchmarks.push_back({"program_config_parse", [configFile](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			sink = PianoTutorPlusConfig(configFile).getLedCount();
+	}});
+
+	// note names, over the whole MIDI range
+	std::vector<std::string> names;
+	for(int note = 0; note < MIDI_NOTES; note++)
+		names.push_back(NoteName::toString(note));
+
+	benchmarks.push_back({"note2midi", [names](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			sink = MidiClient::note2midi(names[i % MIDI_NOTES]);
+	}});
+	// the same names through the regular expression, which must agree on the ones it accepts
+	for(const std::string& name : names) {
+		int reference = note2midiRegex(name);
+		if(reference >= 0 && reference != MidiClient::note2midi(name)) {
+			std::cerr << "The note parser does not match the reference on " << name << std::endl;
+			exit(ERR_MISMATCH);
+		}
+	}
+
+	benchmarks.push_back({"note2midi_regex", [names](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			sink = note2midiRegex(names[i % MIDI_NOTES]);
+	}});
+
+	// the keyboard range of a configuration file, read and parsed with either parser
+	benchmarks.push_back({"config_keyboard_range_parse", [configFile](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++) {
+			Config conf = Config::parse(configFile);
+			sink = MidiClient::note2midi(conf[KEY_KEYBOARD_MIN_NOTE]) + MidiClient::note2midi(conf[KEY_KEYBOARD_MAX_NOTE]);
+		}
+	}});
+	benchmarks.push_back({"config_keyboard_range_parse_regex", [configFile](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++) {
+			Config conf = Config::parse(configFile);
+			sink = note2midiRegex(conf[KEY_KEYBOARD_MIN_NOTE]) + note2midiRegex(conf[KEY_KEYBOARD_MAX_NOTE]);
+		}
+	}});
+
+	benchmarks.push_back({"midi2note", [](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			sink = MidiClient::midi2note(i % MIDI_NOTES).size();
+	}});
+
+	// enumerations, over all the available names
+	std::vector<std::string> colors;
+	for(LedColor::Color color : LedColor::getAllColors())
+		colors.push_back(LedColor::toString(color));
+	std::vector<std::string> types;
+	for(StripType::Type type : StripType::getAllStripTypes())
+		types.push_back(StripType::toString(type));
+
+	benchmarks.push_back({"led_color_parse", [colors](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			sink = LedColor::parse(colors[i % colors.size()]);
+	}});
+	benchmarks.push_back({"strip_type_parse", [types](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			sink = StripType::parse(types[i % types.size()]);
+	}});
+
+	// note-to-LED mapping of a single event, without rendering. The fixtures of this
+	// and the following benchmarks are built once, so that only the work per event is
+	// timed and not, for instance, the start of a render thread
+	const std::vector<MidiEvent> events = noteEvents(4096);
+	std::shared_ptr<PianoTutorPlusConfig> config = std::make_shared<PianoTutorPlusConfig>(configFile);
+	std::shared_ptr<Compositor> mappingCompositor = std::make_shared<Compositor>(config->getLedCount());
+	std::shared_ptr<NoteMapper> mapper = std::make_shared<NoteMapper>(*config, *mappingCompositor);
+
+	benchmarks.push_back({"note_mapping", [config, mappingCompositor, mapper, &events](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			sink = mapper->apply(events[i % events.size()]);
+	}});
+
+	// one LED switched on and the frame published, at several strip lengths
+	for(unsigned int count : {60u, 120u, 255u, 600u, 1200u}) {
+		std::shared_ptr<LedStrip> strip = std::make_shared<LedStrip>(
+				std::unique_ptr<LedBackend>(new NullBackend(800000, false)), count);
+		benchmarks.push_back({"switch_on_render_" + std::to_string(count) + "_leds", [strip, count](uint64_t n) {
+			for(uint64_t i = 0; i < n; i++) {
+				strip->switchOn(i % count, (i / count) & 1 ? LedColor::Color::ORANGE : LedColor::Color::GREEN);
+				sink = strip->render();
+			}
+		}});
+	}
+
+	// a frame of the fade engine, at growing numbers of keys being animated: the
+	// envelopes last 1000 frames, then the keys are released or pressed again
+	std::string animatedConfigFile = dir + "/animated.conf";
+	writeFile(animatedConfigFile, programConfig(176) + "ATTACK_TIME = 10000\nDECAY_TIME = 10000\nANIMATION_FPS = 100\n");
+	files.push_back(animatedConfigFile);
+	std::shared_ptr<PianoTutorPlusConfig> animatedConfig = std::make_shared<PianoTutorPlusConfig>(animatedConfigFile);
+
+	for(unsigned int keys : {1u, 10u, 44u, 88u}) {
+		std::shared_ptr<Compositor> animatedCompositor = std::make_shared<Compositor>(animatedConfig->getLedCount());
+		std::shared_ptr<Animator> animator = std::make_shared<Animator>(*animatedConfig, *animatedCompositor);
+		std::shared_ptr<bool> lit = std::make_shared<bool>(false);
+		benchmarks.push_back({"animation_frame_" + std::to_string(keys) + "_keys",
+				[animatedConfig, animatedCompositor, animator, lit, keys](uint64_t n) {
+			for(uint64_t i = 0; i < n; i++) {
+				if(animator->getActiveKeys() == 0) {
+					*lit = !*lit;
+					for(unsigned int k = 0; k < keys; k++) {
+						unsigned char note = 21 + k * 88 / keys;
+						if(*lit)
+							animator->press(note, LedColor::Color::ORANGE);
+						else
+							animator->release(note);
+					}
+				}
+				sink = animator->advance();
+			}
+		}});
+	}
+
+	// gamma and white balance correction of a whole frame, in the implementation
+	// used by the render thread and in the scalar reference
+	const uint8_t whiteBalance[3] = {255, 200, 180};
+	std::shared_ptr<ColorCorrection> correction(new ColorCorrection(2.2, whiteBalance, 2, 32));
+	std::vector<ws2811_led_t> frame(1200);
+	uint32_t seed = 0x2545F491u;
+	for(ws2811_led_t& led : frame) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		led = seed;
+	}
+
+	benchmarks.push_back({"color_correction_1200_leds", [correction, frame](uint64_t n) {
+		std::vector<ws2811_led_t> out(frame.size());
+		for(uint64_t i = 0; i < n; i++) {
+			correction->apply(frame.data(), out.data(), frame.size());
+			sink = out[i % out.size()];
+		}
+	}});
+	benchmarks.push_back({"color_correction_scalar_1200_leds", [correction, frame](uint64_t n) {
+		std::vector<ws2811_led_t> out(frame.size());
+		for(uint64_t i = 0; i < n; i++) {
+			correction->applyScalar(frame.data(), out.data(), frame.size());
+			sink = out[i % out.size()];
+		}
+	}});
+
+	// composition of a 300 LED frame from 4 layers of random colors and opacities,
+	// with the vector kernels and the scalar reference
+	std::shared_ptr<Compositor> compositor = std::make_shared<Compositor>(300);
+	for(unsigned int layer = 0; layer < Compositor::LAYERS; layer++) {
+		for(unsigned short pos = 0; pos < compositor->getCount(); pos++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			compositor->setColor((Compositor::Layer) layer, pos, seed & 0xFFFFFF, seed >> 24);
+		}
+	}
+	const unsigned int blendEnd = (compositor->getCount() + COMPOSITOR_BLOCK - 1) / COMPOSITOR_BLOCK * COMPOSITOR_BLOCK;
+
+	benchmarks.push_back({"blend_300_leds_4_layers", [compositor, blendEnd](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++) {
+			compositor->blend(0, blendEnd);
+			sink = compositor->getOutput()[i % compositor->getCount()];
+		}
+	}});
+	benchmarks.push_back({"blend_scalar_300_leds_4_layers", [compositor, blendEnd](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++) {
+			compositor->blendScalar(0, blendEnd);
+			sink = compositor->getOutput()[i % compositor->getCount()];
+		}
+	}});
+
+	// the same frame composed into a strip, with the whole strip touched every time
+	std::shared_ptr<LedStrip> compositeStrip = std::make_shared<LedStrip>(
+			std::unique_ptr<LedBackend>(new NullBackend(800000, false)), compositor->getCount());
+	benchmarks.push_back({"composite_300_leds_4_layers", [compositor, compositeStrip](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++) {
+			compositor->setColor(Compositor::AMBIENT, 0, i, 255);
+			compositor->setColor(Compositor::AMBIENT, compositor->getCount() - 1, i, 255);
+			sink = compositor->composite(*compositeStrip);
+		}
+	}});
+
+	// the whole event path, from the decoded event to the published frame. The events
+	// are generated in advance: taking them from a source would time its clock and
+	// timer calls too, as the loop keeps catching up with the stream
+	std::shared_ptr<LedStrip> loopStrip = std::make_shared<LedStrip>(
+			std::unique_ptr<LedBackend>(new NullBackend(config->getFreq(), false)), config->getLedCount());
+	std::shared_ptr<Compositor> loopCompositor = std::make_shared<Compositor>(config->getLedCount());
+	std::shared_ptr<NoteMapper> loopMapper = std::make_shared<NoteMapper>(*config, *loopCompositor);
+
+	benchmarks.push_back({"full_loop_per_event", [config, loopStrip, loopCompositor, loopMapper, &events](uint64_t n) {
+		// a frame per chord: its releases and presses arrive together
+		for(uint64_t i = 0; i < n; i++) {
+			loopMapper->apply(events[i % events.size()]);
+			if(i % 8 == 7) {
+				loopCompositor->composite(*loopStrip);
+				loopStrip->render(Clock::now());
+			}
+		}
+	}});
+
+	// a statement below the current level, and one recorded and then formatted:
+	// the output is flushed before the ring fills up, so no record is dropped
+	FILE* devNull = fopen("/dev/null", "w");
+	Logger::registerThread();
+	Logger::setLevel(LogLevel::INFO);
+	Logger::start(devNull);
+
+	benchmarks.push_back({"log_disabled", [](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++)
+			LOG_TRACE("[%c] %s %s", 'R', NoteName::toString(i % MIDI_NOTES), "ON");
+	}});
+	benchmarks.push_back({"log_record_and_format", [](uint64_t n) {
+		for(uint64_t i = 0; i < n; i++) {
+			LOG_INFO("[%c] %s %s", 'R', NoteName::toString(i % MIDI_NOTES), "ON");
+			if(i % (LOG_RING_RECORDS / 2) == 0)
+				Logger::flush();
+		}
+	}});
+
+	std::vector<Result> results;
+	for(const Benchmark& benchmark : benchmarks)
+		if(benchmark.name.find(filter) != std::string::npos)
+			results.push_back(measure(benchmark));
+
+	Logger::stop();
+	fclose(devNull);
+
+	for(const std::string& file : files)
+		unlink(file.c_str());
+	rmdir(dir.c_str());
+
+	if(!baselineFile.empty()) {
+		std::map<std::string, double> baseline;
+		bool slower = false;
+
+		try {
+			baseline = readBaseline(baselineFile);
+		} catch(std::exception& e) {
+			std::cerr << "Error reading the baseline " << baselineFile << std::endl;
+			exit(ERR_BASELINE);
+		}
+
+		printf("benchmark,ns_per_op,baseline_ns_per_op,change_percent,status\n");
+		for(const Result& result : results) {
+			auto entry = baseline.find(result.name);
+			if(entry == baseline.end()) {
+				printf("%s,%.2f,,,NEW\n", result.name.c_str(), result.nsPerOp);
+				continue;
+			}
+
+			double change = (result.nsPerOp / entry->second - 1) * 100;
+			const char* status = "OK";
+			if(change > threshold) {
+				status = "SLOWER";
+				slower = true;
+			} else if(change < -threshold) {
+				status = "FASTER";
+			}
+			printf("%s,%.2f,%.2f,%+.1f,%s\n", result.name.c_str(), result.nsPerOp, entry->second, change, status);
+		}
+
+		return slower ? ERR_SLOWDOWN : 0;
+	}
+
+	if(json) {
+		printf("[\n");
+		for(std::size_t i = 0; i < results.size(); i++)
+			printf("  {\"benchmark\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}%s\n",
+					results[i].name.c_str(), (unsigned long long) results[i].iterations, results[i].nsPerOp,
+					NS_PER_SEC / results[i].nsPerOp, i + 1 < results.size() ? "," : "");
+		printf("]\n");
+	} else {
+		printf("benchmark,iterations,ns_per_op,ops_per_sec\n");
+		for(const Result& result : results)
+			printf("%s,%llu,%.2f,%.0f\n", result.name.c_str(), (unsigned long long) result.iterations,
+					result.nsPerOp, NS_PER_SEC / result.nsPerOp);
+	}
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __ALLOCGUARD_H__
+#define __ALLOCGUARD_H__
+
+/**
+ * Hook to check that the steady-state event path never allocates. When built
+ * with ALLOC_CHECK (make alloccheck), the global operator new is replaced and
+ * any allocation performed while the guard is armed aborts the program. In all
+ * the other builds the guard does nothing
+ */
+namespace AllocGuard {
+
+	/**
+	 * Make any further heap allocation of the calling thread fatal
+	 */
+	void arm();
+
+	/**
+	 * Allow heap allocations of the calling thread again
+	 */
+	void disarm();
+
+	/**
+	 * Arm the guard for the lifetime of the object (ex. a MIDI handler)
+	 */
+	class Scope {
+	public:
+		Scope() { arm(); }
+		~Scope() { disarm(); }
+	};
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __ANIMATOR_H__
+#define __ANIMATOR_H__
+
+#include <stdint.h>
+
+#include "Compositor.h"
+#include "NoteName.h"
+#include "PianoTutorPlusConfig.h"
+
+#define ANIMATION_LEVEL_BITS	16
+#define ANIMATION_FULL_LEVEL	(1u << ANIMATION_LEVEL_BITS)	// level of a fully lit key
+
+/**
+ * Attack and decay envelopes of the keys: instead of snapping on and off, a key
+ * fades in when it is pressed and fades out when it is released. The levels are
+ * 16.16 fixed-point numbers, advanced at a fixed frame rate by a timerfd; only the
+ * keys whose level is moving are visited, so the cost of a frame grows with the
+ * keys being animated rather than with the length of the strip. The level of a
+ * key is its opacity on the NOTES layer, so it fades over the layers below. The
+ * timer is stopped as soon as every key has reached its level
+ */
+class Animator {
+
+	const PianoTutorPlusConfig* config;
+	Compositor& compositor;
+
+	int timerFd;
+	bool armed;
+	uint64_t framePeriod;
+
+	// level change per frame, 0 to skip the envelope
+	uint32_t attackStep;
+	uint32_t decayStep;
+
+	// per key: color, current level and level it is moving to
+	ws2811_led_t colors[MIDI_NOTES];
+	uint32_t levels[MIDI_NOTES];
+	uint32_t targets[MIDI_NOTES];
+
+	// keys whose level is moving, and position of each key in the list
+	uint8_t active[MIDI_NOTES];
+	uint8_t positions[MIDI_NOTES];
+	unsigned int activeKeys;
+
+	unsigned long frames;
+
+	/**
+	 * Move the level of a key towards its target
+	 * 
+	 * @param	note	MIDI note of the key
+	 * @param	count	number of frames elapsed
+	 * 
+	 * @return	true if the key reached its target
+	 */
+	bool step(unsigned char note, uint64_t count);
+
+	/**
+	 * Write the color of a key to its LEDs, with its level as opacity
+	 * 
+	 * @param	note	MIDI note of the key
+	 */
+	void show(unsigned char note);
+
+	/**
+	 * Start moving a key towards its target: the first step is taken at once,
+	 * so that the next frame already shows the change, and the frame clock is
+	 * started if needed
+	 * 
+	 * @param	note	MIDI note of the key
+	 * @param	stepSize	level change per frame
+	 */
+	void animate(unsigned char note, uint32_t stepSize);
+
+	/**
+	 * Remove a key from the list of the ones being animated
+	 * 
+	 * @param	note	MIDI note of the key
+	 */
+	void deactivate(unsigned char note);
+
+	/**
+	 * Start or stop the frame clock
+	 * 
+	 * @param	running		true to start the clock, false to stop it
+	 */
+	void setTimer(bool running);
+
+public:
+
+	/**
+	 * Build the engine with all the keys off, taking the envelope times and the
+	 * frame rate from the configuration. In case of error a LedStripException
+	 * is thrown
+	 * 
+	 * @param	config		configuration providing the LED spans and the envelopes
+	 * @param	compositor	layers of the strip, the keys being drawn on the NOTES one
+	 */
+	Animator(const PianoTutorPlusConfig& config, Compositor& compositor);
+
+	/**
+	 * Release the frame clock
+	 */
+	~Animator();
+
+	/**
+	 * Take the envelope times, the frame rate and the LED spans from a new
+	 * configuration. The keys keep their levels and go on fading from there
+	 * 
+	 * @param	config		configuration providing the LED spans and the envelopes
+	 */
+	void configure(const PianoTutorPlusConfig& config);
+
+	/**
+	 * Fade a key in, towards the provided color. A key already lit switches
+	 * to the new color at its current level
+	 * 
+	 * @param	note	MIDI note of the key
+	 * @param	color	color of the key at full level
+	 */
+	void press(unsigned char note, ws2811_led_t color);
+
+	/**
+	 * Fade a key out, keeping its color
+	 * 
+	 * @param	note	MIDI note of the key
+	 */
+	void release(unsigned char note);
+
+	/**
+	 * Switch off all the keys at once, stopping the frame clock. The LEDs are
+	 * left untouched
+	 */
+	void clear();
+
+	/**
+	 * Advance the envelopes of the keys being animated, writing their LEDs, and
+	 * stop the frame clock when no key is left to animate
+	 * 
+	 * @param	count	number of frames elapsed
+	 * 
+	 * @return	number of keys still being animated
+	 */
+	unsigned int advance(uint64_t count = 1);
+
+	/**
+	 * Consume the expirations of the frame clock, advancing the envelopes by
+	 * as many frames
+	 * 
+	 * @return	number of keys still being animated
+	 */
+	unsigned int tick();
+
+	// list of getters
+	int getFd() const { return timerFd; }
+	unsigned int getActiveKeys() const { return activeKeys; }
+	unsigned long getFrames() const { return frames; }
+};
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __BATCHSTATS_H__
+#define __BATCHSTATS_H__
+
+#include <ostream>
+
+#define BATCH_STATS_BUCKETS	6
+
+/**
+ * Counters describing how MIDI events are grouped into batches by the main loop.
+ * Every batch (all the events drained in a single wakeup) costs a single render,
+ * so the difference between rendering events one by one and rendering batches is
+ * tracked as the number of renders saved
+ */
+class BatchStats {
+
+	unsigned long batches;
+	unsigned long events;
+	unsigned long renders;
+	unsigned long maxBatch;
+
+	// batch-size distribution: 1, 2-3, 4-7, 8-15, 16-31, 32+
+	unsigned long sizes[BATCH_STATS_BUCKETS];
+
+public:
+
+	/**
+	 * Build the object with all the counters set to zero
+	 */
+	BatchStats();
+
+	/**
+	 * Record a drained batch
+	 * 
+	 * @param	size		number of events in the batch
+	 * @param	rendered	true if the batch triggered a render
+	 */
+	void record(unsigned long size, bool rendered);
+
+	// list of getters
+	unsigned long getBatches() const { return batches; }
+	unsigned long getEvents() const { return events; }
+	unsigned long getRenders() const { return renders; }
+	unsigned long getMaxBatch() const { return maxBatch; }
+	unsigned long getRendersSaved() const { return events - renders; }
+
+	/**
+	 * Print a human-readable summary of the counters
+	 * 
+	 * @param	os		output stream
+	 */
+	void print(std::ostream& os) const;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define NS_PER_US	1000ull
+#define NS_PER_MS	1000000ull
+#define NS_PER_SEC	1000000000ull
+
+/**
+ * Namespace gathering the time helpers. All the timestamps of the program are
+ * CLOCK_MONOTONIC nanoseconds
+ */
+namespace Clock {
+
+	/**
+	 * Return the current time
+	 * 
+	 * @return	CLOCK_MONOTONIC time, in ns
+	 */
+	inline uint64_t now() {
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+	}
+
+	/**
+	 * Convert a time into a timespec
+	 * 
+	 * @param	ns		time, in ns
+	 * 
+	 * @return	corresponding timespec
+	 */
+	inline timespec toTimespec(uint64_t ns) {
+		timespec ts;
+		ts.tv_sec = ns / NS_PER_SEC;
+		ts.tv_nsec = ns % NS_PER_SEC;
+		return ts;
+	}
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __COLORCORRECTION_H__
+#define __COLORCORRECTION_H__
+
+#include <stdint.h>
+
+#include "LedBackend.h"
+
+#define VELOCITIES	128
+
+/**
+ * Lookup tables turning the colors chosen by the program into the values sent
+ * to a specific strip. A gamma curve makes the brightness steps perceptually
+ * even, and a per-channel white balance compensates the tint of the LEDs; both
+ * are folded into one 256-entry table per channel when the configuration is
+ * loaded, so that correcting a LED costs three table reads. A second table maps
+ * the MIDI velocity of a note to the brightness level of its key
+ */
+class ColorCorrection {
+
+	// red, green and blue tables, in this order
+	alignas(16) uint8_t tables[3][256];
+	uint8_t levels[VELOCITIES];
+	bool identity;
+
+public:
+
+	/**
+	 * Build tables leaving the colors untouched, with every velocity at full
+	 * brightness
+	 */
+	ColorCorrection();
+
+	/**
+	 * Build the tables from the provided curves
+	 * 
+	 * @param	gamma			exponent of the gamma curve, 1 for a linear response
+	 * @param	whiteBalance	maximum value of the red, green and blue channels
+	 * @param	velocityGamma	exponent of the velocity-to-brightness curve, 0 to
+	 * 							show every velocity at full brightness
+	 * @param	minLevel		brightness level of the softest note, from 0 to 255
+	 */
+	ColorCorrection(double gamma, const uint8_t (&whiteBalance)[3], double velocityGamma, uint8_t minLevel);
+
+	/**
+	 * Return the brightness level of a note played with the provided velocity
+	 * 
+	 * @param	velocity	MIDI velocity
+	 * 
+	 * @return	brightness level, from 0 to 255
+	 */
+	uint8_t getLevel(uint8_t velocity) const { return levels[velocity & (VELOCITIES - 1)]; }
+
+	/**
+	 * Return true if the tables leave the colors untouched, so that the frames
+	 * can be sent as they are
+	 */
+	bool isIdentity() const { return identity; }
+
+	/**
+	 * Correct a frame, with the fastest implementation available on the target
+	 * (NEON on 64-bit ARM, the scalar one elsewhere)
+	 * 
+	 * @param	in		values of the LEDs
+	 * @param	out		corrected values, it can be the same array as in
+	 * @param	count	number of LEDs
+	 */
+	void apply(const ws2811_led_t* in, ws2811_led_t* out, unsigned int count) const;
+
+	/**
+	 * Correct a frame one LED at a time. It is the reference the vectorised
+	 * implementations must match exactly
+	 * 
+	 * @param	in		values of the LEDs
+	 * @param	out		corrected values, it can be the same array as in
+	 * @param	count	number of LEDs
+	 */
+	void applyScalar(const ws2811_led_t* in, ws2811_led_t* out, unsigned int count) const;
+
+	/**
+	 * Scale each channel of a color by a brightness level, rounding to the
+	 * nearest value
+	 * 
+	 * @param	color	0xWWRRGGBB color
+	 * @param	level	brightness level, 255 leaves the color untouched
+	 * 
+	 * @return	scaled color
+	 */
+	static ws2811_led_t scale(ws2811_led_t color, uint8_t level);
+};
+
+#endif
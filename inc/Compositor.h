@@ -0,0 +1,178 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __COMPOSITOR_H__
+#define __COMPOSITOR_H__
+
+#include <stdint.h>
+
+#include "LedBackend.h"
+#include "LedStrip.h"
+
+#define COMPOSITOR_ALIGNMENT	64	// every plane starts on its own cache line
+#define COMPOSITOR_BLOCK		16	// LEDs blended at once by the vector kernels
+
+/**
+ * Stack of layers composed into the frame of a strip, so that several things
+ * can be shown on the same key at once (ex. the keys played over the hints of
+ * the notes to come). Each layer stores a color and an alpha per LED, as
+ * separate cache-aligned planes of bytes, and the layers are blended bottom to
+ * top over black. Only the LEDs touched since the last composition are blended,
+ * 16 at a time with NEON or SSE2 where available, with a scalar fallback
+ */
+class Compositor {
+
+public:
+
+	/**
+	 * Layers, from the bottom to the top one
+	 */
+	enum Layer {
+		AMBIENT,	// idle animations
+		HINTS,		// notes to come
+		NOTES,		// keys being played
+		ALERTS,		// flashes over everything else
+		LAYERS
+	};
+
+private:
+
+	unsigned short count;
+	unsigned int stride;	// LEDs per plane, rounded up to whole cache lines
+
+	// red, green, blue and alpha planes of every layer, in this order
+	uint8_t* planes;
+	ws2811_led_t* output;
+
+	// layers with at least one visible LED, and LEDs touched since the last composition
+	unsigned int usedLayers;
+	unsigned int dirtyFirst;
+	unsigned int dirtyEnd;
+
+	/**
+	 * Return a plane of a layer
+	 * 
+	 * @param	layer		layer
+	 * @param	component	0 for red, 1 for green, 2 for blue and 3 for alpha
+	 * 
+	 * @return	first byte of the plane
+	 */
+	uint8_t* plane(unsigned int layer, unsigned int component) const {
+		return planes + (layer * 4 + component) * stride;
+	}
+
+public:
+
+	/**
+	 * Build the layers of a strip, all of them transparent. In case of error
+	 * a LedStripException is thrown
+	 * 
+	 * @param	count	number of LEDs in the strip
+	 */
+	Compositor(unsigned short count);
+
+	/**
+	 * Release the layers
+	 */
+	~Compositor();
+
+	Compositor(const Compositor&) = delete;
+	Compositor& operator=(const Compositor&) = delete;
+
+	/**
+	 * Change the number of LEDs, making all the layers transparent again. In
+	 * case of error a LedStripException is thrown and the layers are kept
+	 * 
+	 * @param	count	number of LEDs in the strip
+	 */
+	void resize(unsigned short count);
+
+	/**
+	 * Set the color of a LED in a layer
+	 * 
+	 * @param	layer	layer to draw on
+	 * @param	pos		position of the LED in the strip
+	 * @param	color	color as 0x00RRGGBB
+	 * @param	alpha	opacity, from 0 (transparent) to 255 (opaque)
+	 */
+	void setColor(Layer layer, unsigned short pos, ws2811_led_t color, uint8_t alpha = 255);
+
+	/**
+	 * Make a LED of a layer transparent
+	 * 
+	 * @param	layer	layer to draw on
+	 * @param	pos		position of the LED in the strip
+	 */
+	void clear(Layer layer, unsigned short pos) { setColor(layer, pos, 0, 0); }
+
+	/**
+	 * Make a whole layer transparent
+	 * 
+	 * @param	layer	layer to clear
+	 */
+	void clearLayer(Layer layer);
+
+	/**
+	 * Blend the LEDs touched since the last composition and write them to the
+	 * back buffer of the strip, which is not rendered
+	 * 
+	 * @param	strip	strip receiving the frame
+	 * 
+	 * @return	true if any LED was blended
+	 */
+	bool composite(LedStrip& strip);
+
+	/**
+	 * Blend a range of LEDs into the output frame, with the fastest
+	 * implementation available on the target
+	 * 
+	 * @param	first	first LED, multiple of COMPOSITOR_BLOCK
+	 * @param	end		LED after the last one, multiple of COMPOSITOR_BLOCK
+	 */
+	void blend(unsigned int first, unsigned int end);
+
+	/**
+	 * Reference implementation of blend(), one LED at a time
+	 * 
+	 * @param	first	first LED
+	 * @param	end		LED after the last one
+	 */
+	void blendScalar(unsigned int first, unsigned int end);
+
+	/**
+	 * Return the output frame, as left by the last blend
+	 * 
+	 * @return	values of the LEDs
+	 */
+	const ws2811_led_t* getOutput() const { return output; }
+
+	unsigned short getCount() const { return count; }
+};
+
+#endif
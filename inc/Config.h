@@ -61,6 +61,16 @@ public:
 	 */
 	std::string operator[](const std::string& key);
 
+	/**
+	 * Return the value associated to an optional key
+	 * 
+	 * @param	key				key of the pair
+	 * @param	defaultValue	value returned if the key is not present
+	 * 
+	 * @return	the value associated to that key, or the default one
+	 */
+	std::string get(const std::string& key, const std::string& defaultValue) const;
+
 	/**
 	 * Parse the provided string, returning the integer value
 	 * 
@@ -103,10 +113,32 @@ public:
  * Exception thrown dealing with file opening
  */
 class OpenFileException : public std::exception {
+private:
+	/**
+	 * Name of the file which could not be opened
+	 */
+	std::string filename;
+
 public:
+	/**
+	 * Constructor
+	 * 
+	 * @param	filename	name of the file which could not be opened
+	 */
+	OpenFileException(const std::string& filename) : filename(filename) {}
+
 	virtual const char* what() const throw() {
 		return "OpenFileException";
 	}
+
+	/**
+	 * Get the name of the file which could not be opened
+	 * 
+	 * @return	name of the file
+	 */
+	const std::string& getFilename() const {
+		return filename;
+	}
 };
 
 /**
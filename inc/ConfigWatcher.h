@@ -0,0 +1,84 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __CONFIGWATCHER_H__
+#define __CONFIGWATCHER_H__
+
+#include <string>
+#include <vector>
+
+/**
+ * Watch a set of configuration files through inotify, telling which of them
+ * have been rewritten. The directories holding the files are watched rather
+ * than the files themselves, so that the editors replacing a file with a new
+ * one (written aside, then renamed over it) are caught as well
+ */
+class ConfigWatcher {
+
+	int fd;
+
+	// watch descriptor of the directory of each file, and name within it
+	std::vector<int> watches;
+	std::vector<std::string> names;
+
+public:
+
+	/**
+	 * Start watching the provided files. If inotify is not available, a warning
+	 * is printed and no change is ever reported
+	 * 
+	 * @param	files	names of the configuration files
+	 */
+	ConfigWatcher(const std::vector<std::string>& files);
+
+	/**
+	 * Stop watching the files
+	 */
+	~ConfigWatcher();
+
+	ConfigWatcher(const ConfigWatcher&) = delete;
+	ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+	/**
+	 * Read the pending notifications, collecting the files written since the
+	 * last call. Each file is reported once, however many times it was written
+	 * 
+	 * @param	changed		vector receiving the indexes of the changed files
+	 */
+	void readChanges(std::vector<size_t>& changed);
+
+	/**
+	 * Return the descriptor to be watched for input
+	 * 
+	 * @return	inotify file descriptor, -1 if the files are not watched
+	 */
+	int getFd() const { return fd; }
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __EVENTLOOP_H__
+#define __EVENTLOOP_H__
+
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <poll.h>
+#include <signal.h>
+#include <vector>
+
+/**
+ * Simple event loop built on top of poll(). File descriptors (MIDI sequencer,
+ * timers, sockets, ...) are registered together with a callback, which is invoked
+ * as soon as the descriptor becomes ready. Signals are delivered synchronously
+ * through a signalfd, so their handlers run in the loop like any other event
+ */
+class EventLoop {
+
+	std::vector<pollfd> fds;
+	std::deque<std::function<void(short)>> handlers;	// references survive push_back
+
+	std::map<int, std::function<void()>> signalHandlers;
+	sigset_t signalMask;
+	int signalFd;
+
+	bool running;
+
+	/**
+	 * Read all the pending signals from the signalfd, invoking the registered handlers
+	 */
+	void dispatchSignals();
+
+public:
+
+	/**
+	 * Build an empty event loop
+	 */
+	EventLoop();
+
+	/**
+	 * Destroy the event loop, closing the signalfd (if any)
+	 */
+	~EventLoop();
+
+	/**
+	 * Watch a file descriptor, invoking the handler when one of the requested
+	 * events occurs
+	 * 
+	 * @param	fd			file descriptor to watch
+	 * @param	events		poll() events of interest (ex. POLLIN)
+	 * @param	handler		callback to execute, receiving the returned events
+	 * 
+	 * @return	reference to the object
+	 */
+	EventLoop& addFd(int fd, short events, std::function<void(short)> handler);
+
+	/**
+	 * Handle the provided signal inside the loop. The signal is blocked for the
+	 * calling thread, so this method has to be called before spawning any other
+	 * thread, which would otherwise still receive it asynchronously. In case of
+	 * error an EventLoopException is thrown
+	 * 
+	 * @param	signum		number of the signal
+	 * @param	handler		callback to execute when the signal is received
+	 * 
+	 * @return	reference to the object
+	 */
+	EventLoop& addSignal(int signum, std::function<void()> handler);
+
+	/**
+	 * Block waiting for events and dispatch them, until stop() is called
+	 */
+	void run();
+
+	/**
+	 * Make run() return after the current iteration
+	 */
+	void stop();
+};
+
+/**
+ * Exception thrown dealing with the event loop
+ */
+class EventLoopException : public std::exception {
+	virtual const char* what() const throw() {
+		return "EventLoopException";
+	}
+};
+
+#endif
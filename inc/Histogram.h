@@ -0,0 +1,103 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS		3	// 8 buckets per power of two, at most 12.5% error
+#define HISTOGRAM_SUB_BUCKETS	(1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS		((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Lock-free histogram of durations with a fixed set of log-linear buckets. Any
+ * thread can record values concurrently, while another thread reads them
+ */
+class Histogram {
+
+	std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> max;
+
+	/**
+	 * Return the bucket holding the provided value
+	 */
+	static unsigned int bucketOf(uint64_t value);
+
+	/**
+	 * Return the highest value held by the provided bucket
+	 */
+	static uint64_t upperBound(unsigned int bucket);
+
+public:
+
+	/**
+	 * Build an empty histogram
+	 */
+	Histogram();
+
+	/**
+	 * Add a value to the histogram
+	 * 
+	 * @param	value	value to record (ex. a duration in ns)
+	 */
+	void record(uint64_t value) {
+		buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t current = max.load(std::memory_order_relaxed);
+		while(value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed));
+	}
+
+	/**
+	 * Return the value below which the provided fraction of the recorded values lies
+	 * 
+	 * @param	fraction	fraction of the values, between 0 and 1 (ex. 0.99)
+	 * 
+	 * @return	upper bound of the bucket holding the percentile
+	 */
+	uint64_t getPercentile(double fraction) const;
+
+	// list of getters
+	uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+	uint64_t getMax() const { return max.load(std::memory_order_relaxed); }
+
+	/**
+	 * Print count, p50, p99, p999 and max, converting ns into us
+	 * 
+	 * @param	os		output stream
+	 * @param	name	name of the histogram
+	 */
+	void print(std::ostream& os, const char* name) const;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __KEYSTATE_H__
+#define __KEYSTATE_H__
+
+#include <stdint.h>
+
+#include "NoteName.h"
+
+#define KEY_STATE_HOLDERS	32	// one per palette entry
+
+/**
+ * Polyphonic state of the keyboard. For every note it counts how many times each
+ * holder (ex. each part of the score) is currently pressing it, so overlapping or re-triggered
+ * notes do not switch the key off while it is still held. The holder shown on a
+ * key is the one with the lowest index among the active ones. A count which
+ * reaches its maximum sticks there until clear(), keeping the key held rather
+ * than switching it off too early
+ */
+class KeyState {
+
+	uint16_t counts[MIDI_NOTES][KEY_STATE_HOLDERS];
+
+	// bitset of the holders with a non-zero count, per note
+	uint32_t active[MIDI_NOTES];
+
+public:
+
+	/**
+	 * Build the object with all the keys released
+	 */
+	KeyState();
+
+	/**
+	 * Register a key press
+	 * 
+	 * @param	note	MIDI note
+	 * @param	holder	index of the holder pressing the key
+	 * 
+	 * @return	true if the holder shown on the key changed
+	 */
+	bool press(unsigned char note, unsigned int holder);
+
+	/**
+	 * Register a key release. Releases without a matching press are ignored
+	 * 
+	 * @param	note	MIDI note
+	 * @param	holder	index of the holder releasing the key
+	 * 
+	 * @return	true if the holder shown on the key changed
+	 */
+	bool release(unsigned char note, unsigned int holder);
+
+	/**
+	 * Return the holder shown on the provided key
+	 * 
+	 * @param	note	MIDI note
+	 * 
+	 * @return	index of the holder, -1 if the key is released
+	 */
+	int getHolder(unsigned char note) const {
+		uint32_t mask = active[note & (MIDI_NOTES - 1)];
+		return mask ? __builtin_ctz(mask) : -1;
+	}
+
+	/**
+	 * Release all the keys
+	 */
+	void clear();
+};
+
+#endif
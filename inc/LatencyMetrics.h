@@ -0,0 +1,100 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __LATENCYMETRICS_H__
+#define __LATENCYMETRICS_H__
+
+#include <ostream>
+#include <string>
+
+#include "Histogram.h"
+
+/**
+ * Latency histograms of the stages an event goes through, from its arrival at
+ * the sequencer to the LEDs being lit
+ */
+class LatencyMetrics {
+
+public:
+
+	enum Stage {
+		DEQUEUE,	// arrival -> read by the main loop (per event)
+		MAP,		// read -> LEDs updated in the back buffer (per event)
+		SUBMIT,		// batch mapped -> frame published to the render thread (per frame)
+		COMPLETE,	// frame published -> transfer complete (per frame)
+		TOTAL,		// oldest event of the frame -> transfer complete (per frame)
+		STAGES
+	};
+
+private:
+
+	Histogram histograms[STAGES];
+
+	// description of the real-time settings in effect
+	std::string settings;
+
+public:
+
+	/**
+	 * Record the duration of a stage
+	 * 
+	 * @param	stage	stage of the pipeline
+	 * @param	from	start of the stage, in ns
+	 * @param	to		end of the stage, in ns
+	 */
+	void record(Stage stage, uint64_t from, uint64_t to) {
+		histograms[stage].record(to > from ? to - from : 0);
+	}
+
+	/**
+	 * Set the description of the real-time settings in effect, printed along
+	 * with the histograms
+	 * 
+	 * @param	settings	description of the settings
+	 */
+	void setSettings(const std::string& settings) { this->settings = settings; }
+
+	/**
+	 * Return the histogram of a stage
+	 * 
+	 * @param	stage	stage of the pipeline
+	 * 
+	 * @return	histogram of the stage
+	 */
+	const Histogram& get(Stage stage) const { return histograms[stage]; }
+
+	/**
+	 * Print the percentiles of all the stages
+	 * 
+	 * @param	os		output stream
+	 */
+	void print(std::ostream& os) const;
+};
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __LEDBACKEND_H__
+#define __LEDBACKEND_H__
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#ifndef NO_WS2811
+#include "ws2811.h" // from https://github.com/jgarff/rpi_ws281x
+#else
+typedef uint32_t ws2811_led_t;
+#endif
+
+class PianoTutorPlusConfig;
+
+#define LED_CHANNELS	2
+
+/**
+ * Settings of one of the two output channels of the ws2811 library. A channel
+ * with GPIO pin 0 is disabled
+ */
+struct LedChannel {
+	unsigned char gpioPin;
+	int stripType;
+	unsigned int count;
+	unsigned char brightness;
+};
+
+/**
+ * Piece of the logical strip driven by a channel: the LEDs first..first+count-1
+ * are copied to the channel starting from offset, in reverse order if requested
+ */
+struct LedSegment {
+	unsigned short first;
+	unsigned short count;
+	unsigned char channel;
+	unsigned short offset;
+	bool reversed;
+};
+
+/**
+ * Namespace to deal with LED backend definitions. It allows to parse backends to and 
+ * from string, manage parsing errors and obtain the list of available backends
+ */
+namespace LedBackendType {
+	enum Type {
+		WS2811,		// rpi_ws281x library, driving a real strip
+		NONE,		// frames are discarded
+		MEMORY,		// frames are kept in memory
+		FILE		// frames are dumped to a binary file
+	};
+
+	/**
+	 * Exception thrown dealing with backend parsing
+	 */
+	class LedBackendNotFoundException : public std::exception {
+		virtual const char* what() const throw() {
+			return "LedBackendNotFoundException";
+		}
+	};
+
+	/**
+	 * Parse a string, obtaining the corresponding backend. Only the backends
+	 * built into the program are accepted
+	 * 
+	 * @param	type	string representing the backend
+	 * 
+	 * @return	corresponding Type value
+	 */
+	Type parse(std::string type);
+
+	/**
+	 * Return the name of the provided backend
+	 * 
+	 * @param	type	backend
+	 * 
+	 * @return	name of the backend
+	 */
+	const char* toString(Type type);
+
+	/**
+	 * Return the list of all the backends built into the program
+	 * 
+	 * @return	vector containing all the available backends
+	 */
+	const std::vector<Type>& getAllBackendTypes();
+}
+
+/**
+ * Interface of the output stage of a LedStrip: it receives complete frames and
+ * transfers them to the LEDs (or wherever they have to go)
+ */
+class LedBackend {
+
+public:
+
+	virtual ~LedBackend() {}
+
+	/**
+	 * Start the transfer of a frame. The frame can be reused as soon as the
+	 * method returns
+	 * 
+	 * @param	leds		values of the LEDs
+	 * @param	count		number of LEDs
+	 * @param	brightness	brightness of the whole strip
+	 */
+	virtual void render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) = 0;
+
+	/**
+	 * Block until the last transfer is complete
+	 */
+	virtual void wait() = 0;
+
+	/**
+	 * Set the brightness of an output channel, used from the next frame on.
+	 * Backends without channels ignore it
+	 * 
+	 * @param	channel		output channel
+	 * @param	brightness	brightness of the channel
+	 */
+	virtual void setChannelBrightness(unsigned char channel, unsigned char brightness) {}
+
+	/**
+	 * Map the logical strip on the output channels with new segments, used
+	 * from the next frame on. They must fit the channels the backend was
+	 * built with. Backends without channels ignore them
+	 * 
+	 * @param	segments	mapping of the logical strip on the channels
+	 */
+	virtual void setSegments(const std::vector<LedSegment>& segments) {}
+
+	/**
+	 * Build the backend selected by the configuration. In case of error a
+	 * LedStripException is thrown
+	 * 
+	 * @param	config	program configuration
+	 * 
+	 * @return	the new backend
+	 */
+	static std::unique_ptr<LedBackend> create(const PianoTutorPlusConfig& config);
+};
+
+#ifndef NO_WS2811
+/**
+ * Backend driving up to two real strips through the rpi_ws2811 library. The
+ * logical strip is split among the channels by a list of segments, and both
+ * channels are sent with a single DMA transfer
+ */
+class Ws2811Backend : public LedBackend {
+
+	ws2811_t ledstring;
+	std::atomic<unsigned char> channelBrightness[LED_CHANNELS];
+
+	// latest mapping set, swapped atomically, and the one the channels were last filled with
+	std::shared_ptr<const std::vector<LedSegment>> segments;
+	std::shared_ptr<const std::vector<LedSegment>> mapped;
+
+	/**
+	 * Keep the segments fitting the channels, dropping the ones on a disabled
+	 * channel or past its end
+	 * 
+	 * @param	segments	mapping of the logical strip on the channels
+	 * 
+	 * @return	the segments kept
+	 */
+	std::shared_ptr<const std::vector<LedSegment>> fit(const std::vector<LedSegment>& segments) const;
+
+public:
+
+	/**
+	 * Initialize the library starting from the provided parameters. In case of
+	 * error a LedStripException is thrown
+	 * 
+	 * @param	freq		driving frequency
+	 * @param	dmaChannel	number of the DMA channel
+	 * @param	channels	settings of the two output channels
+	 * @param	segments	mapping of the logical strip on the channels
+	 */
+	Ws2811Backend(unsigned int freq, unsigned char dmaChannel, const LedChannel (&channels)[LED_CHANNELS],
+			const std::vector<LedSegment>& segments);
+
+	/**
+	 * Release the library resources
+	 */
+	~Ws2811Backend();
+
+	void render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) override;
+	void wait() override;
+	void setChannelBrightness(unsigned char channel, unsigned char brightness) override;
+	void setSegments(const std::vector<LedSegment>& segments) override;
+};
+#endif
+
+/**
+ * Base class of the backends not driving any hardware. If requested, the time a
+ * real strip would take to receive a frame (24 bits per LED at the driving
+ * frequency, plus the reset time) is simulated by wait()
+ */
+class SimulatedBackend : public LedBackend {
+
+	unsigned int freq;
+	bool simulateDma;
+	unsigned int transferLeds;
+	timespec transferEnd;
+
+public:
+
+	/**
+	 * Build the backend
+	 * 
+	 * @param	freq			driving frequency of the simulated strip
+	 * @param	simulateDma		true to make wait() last as a real transfer
+	 */
+	SimulatedBackend(unsigned int freq, bool simulateDma);
+
+	/**
+	 * Set the number of LEDs of the longest channel, which is what bounds the
+	 * length of a transfer when the strip is split on more channels
+	 * 
+	 * @param	leds	LEDs sent per transfer, 0 to use the length of the frame
+	 */
+	void setTransferLength(unsigned int leds) { transferLeds = leds; }
+
+	void render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) override;
+	void wait() override;
+};
+
+/**
+ * Backend discarding all the frames
+ */
+class NullBackend : public SimulatedBackend {
+
+public:
+
+	NullBackend(unsigned int freq, bool simulateDma) : SimulatedBackend(freq, simulateDma) {}
+};
+
+/**
+ * Backend keeping the rendered frames in memory, so that they can be inspected
+ */
+class MemoryBackend : public SimulatedBackend {
+
+	mutable std::mutex mutex;
+	std::vector<std::vector<ws2811_led_t>> frames;
+
+public:
+
+	MemoryBackend(unsigned int freq, bool simulateDma) : SimulatedBackend(freq, simulateDma) {}
+
+	void render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) override;
+
+	/**
+	 * Return a copy of all the frames rendered so far
+	 * 
+	 * @return	vector of frames, oldest first
+	 */
+	std::vector<std::vector<ws2811_led_t>> getFrames() const;
+
+	/**
+	 * Forget all the frames rendered so far
+	 */
+	void clear();
+};
+
+/**
+ * Backend appending the rendered frames to a binary file. Each frame is stored as
+ * a 64-bit CLOCK_MONOTONIC timestamp in nanoseconds, a 32-bit LED count, the 8-bit
+ * brightness and 3 padding bytes, followed by the 32-bit LED values (host endianness)
+ */
+class FileBackend : public SimulatedBackend {
+
+	FILE* file;
+
+public:
+
+	/**
+	 * Open the output file. In case of error a LedStripException is thrown
+	 * 
+	 * @param	filename		name of the output file
+	 * @param	freq			driving frequency of the simulated strip
+	 * @param	simulateDma		true to make wait() last as a real transfer
+	 */
+	FileBackend(const std::string& filename, unsigned int freq, bool simulateDma);
+
+	/**
+	 * Flush and close the output file
+	 */
+	~FileBackend();
+
+	void render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) override;
+};
+
+#endif
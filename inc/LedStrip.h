@@ -29,12 +29,18 @@
 #ifndef __LEDSTRIP_H__
 #define __LEDSTRIP_H__
 
+#include <atomic>
 #include <exception>
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "ws2811.h" // from https://github.com/jgarff/rpi_ws281x
+#include "ColorCorrection.h"
+#include "LatencyMetrics.h"
+#include "LedBackend.h"
+#include "RenderPool.h"
 
 /**
  * Namespace to deal with color definitions. It allows to parse colors to and 
@@ -70,6 +76,16 @@ namespace LedColor {
 	 */
 	Color parse(std::string color);
 
+	/**
+	 * Parse a string holding either the name of a color or an arbitrary one,
+	 * written as 0xRRGGBB or rgb(R, G, B) with components from 0 to 255
+	 * 
+	 * @param	color	string representing the color
+	 * 
+	 * @return	color as 0x00RRGGBB, ready to be sent to the strip
+	 */
+	ws2811_led_t parseRgb(std::string color);
+
 	/**
 	 * Return the name of the provided color
 	 * 
@@ -84,7 +100,7 @@ namespace LedColor {
 	 * 
 	 * @return	vector containing all the available colors
 	 */
-	std::vector<Color> getAllColors();
+	const std::vector<Color>& getAllColors();
 }
 
 /**
@@ -133,7 +149,7 @@ namespace StripType {
 	 * 
 	 * @return	vector containing all the available strip types
 	 */
-	std::vector<Type> getAllStripTypes();
+	const std::vector<Type>& getAllStripTypes();
 }
 
 /**
@@ -171,7 +187,7 @@ namespace LedOrder {
 	 * 
 	 * @return	name of the order
 	 */
-	std::vector<Order> getAllLedOrders();
+	const std::vector<Order>& getAllLedOrders();
 
 	/**
 	 * Return the list of all the available LED orders
@@ -182,26 +198,110 @@ namespace LedOrder {
 }
 
 /**
- * Simple class which wraps the functionalities offered by the rpi_ws2811 library,
- * allowing to interact with the LED strip
+ * Simple class allowing to interact with the LED strip. The frames are sent through
+ * a LedBackend, which drives the real strip (ex. with the rpi_ws2811 library) or a
+ * simulated one.
+ * 
+ * The caller edits a back buffer and publishes it with render(); the transfer to
+ * the strip is performed by a dedicated thread, so the caller never waits for the
+ * DMA. Frames are handed over through a single slot, swapped atomically: if a new
+ * frame is published before the render thread picks up the previous one, the older
+ * frame is dropped and only the latest one is sent. When many strips are driven by
+ * the same process, the frames can be sent by a shared RenderPool instead of a
+ * thread per strip
  */ 
 class LedStrip {
 
-    ws2811_t ledstring;
+	friend class RenderPool;
+
+	std::unique_ptr<LedBackend> backend;
+
+	// back buffer, edited by the caller
+	std::vector<ws2811_led_t> frame;
+
+	// handoff buffers: one owned by the caller, one by the render thread and the
+	// shared one, whose index is stored in the slot along with the FRESH flag
+	std::vector<ws2811_led_t> buffers[3];
+	// per buffer: arrival of the oldest event shown and time it was published, in ns
+	uint64_t eventStamps[3];
+	uint64_t publishStamps[3];
+	unsigned int publishBuffer;
+	unsigned int renderBuffer;
+	std::atomic<unsigned int> slot;
+
+	std::atomic<unsigned char> brightness;
+	std::atomic<bool> stopping;
+	int wakeFd;
+	std::thread renderThread;
+
+	// shared workers sending the frames instead of the render thread, if any,
+	// and flag set while the strip is queued or being served by them
+	RenderPool* pool;
+	std::atomic<bool> poolOwned;
+
+	// true if the LEDs changed since the last render
+	bool dirty;
+
+	unsigned long changedLeds;
+	unsigned long renders;
+	unsigned long skippedRenders;
+	unsigned long droppedFrames;
+	std::atomic<unsigned long> sentFrames;
+
+	LatencyMetrics* metrics;
+
+	// correction applied to the next frames, the one each handoff buffer was
+	// published with, and the output of the render thread
+	std::shared_ptr<const ColorCorrection> correction;
+	std::shared_ptr<const ColorCorrection> corrections[3];
+	std::vector<ws2811_led_t> corrected;
+
+	/**
+	 * Write a value into the desired LED, marking the frame as dirty only if
+	 * the value actually changed
+	 * 
+	 * @param	pos		position of the LED in the strip
+	 * @param	value	raw value of the LED
+	 */
+	void write(unsigned short pos, ws2811_led_t value);
+
+	/**
+	 * Body of the render thread: wait for published frames and send them to
+	 * the strip, one at a time
+	 */
+	void renderLoop();
+
+	/**
+	 * Send the last published frame, if it has not been sent yet
+	 */
+	void sendPublished();
+
+	/**
+	 * Invoked by a worker of the pool: send the published frames until none is
+	 * left, then give the strip back to the pool
+	 */
+	void renderQueued();
+
+	/**
+	 * Send the provided frame through the backend, waiting for the transfer
+	 * to complete
+	 * 
+	 * @param	leds		frame to send
+	 * @param	correction	tables to apply, or nullptr to send the frame as it is
+	 */
+	void send(const std::vector<ws2811_led_t>& leds, const ColorCorrection* correction);
 
 public:
 
 	/**
-	 * Initialize the LED strip starting from the provided parameters. In case of error a
-	 * LedStripException is thrown
+	 * Initialize the LED strip, starting the render thread unless a pool is
+	 * provided. In case of error a LedStripException is thrown
 	 * 
-	 * @param	freq		driving frequency
-	 * @param	dmaChannel	number of the DMA channel
-	 * @param	gpioPin		number of the GPIO pin
-	 * @param	stripType	type of the LED strip
+	 * @param	backend		output stage receiving the frames
 	 * @param	count		number of LEDs in the strip
+	 * @param	pool		workers sending the frames, nullptr for a dedicated thread
 	 */
-    LedStrip(unsigned int freq, unsigned char dmaChannel, unsigned char gpioPin, StripType::Type stripType, unsigned char count);
+    LedStrip(std::unique_ptr<LedBackend> backend, unsigned short count, RenderPool* pool = nullptr);
    
 	/**
 	 * Destroy the LedStrip object and perfrom clean-up
@@ -224,7 +324,28 @@ public:
 	 * 
 	 * @return	a reference to the object
 	 */
-    LedStrip& switchOn(unsigned char pos, LedColor::Color color);
+    LedStrip& switchOn(unsigned short pos, LedColor::Color color);
+
+	/**
+	 * Set the desired LED to a raw 0xWWRRGGBB value
+	 * 
+	 * @param	pos		position of the LED in the strip
+	 * @param	value	raw value of the LED
+	 * 
+	 * @return	a reference to the object
+	 */
+    LedStrip& setColor(unsigned short pos, ws2811_led_t value);
+
+	/**
+	 * Copy a range of raw 0xWWRRGGBB values into the LEDs
+	 * 
+	 * @param	first	position of the first LED in the strip
+	 * @param	values	raw values of the LEDs
+	 * @param	count	number of LEDs
+	 * 
+	 * @return	a reference to the object
+	 */
+    LedStrip& setColors(unsigned short first, const ws2811_led_t* values, unsigned short count);
 
 	/**
 	 * Switch off the desired LED
@@ -233,7 +354,7 @@ public:
 	 * 
 	 * @return	a reference to the object
 	 */
-    LedStrip& switchOff(unsigned char pos);
+    LedStrip& switchOff(unsigned short pos);
 
 	/**
 	 * Switch off all the LEDs in the strip
@@ -243,9 +364,73 @@ public:
     LedStrip& clearAll();
 
 	/**
-	 * Send commands to switch on/off the LEDs in the strip
+	 * Set the metrics receiving the render latencies. It must be called before
+	 * the first render
+	 * 
+	 * @param	metrics		latency metrics, or nullptr to disable them
+	 * 
+	 * @return	a reference to the object
+	 */
+    LedStrip& setMetrics(LatencyMetrics* metrics);
+
+	/**
+	 * Set the gamma and white balance correction applied to every frame right
+	 * before it is sent. It can be changed between two renders: every frame is
+	 * corrected with the tables set when it was published, which are kept alive
+	 * until the frame is gone
+	 * 
+	 * @param	correction	tables to apply, or nullptr to send the frames as they are
+	 * 
+	 * @return	a reference to the object
+	 */
+    LedStrip& setColorCorrection(std::shared_ptr<const ColorCorrection> correction);
+
+	/**
+	 * Set the brightness of an output channel of the backend, shown by the
+	 * next render
+	 * 
+	 * @param	channel		output channel
+	 * @param	brightness	brightness of the channel
+	 * 
+	 * @return	a reference to the object
+	 */
+    LedStrip& setChannelBrightness(unsigned char channel, unsigned char brightness);
+
+	/**
+	 * Map the strip on the output channels of the backend with new segments,
+	 * keeping the number of LEDs of each channel. The next render sends the
+	 * whole frame with the new mapping
+	 * 
+	 * @param	segments	mapping of the strip on the channels
+	 * 
+	 * @return	a reference to the object
+	 */
+    LedStrip& setSegments(const std::vector<LedSegment>& segments);
+
+	/**
+	 * Publish the back buffer to the render thread, which switches on/off the
+	 * LEDs in the strip asynchronously. If nothing changed since the last render,
+	 * the frame is not published at all
+	 * 
+	 * @param	eventStamp	arrival time of the oldest event shown by the frame, in ns
+	 * 						(0 if unknown), used for the end-to-end latency
+	 * 
+	 * @return	true if the frame has been published, false if it was skipped
+	 */
+    bool render(uint64_t eventStamp = 0);
+
+	// list of getters
+	unsigned long getChangedLeds() const { return changedLeds; }
+	unsigned long getRenders() const { return renders; }
+	unsigned long getSkippedRenders() const { return skippedRenders; }
+	unsigned long getDroppedFrames() const { return droppedFrames; }
+	unsigned long getSentFrames() const { return sentFrames.load(); }
+
+	/**
+	 * Return the handle of the render thread, to tune its scheduling. Strips
+	 * served by a pool have no render thread of their own
 	 */
-    void render();
+	std::thread::native_handle_type getRenderThread() { return renderThread.native_handle(); }
 };
 
 /**
@@ -0,0 +1,370 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <atomic>
+#include <exception>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Clock.h"
+
+#define LOG_RING_RECORDS	1024	// records per thread, must be a power of two
+#define LOG_MAX_THREADS		16		// threads which can log at the same time
+#define LOG_RECORD_SIZE		128
+#define LOG_MAX_ARGS		6
+#define LOG_TEXT_LEN		(LOG_RECORD_SIZE - 32 - LOG_MAX_ARGS * 8)
+
+#ifdef DEBUG
+#define LOG_DEFAULT_LEVEL	LogLevel::VERBOSE
+#else
+#define LOG_DEFAULT_LEVEL	LogLevel::WARNING
+#endif
+
+/**
+ * Namespace to deal with log level definitions. It allows to parse levels to and 
+ * from string, manage parsing errors and obtain the list of available levels
+ */
+namespace LogLevel {
+	enum Level {
+		ERROR,
+		WARNING,
+		INFO,
+		VERBOSE,
+		TRACE		// per-event messages
+	};
+
+	/**
+	 * Exception thrown dealing with log level parsing
+	 */
+	class LogLevelNotFoundException : public std::exception {
+		virtual const char* what() const throw() {
+			return "LogLevelNotFoundException";
+		}
+	};
+
+	/**
+	 * Parse a string, obtaining the corresponding level
+	 * 
+	 * @param	level	string representing the level
+	 * 
+	 * @return	corresponding Level value
+	 */
+	Level parse(std::string level);
+
+	/**
+	 * Return the name of the provided level
+	 * 
+	 * @param	level	log level
+	 * 
+	 * @return	name of the level
+	 */
+	const char* toString(Level level);
+
+	/**
+	 * Return the list of all the available levels
+	 * 
+	 * @return	vector containing all the available levels
+	 */
+	const std::vector<Level>& getAllLevels();
+}
+
+/**
+ * Static description of a logging statement: the address of the object is the
+ * site id stored in the records
+ */
+struct LogSite {
+	LogLevel::Level level;
+	const char* function;
+	int line;
+};
+
+/**
+ * Binary log record. Arguments are stored raw and formatted later, following the
+ * conversions of the format string: strings are copied into the record, so that
+ * they can be formatted after the caller released them
+ */
+struct LogRecord {
+	uint64_t timestamp;				// CLOCK_MONOTONIC, in ns
+	const LogSite* site;
+	const char* format;				// string literal
+	uint32_t thread;				// index of the ring the record comes from
+	uint8_t argc;
+	uint8_t textUsed;
+	uint8_t padding[2];
+	uint64_t args[LOG_MAX_ARGS];
+	char text[LOG_TEXT_LEN];		// storage of the string arguments
+};
+
+static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "LogRecord must have a fixed size");
+
+/**
+ * Single-producer single-consumer ring of records, owned by a thread. When full,
+ * new records are dropped (and counted), so the producer never waits. When the
+ * thread exits, the ring is handed over to the next thread which registers
+ */
+class LogRing {
+
+	// producer and consumer indexes lie on different cache lines
+	std::atomic<uint32_t> head;
+	char headPadding[64 - sizeof(std::atomic<uint32_t>)];
+	std::atomic<uint32_t> tail;
+	char tailPadding[64 - sizeof(std::atomic<uint32_t>)];
+
+	std::atomic<uint64_t> dropped;
+	uint32_t index;
+	LogRecord records[LOG_RING_RECORDS];
+
+public:
+
+	/**
+	 * Build an empty ring
+	 * 
+	 * @param	index	index of the ring, stored in its records
+	 */
+	LogRing(uint32_t index) : head(0), tail(0), dropped(0), index(index) {}
+
+	/**
+	 * Return the next free record, or nullptr if the ring is full. The record is
+	 * published by commit()
+	 */
+	LogRecord* reserve() {
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if(h - tail.load(std::memory_order_acquire) == LOG_RING_RECORDS) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		LogRecord* record = &records[h & (LOG_RING_RECORDS - 1)];
+		record->thread = index;
+		return record;
+	}
+
+	/**
+	 * Publish the record returned by reserve()
+	 */
+	void commit() {
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/**
+	 * Return the oldest published record, or nullptr if the ring is empty (consumer side)
+	 */
+	const LogRecord* peek() const {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if(t == head.load(std::memory_order_acquire))
+			return nullptr;
+		return &records[t & (LOG_RING_RECORDS - 1)];
+	}
+
+	/**
+	 * Release the record returned by peek() (consumer side)
+	 */
+	void pop() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	uint32_t getIndex() const { return index; }
+	uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Asynchronous logger. Each thread writes binary records into its own ring, with
+ * no lock and no formatting; a background thread merges the rings by timestamp and
+ * formats the records into the output file. Statements below the current level
+ * cost a single relaxed load. The background thread sleeps until the first
+ * record written after it last ran wakes it up
+ */
+class Logger {
+
+	static std::atomic<int> level;
+
+	/**
+	 * Wake the background thread up after a record was written, unless another
+	 * record already did since it last ran
+	 */
+	static void wake();
+
+	/**
+	 * Return the ring of the calling thread, registering it if needed. Return
+	 * nullptr, counting the record as dropped, if all the LOG_MAX_THREADS rings
+	 * belong to running threads
+	 */
+	static LogRing* getRing();
+
+	/**
+	 * Store an argument into the record
+	 */
+	template<typename T>
+	static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+	store(LogRecord& record, T value) {
+		record.args[record.argc++] = (uint64_t) (int64_t) value;
+	}
+
+	template<typename T>
+	static typename std::enable_if<std::is_floating_point<T>::value>::type
+	store(LogRecord& record, T value) {
+		double d = value;
+		memcpy(&record.args[record.argc++], &d, sizeof(d));
+	}
+
+	static void store(LogRecord& record, const char* value) {
+		// the argument is the offset of the copy, truncated to the free space
+		std::size_t room = LOG_TEXT_LEN - record.textUsed;
+		if(room == 0) {
+			// the last byte is the terminator of the previous string
+			record.args[record.argc++] = LOG_TEXT_LEN - 1;
+			return;
+		}
+
+		std::size_t length = value ? strnlen(value, room - 1) : 0;
+		memcpy(record.text + record.textUsed, value, length);
+		record.text[record.textUsed + length] = '\0';
+		record.args[record.argc++] = record.textUsed;
+		record.textUsed += length + 1;
+	}
+
+	static void store(LogRecord& record, const void* value) {
+		record.args[record.argc++] = (uint64_t) (uintptr_t) value;
+	}
+
+	static void storeAll(LogRecord& record) {}
+
+	template<typename T, typename... Args>
+	static void storeAll(LogRecord& record, T value, Args... args) {
+		store(record, value);
+		storeAll(record, args...);
+	}
+
+public:
+
+	/**
+	 * Return true if the statements of the provided level are recorded
+	 * 
+	 * @param	level	log level
+	 */
+	static bool isEnabled(LogLevel::Level level) {
+		return level <= Logger::level.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Set the level of the recorded statements. It can be changed at any time
+	 * 
+	 * @param	level	most verbose level to record
+	 */
+	static void setLevel(LogLevel::Level level);
+
+	/**
+	 * Return the current log level
+	 */
+	static LogLevel::Level getLevel();
+
+	/**
+	 * Allocate the ring of the calling thread, or take the one of a thread which
+	 * exited. It is done automatically by the first statement of the thread, so
+	 * this is needed only by the threads which must not allocate while logging
+	 */
+	static void registerThread();
+
+	/**
+	 * Start the background thread formatting the records into the provided file.
+	 * Records written earlier are kept and formatted as soon as it starts
+	 * 
+	 * @param	output	output file, which must stay open until stop()
+	 */
+	static void start(FILE* output);
+
+	/**
+	 * Format all the pending records and stop the background thread
+	 */
+	static void stop();
+
+	/**
+	 * Format all the pending records into the output file right away
+	 */
+	static void flush();
+
+	/**
+	 * Return the number of records dropped because a ring was full, or because
+	 * no ring was left for the thread
+	 */
+	static uint64_t getDropped();
+
+	/**
+	 * Write a record into the ring of the calling thread
+	 * 
+	 * @param	site	statement producing the record
+	 * @param	format	printf-like format string, which must be a literal
+	 * @param	args	arguments of the format string (integers, floating point
+	 * 					numbers, C strings or pointers), at most LOG_MAX_ARGS
+	 */
+	template<typename... Args>
+	static void write(const LogSite& site, const char* format, Args... args) {
+		static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many arguments for a log record");
+
+		LogRing* ring = getRing();
+		LogRecord* record = ring ? ring->reserve() : nullptr;
+		if(!record)
+			return;
+
+		record->timestamp = Clock::now();
+		record->site = &site;
+		record->format = format;
+		record->argc = 0;
+		record->textUsed = 0;
+		storeAll(*record, args...);
+		ring->commit();
+		wake();
+	}
+};
+
+/**
+ * Log a printf-like message (format string literal, then the arguments), if the
+ * level is enabled
+ */
+#define LOG(lvl, ...) do {\
+			if(Logger::isEnabled(lvl)) {\
+				static const LogSite logSite = {lvl, __FUNCTION__, __LINE__};\
+				Logger::write(logSite, __VA_ARGS__);\
+			}\
+		} while(0)
+
+#define LOG_ERROR(...)		LOG(LogLevel::ERROR, __VA_ARGS__)
+#define LOG_WARNING(...)	LOG(LogLevel::WARNING, __VA_ARGS__)
+#define LOG_INFO(...)		LOG(LogLevel::INFO, __VA_ARGS__)
+#define LOG_VERBOSE(...)		LOG(LogLevel::VERBOSE, __VA_ARGS__)
+#define LOG_TRACE(...)		LOG(LogLevel::TRACE, __VA_ARGS__)
+
+#endif
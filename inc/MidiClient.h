@@ -31,52 +31,49 @@
 
 #include <alsa/asoundlib.h>
 #include <exception>
+#include <poll.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
+
+#include "MidiSource.h"
 
 /**
- * Custom struct for storing the MIDI event informations meaningfull for
- * the project
+ * Simple class to mask the interaction with the ALSA MIDI sequencer
  */
-struct MidiEvent {
-
-    enum Type {
-        NOTE_ON,
-        NOTE_OFF,
-        UNKNOWN,
-        NO_EVENT
-    };
+class MidiClient : public MidiSource {
 
-    enum Hand {
-        RIGHT,
-        LEFT
-    };
-
-    unsigned char note;
-    Type type;
-    Hand hand;
+    snd_seq_t *seq_handle;
+    int queue;
+    uint64_t queueStart;    // CLOCK_MONOTONIC time the queue was started, in ns
 
-};
+    unsigned long overruns;
+    bool lostEvents;        // true if an overrun occurred since the last check
 
-/**
- * Exception thrown dealing with MIDI errors
- */
-class MidiDeviceException : public std::exception {
-    virtual const char* what() const throw() {
-        return "MidiDeviceException";
-    }
-};
+    size_t inputBuffer;     // size of the user-space input buffer in effect, in bytes
+    size_t inputPool;       // size of the kernel input pool in effect, in events
 
-/**
- * Simple class to mask the interaction with the ALSA MIDI sequencer
- */
-class MidiClient {
+    /**
+     * Account for an overrun of the kernel input pool: the events it held are
+     * gone, and the sequencer has already dropped the rest of the input
+     */
+    void recordOverrun();
 
-    snd_seq_t *seq_handle;
+    /**
+     * Fill a MidiEvent from a sequencer event
+     * 
+     * @param	ev		sequencer event
+     * @param	event	event to fill
+     * 
+     * @return	true for a NOTE_ON or NOTE_OFF event, false for any other type
+     */
+    bool decode(const snd_seq_event_t* ev, MidiEvent& event) const;
 
 public:
 
     /**
      * Open the MIDI sequencer in non-blocking mode, creates a client and a port, subscribing to it.
+     * The port is attached to a real-time queue, so every event is timestamped on arrival.
      * If something goes wrong, trows a MidiDeviceException()
      * 
      * @param	clientName		name of the MIDI client
@@ -84,6 +81,20 @@ public:
      */
     MidiClient(const char* clientName, const char* portName);
 
+    /**
+     * Open the MIDI sequencer as above, creating one port per name. Port i gets
+     * number i, which is reported by the events it receives. Only note events are
+     * delivered by the kernel, the rest (clock, active sensing, ...) is filtered out.
+     * If something goes wrong, trows a MidiDeviceException()
+     * 
+     * @param	clientName		name of the MIDI client
+     * @param	portNames		names of the MIDI ports
+     * @param	inputBuffer		size of the user-space input buffer in bytes, 0 for the default
+     * @param	inputPool		size of the kernel input pool in events, 0 for the default
+     */
+    MidiClient(const char* clientName, const std::vector<std::string>& portNames,
+            size_t inputBuffer = 0, size_t inputPool = 0);
+
     /**
      * Close the MIDI sequencer
      */
@@ -95,9 +106,54 @@ public:
      *  - NOTE_ON if a key has been pressed
      *  - NOTE_OFF if a key has been released
      *  - UNKNOWN otherwise (all of them are meaningless for this applicaton)
-     * When needed, note and hand are correctly set
+     * When needed, note, velocity, channel, hand and port are correctly set
+     */
+    MidiEvent getEvent() override;
+
+    /**
+     * Return the number of events ready to be read with getEvent(). If the input
+     * buffer is empty, the sequencer is checked for new events as well
+     * 
+     * @return	number of pending events
+     */
+    int getPendingEvents() override;
+
+    /**
+     * Read the pending note events straight into a caller-owned array. It
+     * returns as soon as the input is empty, the array is full or an overrun
+     * is detected, so that the events read before the overrun can be applied
+     * before resynchronising
+     * 
+     * @param	events	array receiving the events
+     * @param	size	capacity of the array
+     * 
+     * @return	number of events read, 0 if none is pending
      */
-    MidiEvent getEvent();
+    unsigned int getEvents(MidiEvent* events, unsigned int size) override;
+
+    /**
+     * Return the poll descriptors of the sequencer, so that the caller can block
+     * (ex. with poll()) until new events are available, instead of busy-waiting
+     * on getEvent()
+     * 
+     * @return	vector containing the descriptors to be polled for input
+     */
+    std::vector<pollfd> getPollDescriptors() override;
+
+    /**
+     * Return true if the kernel input pool overflowed since the last call, so
+     * that some events (possibly note-offs) have been lost
+     */
+    bool checkLostEvents() override;
+
+    /**
+     * Return the number of input overruns detected so far
+     */
+    unsigned long getOverruns() const override { return overruns; }
+
+    // list of getters
+    size_t getInputBuffer() const { return inputBuffer; }
+    size_t getInputPool() const { return inputPool; }
 
     /**
      * Return a string representing the provided midi note
@@ -113,9 +169,10 @@ public:
      * 
      * @param	note	string encoding a note
      * 
-     * @return	integer representing corresponding MIDI value
+     * @return	integer representing corresponding MIDI value, negative if the
+     * 			note is not valid
      */
-    static int note2midi(std::string note);
+    static int note2midi(const std::string& note);
 };
 
 #endif
\ No newline at end of file
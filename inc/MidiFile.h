@@ -0,0 +1,195 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __MIDIFILE_H__
+#define __MIDIFILE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "MidiSource.h"
+
+/**
+ * Reader of Standard MIDI Files (type 0 and 1). The file is memory-mapped and
+ * decoded in place: no track data is copied, and the tracks are merged lazily,
+ * keeping them in a min-heap ordered by the tick of their next event. Memory
+ * usage is therefore proportional to the number of tracks, not to the size of
+ * the file. The tempo map is computed once, when the file is opened
+ */
+class MidiFile {
+
+	/**
+	 * Decoding state of a track
+	 */
+	struct Track {
+		const uint8_t* pos;
+		const uint8_t* end;
+		uint64_t tick;			// absolute tick of the event at pos
+		uint8_t runningStatus;
+		unsigned int index;
+	};
+
+	/**
+	 * Tempo change, along with the time elapsed from the beginning of the file
+	 */
+	struct Tempo {
+		uint64_t tick;
+		uint64_t time;			// ns
+		uint32_t usPerQuarter;
+	};
+
+	const uint8_t* data;
+	std::size_t size;
+
+	unsigned int format;
+	unsigned int division;		// ticks per quarter note
+	uint64_t ticksPerSecond;	// non-zero for SMPTE time division
+
+	std::vector<Track> tracks;
+	std::vector<Track*> heap;	// tracks with events left, earliest first
+	std::vector<Tempo> tempoMap;
+	std::size_t tempoIndex;
+
+	/**
+	 * Heap ordering: the track with the earliest event (the lowest index on ties) on top
+	 * 
+	 * @param	a	first track
+	 * @param	b	second track
+	 * 
+	 * @return	true if the next event of a comes after the one of b
+	 */
+	static bool laterThan(const Track* a, const Track* b);
+
+	/**
+	 * Decode a variable-length quantity, advancing the pointer
+	 * 
+	 * @param	pos		position of the quantity, moved past it
+	 * @param	end		end of the track
+	 * @param	value	decoded value
+	 * 
+	 * @return	false if the track is truncated
+	 */
+	static bool readVarLen(const uint8_t*& pos, const uint8_t* end, uint32_t& value);
+
+	/**
+	 * Decode the next event of a track, advancing it to the following one
+	 * 
+	 * @param	track	track to decode
+	 * @param	event	filled if the event is a note
+	 * @param	tempo	filled with the new tempo if the event is a tempo change
+	 * 
+	 * @return	1 if the event is a note, 2 if it is a tempo change, 0 for any other
+	 * 			event and -1 at the end of the track
+	 */
+	int decode(Track& track, MidiEvent& event, uint32_t& tempo);
+
+	/**
+	 * Read the delta time of the next event of a track
+	 * 
+	 * @param	track	track to advance
+	 * 
+	 * @return	false at the end of the track
+	 */
+	bool advance(Track& track);
+
+	/**
+	 * Scan the first track for tempo changes, building the tempo map
+	 */
+	void buildTempoMap();
+
+	/**
+	 * Convert a tick into the time elapsed from the beginning of the file. Ticks
+	 * must be provided in non-decreasing order
+	 * 
+	 * @param	tick	absolute tick
+	 * 
+	 * @return	time in ns
+	 */
+	uint64_t tickToTime(uint64_t tick);
+
+public:
+
+	/**
+	 * Open and map the file, locating the tracks and building the tempo map. In case
+	 * of error an OpenFileException or a ParsingException is thrown
+	 * 
+	 * @param	filename	name of the MIDI file
+	 */
+	MidiFile(const std::string& filename);
+
+	/**
+	 * Unmap the file
+	 */
+	~MidiFile();
+
+	MidiFile(const MidiFile&) = delete;
+	MidiFile& operator=(const MidiFile&) = delete;
+
+	/**
+	 * Return the next note of the file, merging all the tracks
+	 * 
+	 * @param	event	event to fill (NOTE_ON or NOTE_OFF)
+	 * @param	time	time of the event from the beginning of the file, in ns
+	 * 
+	 * @return	false at the end of the file
+	 */
+	bool next(MidiEvent& event, uint64_t& time);
+
+	// list of getters
+	unsigned int getFormat() const { return format; }
+	std::size_t getTrackCount() const { return tracks.size(); }
+};
+
+/**
+ * Source playing a Standard MIDI File
+ */
+class MidiFileSource : public ScheduledSource {
+
+	MidiFile file;
+
+protected:
+
+	bool read(MidiEvent& event, uint64_t& time) override { return file.next(event, time); }
+
+public:
+
+	/**
+	 * Open the file. In case of error an OpenFileException or a ParsingException
+	 * is thrown
+	 * 
+	 * @param	filename	name of the MIDI file
+	 * @param	speed		playback speed (1 = real time, 2 = twice as fast, ...)
+	 * @param	preview		preview window, in ns (0 = no preview)
+	 */
+	MidiFileSource(const std::string& filename, double speed, uint64_t preview = 0)
+		: ScheduledSource(speed, preview), file(filename) {}
+};
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __MIDISOURCE_H__
+#define __MIDISOURCE_H__
+
+#include <exception>
+#include <memory>
+#include <poll.h>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#define PREVIEW_QUEUE_EVENTS	4096	// announced events waiting for their time
+#define MIDI_NO_TRACK			0xFF	// track of the events which do not come from a file
+
+class PianoTutorPlusConfig;
+
+/**
+ * Custom struct for storing the MIDI event informations meaningfull for
+ * the project. It is a 16-byte POD, so that batches of events can be read
+ * into plain arrays and copied around without any cost
+ */
+struct MidiEvent {
+
+    enum Type : uint8_t {
+        NOTE_ON,
+        NOTE_OFF,
+        PREVIEW,            // NOTE_ON due at the end of the preview window
+        UNKNOWN,
+        NO_EVENT
+    };
+
+    enum Hand : uint8_t {
+        RIGHT,
+        LEFT
+    };
+
+    uint64_t timestamp;     // CLOCK_MONOTONIC arrival time, in ns
+    uint8_t note;
+    uint8_t velocity;       // release velocity for NOTE_OFF
+    uint8_t channel;        // MIDI channel, 0-15
+    uint8_t port;           // input port receiving the event, selecting the station
+    Type type;
+    Hand hand;              // channel 0 is played by the right hand, any other by the left one
+    uint8_t track;          // track of the Standard MIDI File from 0, MIDI_NO_TRACK for any other event
+    uint8_t reserved;
+
+};
+
+static_assert(sizeof(MidiEvent) == 16, "MidiEvent must fit 16 bytes");
+static_assert(std::is_pod<MidiEvent>::value, "MidiEvent must be a POD");
+
+/**
+ * Exception thrown dealing with MIDI errors
+ */
+class MidiDeviceException : public std::exception {
+    virtual const char* what() const throw() {
+        return "MidiDeviceException";
+    }
+};
+
+/**
+ * Namespace to deal with MIDI source definitions. It allows to parse sources to and 
+ * from string, manage parsing errors and obtain the list of available sources
+ */
+namespace MidiSourceType {
+	enum Type {
+		ALSA,		// ALSA sequencer port
+		REPLAY,		// recorded event stream
+		SYNTHETIC,	// generated load
+		FILE		// Standard MIDI File
+	};
+
+	/**
+	 * Exception thrown dealing with source parsing
+	 */
+	class MidiSourceNotFoundException : public std::exception {
+		virtual const char* what() const throw() {
+			return "MidiSourceNotFoundException";
+		}
+	};
+
+	/**
+	 * Parse a string, obtaining the corresponding source
+	 * 
+	 * @param	type	string representing the source
+	 * 
+	 * @return	corresponding Type value
+	 */
+	Type parse(std::string type);
+
+	/**
+	 * Return the name of the provided source
+	 * 
+	 * @param	type	source
+	 * 
+	 * @return	name of the source
+	 */
+	const char* toString(Type type);
+
+	/**
+	 * Return the list of all the available sources
+	 * 
+	 * @return	vector containing all the available sources
+	 */
+	const std::vector<Type>& getAllSourceTypes();
+}
+
+/**
+ * Interface of the objects feeding MIDI events to the main loop. Sources are
+ * non-blocking: the loop polls their descriptors and then reads events
+ * until none is pending
+ */
+class MidiSource {
+
+public:
+
+	virtual ~MidiSource() {}
+
+    /**
+     * Return a MidiEvent of type
+     *  - NO_EVENT if no event is present (the semantics is non-blocking)
+     *  - NOTE_ON if a key has been pressed
+     *  - NOTE_OFF if a key has been released
+     *  - UNKNOWN otherwise (all of them are meaningless for this applicaton)
+     * When needed, note and hand are correctly set
+     */
+	virtual MidiEvent getEvent() = 0;
+
+    /**
+     * Return the number of events ready to be read with getEvent()
+     * 
+     * @return	number of pending events
+     */
+	virtual int getPendingEvents() = 0;
+
+	/**
+	 * Read the pending NOTE_ON, NOTE_OFF and PREVIEW events into a caller-owned
+	 * array, skipping any other event. It returns as soon as no event is pending
+	 * or the array is full
+	 * 
+	 * @param	events	array receiving the events
+	 * @param	size	capacity of the array
+	 * 
+	 * @return	number of events read, 0 if none is pending
+	 */
+	virtual unsigned int getEvents(MidiEvent* events, unsigned int size);
+
+    /**
+     * Return the descriptors to be polled for input, becoming ready when new
+     * events are available
+     * 
+     * @return	vector containing the descriptors
+     */
+	virtual std::vector<pollfd> getPollDescriptors() = 0;
+
+	/**
+	 * Return true if the source will not produce any other event
+	 */
+	virtual bool isFinished() { return false; }
+
+	/**
+	 * Return true if some events have been lost (ex. because of an input
+	 * overrun) since the last call, so that the caller can resynchronise
+	 */
+	virtual bool checkLostEvents() { return false; }
+
+	/**
+	 * Return the number of input overruns detected so far
+	 */
+	virtual unsigned long getOverruns() const { return 0; }
+
+	/**
+	 * Build the source selected by the configuration. In case of error a
+	 * MidiDeviceException (or the exception of the failing file operation) is thrown
+	 * 
+	 * @param	config		program configuration
+	 * @param	clientName	name of the MIDI client, for the ALSA source
+	 * @param	portName	name of the MIDI port, for the ALSA source
+	 * 
+	 * @return	the new source
+	 */
+	static std::unique_ptr<MidiSource> create(const PianoTutorPlusConfig& config,
+			const char* clientName, const char* portName);
+};
+
+/**
+ * Base class of the sources whose events are known in advance, each with its own
+ * time (relative to the beginning of the stream). Events are released when their
+ * time comes, using a timerfd to wake up the loop.
+ * 
+ * With a preview window, every NOTE_ON is announced by a PREVIEW event as long
+ * before it as the window, and the whole stream is delayed by the window so that
+ * the first notes are announced as well. The events already announced wait in a
+ * queue ordered by time: since the announcements come in the same order as the
+ * events, each wakeup only looks at the head of the queue and at the next event
+ * of the stream, whatever the length of the score. When the queue is full, the
+ * next announcement waits for the head to be released, and carries its time
+ */
+class ScheduledSource : public MidiSource {
+
+	/**
+	 * Event waiting for its time, after its announcement
+	 */
+	struct PendingEvent {
+		uint64_t time;
+		MidiEvent event;
+	};
+
+	int timerFd;
+	double speed;
+	uint64_t preview;	// preview window, in ns (0 = no preview)
+
+	bool started;
+	bool finished;
+	bool buffered;
+	uint64_t start;		// CLOCK_MONOTONIC time of the beginning, in ns
+	MidiEvent next;
+	uint64_t nextTime;	// time of the next event from the beginning, in ns
+	uint64_t released;	// time of the last event released from the beginning, in ns
+
+	// ring of the announced events, allocated only with a preview window
+	std::vector<PendingEvent> pending;
+	std::size_t pendingHead;
+	std::size_t pendingCount;
+
+	/**
+	 * Return the time of the next event to release, either the head of the
+	 * queue or the next event of the stream (its announcement, with a preview)
+	 * 
+	 * @return	time from the beginning, in ns, UINT64_MAX if nothing is left
+	 */
+	uint64_t getDueTime() const;
+
+	/**
+	 * Append an announced event to the queue, which must not be full
+	 * 
+	 * @param	time	time of the event from the beginning, in ns
+	 * @param	event	event
+	 */
+	void enqueue(uint64_t time, const MidiEvent& event);
+
+	/**
+	 * Start the stream and arm the timer for the first event
+	 */
+	void begin();
+
+	/**
+	 * Read the next event into the buffer, if it is empty. With a preview,
+	 * the events that are not announced go straight to the queue, so that
+	 * the buffer holds the next NOTE_ON
+	 */
+	void fetch();
+
+	/**
+	 * Consume the expirations of the timer and arm it for the buffered event
+	 */
+	void rearm();
+
+protected:
+
+	/**
+	 * Produce the next event of the stream
+	 * 
+	 * @param	event	event to fill
+	 * @param	time	time of the event from the beginning of the stream, in ns
+	 * 
+	 * @return	false if the stream is over
+	 */
+	virtual bool read(MidiEvent& event, uint64_t& time) = 0;
+
+public:
+
+	/**
+	 * Build the source. In case of error a MidiDeviceException is thrown
+	 * 
+	 * @param	speed	playback speed (1 = real time, 2 = twice as fast, ...)
+	 * @param	preview	preview window, in ns (0 = no preview)
+	 */
+	ScheduledSource(double speed, uint64_t preview = 0);
+
+	/**
+	 * Release the timer
+	 */
+	~ScheduledSource();
+
+	MidiEvent getEvent() override;
+	int getPendingEvents() override;
+	std::vector<pollfd> getPollDescriptors() override;
+	bool isFinished() override;
+};
+
+/**
+ * Source replaying a recorded event stream. The stream is a text file with one
+ * event per line, in the form
+ * 
+ *     <time in microseconds> <on|off> <MIDI note> <MIDI channel> [<velocity>]
+ * 
+ * where lines starting with # are comments. Channel 0 is the right hand, any
+ * other channel the left one. Events without velocity get the MIDI default, 64
+ */
+class ReplaySource : public ScheduledSource {
+
+	struct TimedEvent {
+		uint64_t time;
+		MidiEvent event;
+	};
+
+	std::vector<TimedEvent> events;
+	std::size_t position;
+
+protected:
+
+	bool read(MidiEvent& event, uint64_t& time) override;
+
+public:
+
+	/**
+	 * Load the whole stream. In case of error an OpenFileException or a
+	 * ParsingException is thrown
+	 * 
+	 * @param	filename	name of the recorded stream
+	 * @param	speed		playback speed (1 = real time, 2 = twice as fast, ...)
+	 * @param	preview		preview window, in ns (0 = no preview)
+	 */
+	ReplaySource(const std::string& filename, double speed, uint64_t preview = 0);
+};
+
+/**
+ * Source generating a synthetic load: chords of random notes are pressed at a
+ * fixed rate, each one released when the following is pressed. Chords can be
+ * grouped in bursts, delivered together a fixed number of times per second
+ */
+class SyntheticSource : public ScheduledSource {
+
+	unsigned char minNote;
+	unsigned char maxNote;
+	uint64_t chordPeriod;	// ns
+	uint64_t burstPeriod;	// ns, 0 if chords are not grouped
+	uint64_t duration;		// ns, 0 if the load never ends
+	unsigned int chordSize;
+	uint32_t seed;
+
+	uint64_t chord;			// index of the current chord
+	unsigned int step;		// event of the current chord to produce
+	bool ending;
+	std::vector<MidiEvent> held;
+	std::vector<MidiEvent> pressed;
+
+	/**
+	 * Return a pseudo-random number (xorshift)
+	 */
+	uint32_t random();
+
+protected:
+
+	bool read(MidiEvent& event, uint64_t& time) override;
+
+public:
+
+	/**
+	 * Build the generator
+	 * 
+	 * @param	minNote		lowest note to play
+	 * @param	maxNote		highest note to play
+	 * @param	chordRate	chords per second
+	 * @param	chordSize	notes per chord
+	 * @param	burstRate	bursts per second, 0 to deliver each chord on time
+	 * @param	duration	seconds of load, 0 to never stop
+	 */
+	SyntheticSource(unsigned char minNote, unsigned char maxNote, double chordRate,
+			unsigned int chordSize, double burstRate, double duration);
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+#ifndef __NOTEMAPPER_H__
+#define __NOTEMAPPER_H__
+
+#include "Animator.h"
+#include "ColorCorrection.h"
+#include "Compositor.h"
+#include "KeyState.h"
+#include "MidiSource.h"
+#include "PianoTutorPlusConfig.h"
+
+/**
+ * Translate note events into LED updates: it tracks the state of the keyboard
+ * and touches the strip only when the color shown on a key changes. Each note
+ * is played by a part of the score, its channel or its track when the track has
+ * a color of its own, and a key shows the color of the lowest part holding it,
+ * scaled by the velocity of the note. Colors are resolved in advance for every
+ * part and velocity. With an Animator, keys fade in and out instead of being
+ * written straight away. The notes announced by PREVIEW events are hinted,
+ * dimmed, on a layer below the keys until they are played. Frames are not
+ * rendered, so that a whole batch of events becomes a single frame
+ */
+class NoteMapper {
+
+	const PianoTutorPlusConfig* config;
+	Compositor& compositor;
+	Animator* animator;
+	KeyState keys;
+
+	// part playing each channel of each track, the last row being used by the
+	// tracks without a color of their own and by the events not coming from a file
+	uint8_t parts[PALETTE_TRACKS + 1][PALETTE_CHANNELS];
+
+	// color of each part at each velocity, and velocity of the last press of
+	// each key by each part
+	ws2811_led_t colors[PALETTE_SIZE][VELOCITIES];
+	uint8_t velocities[MIDI_NOTES][PALETTE_SIZE];
+
+	// notes announced by a PREVIEW and not played yet, per key
+	uint8_t hints[MIDI_NOTES];
+
+	/**
+	 * Draw a key on the layer of the keys, or hand it to the animator, with
+	 * the color of the part holding it
+	 * 
+	 * @param	note	MIDI note of the key
+	 */
+	void draw(unsigned char note);
+
+	/**
+	 * Draw the hint of a key on the layer of the hints
+	 * 
+	 * @param	note	MIDI note of the key
+	 * @param	color	color of the hint
+	 * @param	alpha	opacity of the hint, 0 to remove it
+	 */
+	void drawHint(unsigned char note, ws2811_led_t color, uint8_t alpha);
+
+public:
+
+	/**
+	 * Build the mapper with all the keys released
+	 * 
+	 * @param	config		configuration providing the LED spans and the colors
+	 * @param	compositor	layers of the strip, the keys being drawn on the NOTES one
+	 * @param	animator	envelopes of the keys, nullptr to switch them on and off at once
+	 */
+	NoteMapper(const PianoTutorPlusConfig& config, Compositor& compositor, Animator* animator = nullptr);
+
+	/**
+	 * Take the LED spans and the colors from a new configuration, keeping the
+	 * state of the keyboard: the keys being held are drawn again, while the
+	 * hints are dropped
+	 * 
+	 * @param	config		configuration providing the LED spans and the colors
+	 * @param	animator	envelopes of the keys, nullptr to switch them on and off at once
+	 */
+	void configure(const PianoTutorPlusConfig& config, Animator* animator);
+
+	/**
+	 * Apply a NOTE_ON or NOTE_OFF event to the layer of the keys, or a PREVIEW
+	 * to the layer of the hints. Any other event is ignored
+	 * 
+	 * @param	event	MIDI event
+	 * 
+	 * @return	true if the LEDs of the key have been updated
+	 */
+	bool apply(const MidiEvent& event);
+
+	/**
+	 * Release all the keys and drop the hints, switching off their LEDs
+	 */
+	void clear();
+};
+
+#endif
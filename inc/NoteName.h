@@ -0,0 +1,156 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __NOTENAME_H__
+#define __NOTENAME_H__
+
+#include <cstddef>
+
+#define MIDI_NOTES		128
+#define NOTE_NAME_LEN	5	// longest name is "C#-1", plus the terminator
+
+/**
+ * Namespace to deal with note names (ex. C#4, Bb3, C-1). Everything can be computed
+ * at compile time, so converting a note from or to its name never allocates nor
+ * throws
+ */
+namespace NoteName {
+
+	/**
+	 * Errors returned by parse(), all of them negative
+	 */
+	enum ParseError {
+		INVALID_NAME = -1,
+		OUT_OF_RANGE = -2
+	};
+
+	/**
+	 * Table holding the names of all the MIDI notes, built at compile time
+	 */
+	struct Table {
+		char names[MIDI_NOTES][NOTE_NAME_LEN];
+
+		constexpr Table() : names() {
+			const char letters[] = "CCDDEFFGGAAB";
+			const bool sharps[] = {false, true, false, true, false, false, true, false, true, false, true, false};
+
+			for(int midi = 0; midi < MIDI_NOTES; midi++) {
+				int octave = midi / 12 - 1;
+				int i = 0;
+
+				names[midi][i++] = letters[midi % 12];
+				if(sharps[midi % 12])
+					names[midi][i++] = '#';
+				if(octave < 0) {
+					names[midi][i++] = '-';
+					octave = -octave;
+				}
+				names[midi][i++] = '0' + octave;
+				names[midi][i] = '\0';
+			}
+		}
+	};
+
+	constexpr Table table;
+
+	/**
+	 * Return the name of the provided MIDI note
+	 * 
+	 * @param	midi	value of the MIDI note
+	 * 
+	 * @return	name of the note
+	 */
+	constexpr const char* toString(unsigned char midi) {
+		return table.names[midi & (MIDI_NOTES - 1)];
+	}
+
+	/**
+	 * Parse a note name made of a letter (A-G, case insensitive), an optional
+	 * sharp (#) or flat (b) and an octave between -1 and 9
+	 * 
+	 * @param	str		characters of the name (not necessarily null-terminated)
+	 * @param	len		number of characters
+	 * 
+	 * @return	MIDI value of the note, or a negative ParseError
+	 */
+	constexpr int parse(const char* str, std::size_t len) {
+		// semitones of A, B, C, D, E, F and G within the octave
+		const int semitones[] = {9, 11, 0, 2, 4, 5, 7};
+		std::size_t i = 0;
+		int note = 0;
+		int octave = 0;
+
+		if(len < 2)
+			return INVALID_NAME;
+
+		char letter = str[i++] | 0x20;	// lower case
+		if(letter < 'a' || letter > 'g')
+			return INVALID_NAME;
+		note = semitones[letter - 'a'];
+
+		if(str[i] == '#') {
+			note++;
+			i++;
+		} else if(str[i] == 'b' || str[i] == 'B') {
+			note--;
+			i++;
+		}
+
+		if(i < len && str[i] == '-') {
+			if(len - i != 2 || str[i + 1] != '1')
+				return INVALID_NAME;
+			octave = -1;
+		} else if(len - i == 1 && str[i] >= '0' && str[i] <= '9') {
+			octave = str[i] - '0';
+		} else {
+			return INVALID_NAME;
+		}
+
+		note += (octave + 1) * 12;
+		if(note < 0 || note >= MIDI_NOTES)
+			return OUT_OF_RANGE;
+		return note;
+	}
+
+	/**
+	 * Parse a null-terminated note name
+	 * 
+	 * @param	str		name of the note
+	 * 
+	 * @return	MIDI value of the note, or a negative ParseError
+	 */
+	constexpr int parse(const char* str) {
+		std::size_t len = 0;
+		while(str[len] != '\0')
+			len++;
+		return parse(str, len);
+	}
+}
+
+#endif
@@ -35,15 +35,74 @@
 #define KEY_LED_COUNT	"LED_COUNT"
 #define KEY_LED_ORDER	"LED_ORDER"
 #define KEY_LED_TYPE	"LED_TYPE"
+#define KEY_LED_BRIGHTNESS		"LED_BRIGHTNESS"
+#define KEY_CHANNEL1_GPIO_PIN	"CHANNEL1_GPIO_PIN"
+#define KEY_CHANNEL1_LED_TYPE	"CHANNEL1_LED_TYPE"
+#define KEY_CHANNEL1_BRIGHTNESS	"CHANNEL1_BRIGHTNESS"
+#define KEY_LED_SEGMENTS		"LED_SEGMENTS"
+#define KEY_STATION_NAME		"STATION_NAME"
+#define KEY_GAMMA				"GAMMA"
+#define KEY_WHITE_BALANCE		"WHITE_BALANCE"
+#define KEY_VELOCITY_BRIGHTNESS	"VELOCITY_BRIGHTNESS"
+#define KEY_VELOCITY_GAMMA		"VELOCITY_GAMMA"
+#define KEY_VELOCITY_MIN_BRIGHTNESS	"VELOCITY_MIN_BRIGHTNESS"
+#define KEY_ATTACK_TIME			"ATTACK_TIME"
+#define KEY_DECAY_TIME			"DECAY_TIME"
+#define KEY_ANIMATION_FPS		"ANIMATION_FPS"
+#define KEY_PREVIEW_TIME		"PREVIEW_TIME"
+#define KEY_PREVIEW_BRIGHTNESS	"PREVIEW_BRIGHTNESS"
 #define KEY_LED_PER_KEY	"LED_PER_KEY"
 #define KEY_COLOR_RIGHT	"COLOR_RIGHT_HAND"
 #define KEY_COLOR_LEFT	"COLOR_LEFT_HAND"
+#define KEY_COLOR_CHANNEL		"COLOR_CHANNEL_"	// followed by the channel, from 1 to 16
+#define KEY_COLOR_TRACK			"COLOR_TRACK_"		// followed by the track, from 1 to 16
 #define KEY_KEYBOARD_MIN_NOTE	"KEYBOARD_MIN_NOTE"
 #define KEY_KEYBOARD_MAX_NOTE	"KEYBOARD_MAX_NOTE"
+#define KEY_LED_BACKEND			"LED_BACKEND"
+#define KEY_LED_BACKEND_FILE	"LED_BACKEND_FILE"
+#define KEY_SIMULATE_DMA		"SIMULATE_DMA"
+#define KEY_MIDI_SOURCE			"MIDI_SOURCE"
+#define KEY_REPLAY_FILE			"REPLAY_FILE"
+#define KEY_REPLAY_SPEED		"REPLAY_SPEED"
+#define KEY_MIDI_FILE			"MIDI_FILE"
+#define KEY_MIDI_INPUT_BUFFER	"MIDI_INPUT_BUFFER"
+#define KEY_MIDI_INPUT_POOL		"MIDI_INPUT_POOL"
+#define KEY_SYNTH_CHORD_RATE	"SYNTH_CHORD_RATE"
+#define KEY_SYNTH_CHORD_SIZE	"SYNTH_CHORD_SIZE"
+#define KEY_SYNTH_BURST_RATE	"SYNTH_BURST_RATE"
+#define KEY_SYNTH_DURATION		"SYNTH_DURATION"
+#define KEY_RT_POLICY			"RT_POLICY"
+#define KEY_RT_PRIORITY			"RT_PRIORITY"
+#define KEY_MIDI_THREAD_CPU		"MIDI_THREAD_CPU"
+#define KEY_RENDER_THREAD_CPU	"RENDER_THREAD_CPU"
+#define KEY_LOCK_MEMORY			"LOCK_MEMORY"
+#define KEY_LOG_LEVEL			"LOG_LEVEL"
+#define KEY_LOG_FILE			"LOG_FILE"
 
 #include <string>
+#include <vector>
 
+#include "ColorCorrection.h"
+#include "Config.h"
+#include "LedBackend.h"
 #include "LedStrip.h"
+#include "Logger.h"
+#include "MidiSource.h"
+#include "NoteName.h"
+#include "RealTime.h"
+
+#define PALETTE_CHANNELS	16	// one color per MIDI channel
+#define PALETTE_TRACKS		16	// optional colors of the first tracks of a MIDI file
+#define PALETTE_SIZE		(PALETTE_CHANNELS + PALETTE_TRACKS)
+
+/**
+ * Range of consecutive LEDs lying under a key. A length of zero means that
+ * the note is not on the keyboard
+ */
+struct LedSpan {
+	unsigned short first;
+	unsigned short length;
+};
 
 /**
  * Simple class used to parse the configuration file and retrieve
@@ -51,6 +110,7 @@
  */ 
 class PianoTutorPlusConfig {
 	
+	std::string filename;
 	unsigned int freq;
 	unsigned short gpioPin;
 	unsigned short dmaChannel;
@@ -58,10 +118,67 @@ class PianoTutorPlusConfig {
 	LedOrder::Order ledOrder;
 	StripType::Type stripType;
 	float ledPerKey;
-	LedColor::Color colorRightHand;
-	LedColor::Color colorLeftHand;
 	unsigned char keyboardMinNote;
 	unsigned char keyboardMaxNote;
+	LedBackendType::Type ledBackend;
+	std::string ledBackendFile;
+	bool simulateDma;
+	MidiSourceType::Type midiSource;
+	std::string replayFile;
+	double replaySpeed;
+	std::string midiFile;
+	unsigned int midiInputBuffer;
+	unsigned int midiInputPool;
+	double synthChordRate;
+	unsigned int synthChordSize;
+	double synthBurstRate;
+	double synthDuration;
+	SchedPolicy::Policy rtPolicy;
+	int rtPriority;
+	int midiThreadCpu;
+	int renderThreadCpu;
+	bool lockMemory;
+	LogLevel::Level logLevel;
+	std::string logFile;
+	std::string stationName;
+	LedChannel ledChannels[LED_CHANNELS];
+	std::vector<LedSegment> ledSegments;
+	ColorCorrection colorCorrection;
+	unsigned int attackTime;
+	unsigned int decayTime;
+	unsigned int animationFps;
+	unsigned int previewTime;
+	unsigned char previewBrightness;
+
+	// colors of the channels, followed by the ones of the tracks
+	ws2811_led_t palette[PALETTE_SIZE];
+	bool trackColors[PALETTE_TRACKS];
+
+	// note-to-LED mapping, with the LED order already applied
+	LedSpan ledSpans[MIDI_NOTES];
+
+	/**
+	 * Fill the note-to-LED table, starting from the keyboard range, the number
+	 * of LEDs per key and the LED order
+	 */
+	void buildLedSpans();
+
+	/**
+	 * Fill the palette: the channels take the color of the hand playing them
+	 * (channel 1 the right one, any other the left one) unless they have a color
+	 * of their own, while tracks have an entry only when a color is set for them
+	 * 
+	 * @param	conf	parsed configuration file
+	 */
+	void parsePalette(Config& conf);
+
+	/**
+	 * Parse the list of segments splitting the strip among the channels, and
+	 * compute the number of LEDs driven by each channel
+	 * 
+	 * @param	str		comma-separated list of first-last:channel segments
+	 */
+	void parseLedSegments(const std::string& str);
 
 	/**
 	 * Throw a ParsingException, showing the provided error message
@@ -80,18 +197,98 @@ public:
 	 */
     PianoTutorPlusConfig(const std::string& filename);
 
+	/**
+	 * Tell whether another configuration drives the strip with the same
+	 * settings (backend, GPIO pins, DMA channel, frequency, LED count, types
+	 * and LEDs per channel), so that the strip can be kept when switching to
+	 * it. The brightness of the channels and the segments can be changed on
+	 * the strip in use
+	 * 
+	 * @param	other	configuration to compare
+	 * 
+	 * @return	true if the strip does not need to be initialized again
+	 */
+	bool hasSameStrip(const PianoTutorPlusConfig& other) const;
+
+	/**
+	 * Tell whether another configuration maps the strip on the channels with
+	 * the same segments
+	 * 
+	 * @param	other	configuration to compare
+	 * 
+	 * @return	true if the segments are the same
+	 */
+	bool hasSameSegments(const PianoTutorPlusConfig& other) const;
+
 	// list of getters
-	unsigned int getFreq() { return freq; }
-	unsigned short getGpioPin() { return gpioPin; }
-	unsigned short getDmaChannel() { return dmaChannel; }
-	unsigned short getLedCount() { return ledCount; }
-	LedOrder::Order getLedOrder() { return ledOrder; }
-	StripType::Type getStripType() { return stripType; }
-	float getLedPerKey() { return ledPerKey; }
-	LedColor::Color getColorRightHand() { return colorRightHand; }
-	LedColor::Color getColorLeftHand() { return colorLeftHand; }
-	unsigned char getKeyboardMinNote() { return keyboardMinNote; }
-	unsigned char getKeyboardMaxNote() { return keyboardMaxNote; }
+	const std::string& getFilename() const { return filename; }
+	unsigned int getFreq() const { return freq; }
+	unsigned short getGpioPin() const { return gpioPin; }
+	unsigned short getDmaChannel() const { return dmaChannel; }
+	unsigned short getLedCount() const { return ledCount; }
+	LedOrder::Order getLedOrder() const { return ledOrder; }
+	StripType::Type getStripType() const { return stripType; }
+	float getLedPerKey() const { return ledPerKey; }
+	unsigned char getKeyboardMinNote() const { return keyboardMinNote; }
+	unsigned char getKeyboardMaxNote() const { return keyboardMaxNote; }
+	LedBackendType::Type getLedBackend() const { return ledBackend; }
+	const std::string& getLedBackendFile() const { return ledBackendFile; }
+	bool getSimulateDma() const { return simulateDma; }
+	MidiSourceType::Type getMidiSource() const { return midiSource; }
+	const std::string& getReplayFile() const { return replayFile; }
+	double getReplaySpeed() const { return replaySpeed; }
+	const std::string& getMidiFile() const { return midiFile; }
+	unsigned int getMidiInputBuffer() const { return midiInputBuffer; }
+	unsigned int getMidiInputPool() const { return midiInputPool; }
+	double getSynthChordRate() const { return synthChordRate; }
+	unsigned int getSynthChordSize() const { return synthChordSize; }
+	double getSynthBurstRate() const { return synthBurstRate; }
+	double getSynthDuration() const { return synthDuration; }
+	SchedPolicy::Policy getRtPolicy() const { return rtPolicy; }
+	int getRtPriority() const { return rtPriority; }
+	int getMidiThreadCpu() const { return midiThreadCpu; }
+	int getRenderThreadCpu() const { return renderThreadCpu; }
+	bool getLockMemory() const { return lockMemory; }
+	LogLevel::Level getLogLevel() const { return logLevel; }
+	const std::string& getLogFile() const { return logFile; }
+	const std::string& getStationName() const { return stationName; }
+	const LedChannel (&getLedChannels() const)[LED_CHANNELS] { return ledChannels; }
+	const std::vector<LedSegment>& getLedSegments() const { return ledSegments; }
+	const ColorCorrection& getColorCorrection() const { return colorCorrection; }
+	unsigned int getAttackTime() const { return attackTime; }
+	unsigned int getDecayTime() const { return decayTime; }
+	unsigned int getAnimationFps() const { return animationFps; }
+	unsigned int getPreviewTime() const { return previewTime; }
+	unsigned char getPreviewBrightness() const { return previewBrightness; }
+
+	/**
+	 * Return a color of the palette: the first PALETTE_CHANNELS entries are the
+	 * colors of the MIDI channels, the following ones the colors of the tracks
+	 * 
+	 * @param	entry	index of the palette entry
+	 * 
+	 * @return	color as 0x00RRGGBB
+	 */
+	ws2811_led_t getPaletteColor(unsigned int entry) const { return palette[entry % PALETTE_SIZE]; }
+
+	/**
+	 * Tell whether a track of a MIDI file has a color of its own, overriding
+	 * the ones of the channels
+	 * 
+	 * @param	track	index of the track, from 0
+	 * 
+	 * @return	true if the track has its own palette entry
+	 */
+	bool hasTrackColor(unsigned int track) const { return track < PALETTE_TRACKS && trackColors[track]; }
+
+	/**
+	 * Return the LEDs lying under the provided note
+	 * 
+	 * @param	note	MIDI note
+	 * 
+	 * @return	span of LEDs, empty if the note is not on the keyboard
+	 */
+	const LedSpan& getLedSpan(unsigned char note) const { return ledSpans[note & (MIDI_NOTES - 1)]; }
 
 };
 
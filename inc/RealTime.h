@@ -0,0 +1,129 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include <exception>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#define RT_PREFAULT_STACK	(256 * 1024)		// bytes of stack touched in advance
+#define RT_PREFAULT_HEAP	(4 * 1024 * 1024)	// bytes of heap touched in advance
+
+/**
+ * Namespace to deal with scheduling policy definitions. It allows to parse policies
+ * to and from string, manage parsing errors and obtain the list of available policies
+ */
+namespace SchedPolicy {
+	enum Policy {
+		OTHER,		// default time-sharing scheduler
+		FIFO,		// SCHED_FIFO real-time scheduler
+		RR			// SCHED_RR real-time scheduler
+	};
+
+	/**
+	 * Exception thrown dealing with scheduling policy parsing
+	 */
+	class SchedPolicyNotFoundException : public std::exception {
+		virtual const char* what() const throw() {
+			return "SchedPolicyNotFoundException";
+		}
+	};
+
+	/**
+	 * Parse a string, obtaining the corresponding policy
+	 * 
+	 * @param	policy	string representing the policy
+	 * 
+	 * @return	corresponding Policy value
+	 */
+	Policy parse(std::string policy);
+
+	/**
+	 * Return the name of the provided policy
+	 * 
+	 * @param	policy	scheduling policy
+	 * 
+	 * @return	name of the policy
+	 */
+	const char* toString(Policy policy);
+
+	/**
+	 * Return the list of all the available policies
+	 * 
+	 * @return	vector containing all the available policies
+	 */
+	const std::vector<Policy>& getAllPolicies();
+}
+
+/**
+ * Namespace gathering the settings which shield the program from the rest of the
+ * system. Every function falls back to the default behaviour if the setting cannot
+ * be applied (ex. for missing permissions), printing a warning
+ */
+namespace RealTime {
+
+	/**
+	 * Set the scheduling policy and priority of a thread
+	 * 
+	 * @param	thread		thread to configure
+	 * @param	name		name of the thread, for the warnings
+	 * @param	policy		scheduling policy
+	 * @param	priority	real-time priority (ignored by the OTHER policy)
+	 * 
+	 * @return	true if the setting has been applied
+	 */
+	bool setScheduling(pthread_t thread, const char* name, SchedPolicy::Policy policy, int priority);
+
+	/**
+	 * Pin a thread to a single CPU
+	 * 
+	 * @param	thread		thread to configure
+	 * @param	name		name of the thread, for the warnings
+	 * @param	cpu			index of the CPU
+	 * 
+	 * @return	true if the setting has been applied
+	 */
+	bool setAffinity(pthread_t thread, const char* name, int cpu);
+
+	/**
+	 * Lock the current and future memory of the process in RAM, then prefault
+	 * RT_PREFAULT_STACK bytes of the calling thread's stack and RT_PREFAULT_HEAP bytes
+	 * of heap, which is never given back to the system. Threads started later get
+	 * their whole stack locked on creation
+	 * 
+	 * @return	true if the memory has been locked
+	 */
+	bool lockMemory();
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __RENDERPOOL_H__
+#define __RENDERPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class LedStrip;
+
+/**
+ * Small set of threads sending the frames of many LED strips, so that the number
+ * of render threads does not grow with the number of strips. A strip with a frame
+ * to send is queued once, however many frames it publishes meanwhile, and it is
+ * served by a single worker at a time
+ */
+class RenderPool {
+
+	std::vector<std::thread> workers;
+
+	// queue of the strips waiting for a worker: a strip is never queued twice,
+	// so it cannot hold more entries than the strips sharing the pool
+	std::mutex mutex;
+	std::vector<LedStrip*> queue;
+	unsigned int head;
+	unsigned int queued;
+
+	// strip being served by each worker, nullptr while it waits; a worker signals
+	// when it is done with a strip, waking up release()
+	std::vector<LedStrip*> serving;
+	std::condition_variable served;
+
+	std::atomic<bool> stopping;
+	int wakeFd;		// semaphore eventfd, counting the queued strips
+
+	/**
+	 * Body of the workers: wait for queued strips and send their frames
+	 * 
+	 * @param	index	index of the worker
+	 */
+	void workerLoop(unsigned int index);
+
+public:
+
+	/**
+	 * Start the workers. In case of error a LedStripException is thrown
+	 * 
+	 * @param	strips		maximum number of strips sharing the pool
+	 * @param	threads		number of workers, 0 to use one per CPU (at most one per strip)
+	 */
+	RenderPool(unsigned int strips, unsigned int threads = 0);
+
+	/**
+	 * Stop the workers, if still running, and release the resources
+	 */
+	~RenderPool();
+
+	/**
+	 * Queue a strip having a frame to send. It must not be called again for the
+	 * same strip until a worker has picked it up
+	 * 
+	 * @param	strip	LED strip to serve
+	 */
+	void post(LedStrip* strip);
+
+	/**
+	 * Wait until a strip is neither queued nor served by any worker, so that
+	 * it can be destroyed while the pool keeps running. The strip must not
+	 * publish any frame meanwhile
+	 * 
+	 * @param	strip	LED strip to give back
+	 */
+	void release(LedStrip* strip);
+
+	/**
+	 * Wait for the workers to finish the frame they are sending, and stop them.
+	 * It must be called before destroying the strips using the pool
+	 */
+	void stop();
+
+	/**
+	 * Return the handles of the workers, to tune their scheduling
+	 * 
+	 * @return	vector containing one handle per worker
+	 */
+	std::vector<std::thread::native_handle_type> getThreads();
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef __STATION_H__
+#define __STATION_H__
+
+#include <memory>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+
+#include "Animator.h"
+#include "BatchStats.h"
+#include "Compositor.h"
+#include "LatencyMetrics.h"
+#include "LedStrip.h"
+#include "MidiSource.h"
+#include "NoteMapper.h"
+#include "PianoTutorPlusConfig.h"
+#include "RenderPool.h"
+
+/**
+ * Keyboard and LED strip driven by the program, along with its own configuration,
+ * key state and counters. The events of a station are applied one at a time to
+ * the layers of its strip, which are composed and shown by a single frame when
+ * the batch they belong to is flushed. The configuration is an immutable snapshot,
+ * which can be replaced between two batches by a newer one
+ */
+class Station {
+
+	std::string name;
+	std::shared_ptr<const PianoTutorPlusConfig> config;
+	RenderPool* pool;
+
+	LatencyMetrics metrics;
+	BatchStats stats;
+	std::unique_ptr<LedStrip> strip;
+	Compositor compositor;
+	std::unique_ptr<Animator> animator;
+	NoteMapper mapper;
+
+	// events applied since the last flush, and arrival of the oldest one
+	unsigned long batch;
+	uint64_t oldest;
+	// true if the frame has to be published at the next flush, even without events
+	bool resynced;
+	unsigned long resyncs;
+
+	/**
+	 * Attach the metrics and the color correction of the configuration to
+	 * the strip
+	 */
+	void setupStrip();
+
+public:
+
+	/**
+	 * Build the station, creating the LED backend selected by its configuration.
+	 * In case of error a LedStripException is thrown
+	 * 
+	 * @param	name		name of the station, shown in the reports
+	 * @param	config		configuration of the station
+	 * @param	pool		workers sending the frames, nullptr for a dedicated render thread
+	 */
+	Station(const std::string& name, std::shared_ptr<const PianoTutorPlusConfig> config, RenderPool* pool);
+
+	/**
+	 * Apply an event to the back buffer of the strip, recording its latency
+	 * 
+	 * @param	event	MIDI event read from the source
+	 * 
+	 * @return	true if the event is the first of a new batch
+	 */
+	bool apply(const MidiEvent& event);
+
+	/**
+	 * Forget the state of the keyboard after some of its events have been lost:
+	 * all the keys are released and their LEDs switched off, so that no LED stays
+	 * on for a note-off that never arrived. The next events show the keys again
+	 * 
+	 * @return	true if nothing was applied since the last flush
+	 */
+	bool resync();
+
+	/**
+	 * Close the current batch, composing the layers and publishing a frame if
+	 * any LED changed
+	 */
+	void flush();
+
+	/**
+	 * Advance the fades of the keys by the frames elapsed on the frame clock,
+	 * publishing the resulting frame
+	 */
+	void animate();
+
+	/**
+	 * Switch to a new configuration, keeping the state of the keyboard. The
+	 * strip is initialized again only if its settings changed, or if the station
+	 * has none, while the brightness of its channels and its segments are changed
+	 * in place; if initializing it fails the previous configuration is kept, and if the
+	 * previous strip cannot be restored either the station goes on without a
+	 * strip until the next reload. It must be called between two batches
+	 * 
+	 * @param	next	new configuration of the station
+	 * 
+	 * @return	true if a new strip has been initialized
+	 */
+	bool reload(std::shared_ptr<const PianoTutorPlusConfig> next);
+
+	/**
+	 * Print a human-readable summary of the counters and of the latencies
+	 * 
+	 * @param	os		output stream
+	 */
+	void print(std::ostream& os) const;
+
+	// list of getters
+	const std::string& getName() const { return name; }
+	const PianoTutorPlusConfig& getConfig() const { return *config; }
+	LedStrip& getStrip() { return *strip; }		// only while the station has a strip
+	Compositor& getCompositor() { return compositor; }
+	LatencyMetrics& getMetrics() { return metrics; }
+	const BatchStats& getStats() const { return stats; }
+	unsigned long getResyncs() const { return resyncs; }
+
+	/**
+	 * Return the frame clock of the fades, to be watched for input
+	 * 
+	 * @return	file descriptor of the clock, -1 if the keys do not fade
+	 */
+	int getAnimationFd() const { return animator ? animator->getFd() : -1; }
+};
+
+#endif
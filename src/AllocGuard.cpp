@@ -0,0 +1,93 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <new>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "AllocGuard.h"
+
+#ifdef ALLOC_CHECK
+
+// only the thread running the event path is checked: the render and logging threads may allocate
+static thread_local bool armed = false;
+
+/**
+ * Replacement of the global operator new, aborting if the guard is armed. The
+ * array and nothrow versions of the standard library forward to this one
+ */
+void* operator new(std::size_t size) {
+	if(armed) {
+		static const char msg[] = "[AllocGuard] heap allocation in the steady-state event path\n";
+		if(write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {}
+		abort();
+	}
+
+	void* ptr = malloc(size ? size : 1);
+	if(ptr == nullptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t size) noexcept {
+	free(ptr);
+}
+
+/**
+ * Make any further heap allocation of the calling thread fatal
+ */
+void AllocGuard::arm() {
+	armed = true;
+}
+
+/**
+ * Allow heap allocations of the calling thread again
+ */
+void AllocGuard::disarm() {
+	armed = false;
+}
+
+#else
+
+/**
+ * Make any further heap allocation of the calling thread fatal
+ */
+void AllocGuard::arm() {
+}
+
+/**
+ * Allow heap allocations of the calling thread again
+ */
+void AllocGuard::disarm() {
+}
+
+#endif
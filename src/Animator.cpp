@@ -0,0 +1,288 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Animator.h"
+#include "Clock.h"
+#include "Logger.h"
+
+#define NOT_ACTIVE	UINT8_MAX	// position of a key missing from the list
+
+/**
+ * Return the level change per frame of an envelope
+ * 
+ * @param	time	duration of the envelope, in ms
+ * @param	fps		frame rate
+ * 
+ * @return	level change per frame, 0 if the envelope is disabled
+ */
+static uint32_t envelopeStep(unsigned int time, unsigned int fps) {
+	if(time == 0)
+		return 0;
+
+	uint64_t count = ((uint64_t) time * fps + 500) / 1000;
+	if(count == 0)
+		count = 1;
+	return (ANIMATION_FULL_LEVEL + count - 1) / count;
+}
+
+/**
+ * Build the engine with all the keys off, taking the envelope times and the
+ * frame rate from the configuration. In case of error a LedStripException
+ * is thrown
+ * 
+ * @param	config		configuration providing the LED spans and the envelopes
+ * @param	compositor	layers of the strip, the keys being drawn on the NOTES one
+ */
+Animator::Animator(const PianoTutorPlusConfig& config, Compositor& compositor)
+	: compositor(compositor), armed(false), activeKeys(0), frames(0) {
+
+	configure(config);
+
+	memset(colors, 0, sizeof(colors));
+	memset(levels, 0, sizeof(levels));
+	memset(targets, 0, sizeof(targets));
+	memset(positions, NOT_ACTIVE, sizeof(positions));
+
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(timerFd < 0) {
+		LOG_ERROR("Unable to create the frame clock: %s", strerror(errno));
+		throw LedStripException();
+	}
+}
+
+/**
+ * Release the frame clock
+ */
+Animator::~Animator() {
+	close(timerFd);
+}
+
+/**
+ * Take the envelope times, the frame rate and the LED spans from a new
+ * configuration. The keys keep their levels and go on fading from there
+ * 
+ * @param	config		configuration providing the LED spans and the envelopes
+ */
+void Animator::configure(const PianoTutorPlusConfig& config) {
+	this->config = &config;
+	framePeriod = NS_PER_SEC / config.getAnimationFps();
+	attackStep = envelopeStep(config.getAttackTime(), config.getAnimationFps());
+	decayStep = envelopeStep(config.getDecayTime(), config.getAnimationFps());
+
+	// a running clock picks up the new frame rate
+	if(armed)
+		setTimer(true);
+}
+
+/**
+ * Fade a key in, towards the provided color. A key already lit switches
+ * to the new color at its current level
+ * 
+ * @param	note	MIDI note of the key
+ * @param	color	color of the key at full level
+ */
+void Animator::press(unsigned char note, ws2811_led_t color) {
+	note &= MIDI_NOTES - 1;
+	colors[note] = color;
+	targets[note] = ANIMATION_FULL_LEVEL;
+	animate(note, attackStep);
+}
+
+/**
+ * Fade a key out, keeping its color
+ * 
+ * @param	note	MIDI note of the key
+ */
+void Animator::release(unsigned char note) {
+	note &= MIDI_NOTES - 1;
+	targets[note] = 0;
+	animate(note, decayStep);
+}
+
+/**
+ * Switch off all the keys at once, stopping the frame clock. The LEDs are
+ * left untouched
+ */
+void Animator::clear() {
+	memset(levels, 0, sizeof(levels));
+	memset(targets, 0, sizeof(targets));
+	memset(positions, NOT_ACTIVE, sizeof(positions));
+	activeKeys = 0;
+	setTimer(false);
+}
+
+/**
+ * Start moving a key towards its target: the first step is taken at once,
+ * so that the next frame already shows the change, and the frame clock is
+ * started if needed
+ * 
+ * @param	note	MIDI note of the key
+ * @param	stepSize	level change per frame
+ */
+void Animator::animate(unsigned char note, uint32_t stepSize) {
+	// without an envelope, the key jumps to its level
+	if(stepSize == 0)
+		levels[note] = targets[note];
+
+	if(levels[note] == targets[note] || step(note, 1)) {
+		deactivate(note);
+	} else if(positions[note] == NOT_ACTIVE) {
+		positions[note] = activeKeys;
+		active[activeKeys++] = note;
+		if(!armed)
+			setTimer(true);
+	}
+
+	show(note);
+}
+
+/**
+ * Remove a key from the list of the ones being animated
+ * 
+ * @param	note	MIDI note of the key
+ */
+void Animator::deactivate(unsigned char note) {
+	unsigned int position = positions[note];
+	if(position == NOT_ACTIVE)
+		return;
+
+	// the last key takes the place of the removed one
+	unsigned char last = active[--activeKeys];
+	active[position] = last;
+	positions[last] = position;
+	positions[note] = NOT_ACTIVE;
+}
+
+/**
+ * Move the level of a key towards its target
+ * 
+ * @param	note	MIDI note of the key
+ * @param	count	number of frames elapsed
+ * 
+ * @return	true if the key reached its target
+ */
+bool Animator::step(unsigned char note, uint64_t count) {
+	uint32_t level = levels[note];
+	uint32_t target = targets[note];
+
+	// an envelope disabled by a new configuration ends at once
+	if(level < target) {
+		uint64_t delta = attackStep * count;
+		levels[note] = delta && delta < target - level ? level + delta : target;
+	} else {
+		uint64_t delta = decayStep * count;
+		levels[note] = delta && delta < level - target ? level - delta : target;
+	}
+
+	return levels[note] == target;
+}
+
+/**
+ * Write the color of a key to its LEDs, with its level as opacity
+ * 
+ * @param	note	MIDI note of the key
+ */
+void Animator::show(unsigned char note) {
+	const LedSpan& span = config->getLedSpan(note);
+	unsigned short end = span.first + span.length;
+
+	uint8_t alpha = (levels[note] * 255 + ANIMATION_FULL_LEVEL / 2) >> ANIMATION_LEVEL_BITS;
+	for(unsigned short pos = span.first; pos < end; pos++)
+		compositor.setColor(Compositor::NOTES, pos, colors[note], alpha);
+}
+
+/**
+ * Advance the envelopes of the keys being animated, writing their LEDs, and
+ * stop the frame clock when no key is left to animate
+ * 
+ * @param	count	number of frames elapsed
+ * 
+ * @return	number of keys still being animated
+ */
+unsigned int Animator::advance(uint64_t count) {
+	for(unsigned int i = 0; i < activeKeys; ) {
+		unsigned char note = active[i];
+		bool done = step(note, count);
+		show(note);
+
+		// a finished key is replaced by the last one, which is visited next
+		if(done)
+			deactivate(note);
+		else
+			i++;
+	}
+
+	frames += count;
+	if(activeKeys == 0 && armed)
+		setTimer(false);
+
+	return activeKeys;
+}
+
+/**
+ * Consume the expirations of the frame clock, advancing the envelopes by
+ * as many frames
+ * 
+ * @return	number of keys still being animated
+ */
+unsigned int Animator::tick() {
+	uint64_t expirations;
+	if(read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return activeKeys;
+
+	// late frames are caught up at once, so the envelopes keep their duration
+	return advance(expirations);
+}
+
+/**
+ * Start or stop the frame clock
+ * 
+ * @param	running		true to start the clock, false to stop it
+ */
+void Animator::setTimer(bool running) {
+	struct itimerspec timer;
+	memset(&timer, 0, sizeof(timer));
+
+	if(running) {
+		timer.it_value = Clock::toTimespec(framePeriod);
+		timer.it_interval = timer.it_value;
+	}
+
+	if(timerfd_settime(timerFd, 0, &timer, nullptr) < 0)
+		LOG_WARNING("Unable to %s the frame clock: %s", running ? "start" : "stop", strerror(errno));
+	armed = running;
+	LOG_TRACE("Frame clock %s", running ? "started" : "stopped");
+}
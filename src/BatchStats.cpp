@@ -0,0 +1,79 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <ostream>
+
+#include "BatchStats.h"
+
+/**
+ * Build the object with all the counters set to zero
+ */
+BatchStats::BatchStats() : batches(0), events(0), renders(0), maxBatch(0), sizes() {
+}
+
+/**
+ * Record a drained batch
+ * 
+ * @param	size		number of events in the batch
+ * @param	rendered	true if the batch triggered a render
+ */
+void BatchStats::record(unsigned long size, bool rendered) {
+	if(size == 0)
+		return;
+
+	batches++;
+	events += size;
+	if(rendered)
+		renders++;
+	if(size > maxBatch)
+		maxBatch = size;
+
+	unsigned int bucket = 0;
+	while(size > 1 && bucket < BATCH_STATS_BUCKETS - 1) {
+		size >>= 1;
+		bucket++;
+	}
+	sizes[bucket]++;
+}
+
+/**
+ * Print a human-readable summary of the counters
+ * 
+ * @param	os		output stream
+ */
+void BatchStats::print(std::ostream& os) const {
+	static const char* labels[BATCH_STATS_BUCKETS] = {"1", "2-3", "4-7", "8-15", "16-31", "32+"};
+
+	os << "Batches: " << batches << ", events: " << events
+		<< ", renders: " << renders << ", renders saved: " << getRendersSaved()
+		<< ", max batch: " << maxBatch << std::endl;
+	os << "Batch sizes:";
+	for(unsigned int i = 0; i < BATCH_STATS_BUCKETS; i++)
+		os << " [" << labels[i] << "] " << sizes[i];
+	os << std::endl;
+}
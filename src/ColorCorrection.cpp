@@ -0,0 +1,167 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <math.h>
+#include <stdint.h>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "ColorCorrection.h"
+
+/**
+ * Build tables leaving the colors untouched, with every velocity at full
+ * brightness
+ */
+ColorCorrection::ColorCorrection() : identity(true) {
+	for(int c = 0; c < 3; c++)
+		for(int x = 0; x < 256; x++)
+			tables[c][x] = x;
+	for(int v = 0; v < VELOCITIES; v++)
+		levels[v] = 255;
+}
+
+/**
+ * Build the tables from the provided curves
+ * 
+ * @param	gamma			exponent of the gamma curve, 1 for a linear response
+ * @param	whiteBalance	maximum value of the red, green and blue channels
+ * @param	velocityGamma	exponent of the velocity-to-brightness curve, 0 to
+ * 							show every velocity at full brightness
+ * @param	minLevel		brightness level of the softest note, from 0 to 255
+ */
+ColorCorrection::ColorCorrection(double gamma, const uint8_t (&whiteBalance)[3], double velocityGamma, uint8_t minLevel)
+	: identity(true) {
+
+	for(int c = 0; c < 3; c++) {
+		for(int x = 0; x < 256; x++) {
+			tables[c][x] = lround(pow(x / 255.0, gamma) * whiteBalance[c]);
+			if(tables[c][x] != x)
+				identity = false;
+		}
+	}
+
+	// velocity 0 never reaches the mapper (it is a NOTE_OFF), but it gets the softest level anyway
+	for(int v = 0; v < VELOCITIES; v++) {
+		if(velocityGamma <= 0)
+			levels[v] = 255;
+		else
+			levels[v] = lround(minLevel + (255 - minLevel) * pow(v / (VELOCITIES - 1.0), velocityGamma));
+	}
+}
+
+/**
+ * Correct a frame one LED at a time. It is the reference the vectorised
+ * implementations must match exactly
+ * 
+ * @param	in		values of the LEDs
+ * @param	out		corrected values, it can be the same array as in
+ * @param	count	number of LEDs
+ */
+void ColorCorrection::applyScalar(const ws2811_led_t* in, ws2811_led_t* out, unsigned int count) const {
+	for(unsigned int i = 0; i < count; i++) {
+		ws2811_led_t led = in[i];
+		out[i] = (led & 0xFF000000u) |
+				((ws2811_led_t) tables[0][(led >> 16) & 0xFF] << 16) |
+				((ws2811_led_t) tables[1][(led >> 8) & 0xFF] << 8) |
+				(ws2811_led_t) tables[2][led & 0xFF];
+	}
+}
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+/**
+ * Look up 16 bytes at once in a 256-entry table, split into four 64-byte
+ * tables: indices out of range of a TBX leave the destination lane untouched
+ * 
+ * @param	table	table, as four groups of four registers
+ * @param	index	indices to look up
+ * 
+ * @return	values found in the table
+ */
+static inline uint8x16_t lookup(const uint8x16x4_t (&table)[4], uint8x16_t index) {
+	uint8x16_t value = vqtbl4q_u8(table[0], index);
+	value = vqtbx4q_u8(value, table[1], vsubq_u8(index, vdupq_n_u8(64)));
+	value = vqtbx4q_u8(value, table[2], vsubq_u8(index, vdupq_n_u8(128)));
+	return vqtbx4q_u8(value, table[3], vsubq_u8(index, vdupq_n_u8(192)));
+}
+#endif
+
+/**
+ * Correct a frame, with the fastest implementation available on the target
+ * (NEON on 64-bit ARM, the scalar one elsewhere)
+ * 
+ * @param	in		values of the LEDs
+ * @param	out		corrected values, it can be the same array as in
+ * @param	count	number of LEDs
+ */
+void ColorCorrection::apply(const ws2811_led_t* in, ws2811_led_t* out, unsigned int count) const {
+	unsigned int i = 0;
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+	// LD4 splits 16 LEDs into their channels (on little-endian targets byte 0 is
+	// blue, 1 green, 2 red and 3 white), then each channel takes 4 table lookups
+	uint8x16x4_t red[4], green[4], blue[4];
+	for(int k = 0; k < 4; k++) {
+		for(int r = 0; r < 4; r++) {
+			red[k].val[r] = vld1q_u8(tables[0] + 64 * k + 16 * r);
+			green[k].val[r] = vld1q_u8(tables[1] + 64 * k + 16 * r);
+			blue[k].val[r] = vld1q_u8(tables[2] + 64 * k + 16 * r);
+		}
+	}
+
+	for(; i + 16 <= count; i += 16) {
+		uint8x16x4_t leds = vld4q_u8((const uint8_t*) (in + i));
+		leds.val[0] = lookup(blue, leds.val[0]);
+		leds.val[1] = lookup(green, leds.val[1]);
+		leds.val[2] = lookup(red, leds.val[2]);
+		vst4q_u8((uint8_t*) (out + i), leds);
+	}
+#endif
+
+	applyScalar(in + i, out + i, count - i);
+}
+
+/**
+ * Scale each channel of a color by a brightness level, rounding to the
+ * nearest value
+ * 
+ * @param	color	0xWWRRGGBB color
+ * @param	level	brightness level, 255 leaves the color untouched
+ * 
+ * @return	scaled color
+ */
+ws2811_led_t ColorCorrection::scale(ws2811_led_t color, uint8_t level) {
+	ws2811_led_t scaled = 0;
+	for(int shift = 0; shift < 32; shift += 8) {
+		unsigned int channel = (color >> shift) & 0xFF;
+		scaled |= (ws2811_led_t) ((channel * level + 127) / 255) << shift;
+	}
+	return scaled;
+}
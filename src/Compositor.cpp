@@ -0,0 +1,299 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Compositor.h"
+
+/**
+ * Blend a component of a layer over the one below it, rounding to the
+ * nearest value: every implementation must produce the same result
+ * 
+ * @param	below	component below the layer
+ * @param	layer	component of the layer
+ * @param	alpha	opacity of the layer
+ * 
+ * @return	blended component
+ */
+static inline uint8_t mix(unsigned int below, unsigned int layer, unsigned int alpha) {
+	unsigned int t = below * (255 - alpha) + layer * alpha + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+/**
+ * Build the layers of a strip, all of them transparent. In case of error
+ * a LedStripException is thrown
+ * 
+ * @param	count	number of LEDs in the strip
+ */
+Compositor::Compositor(unsigned short count)
+	: count(0), stride(0), planes(nullptr), output(nullptr), usedLayers(0), dirtyFirst(0), dirtyEnd(0) {
+
+	resize(count);
+}
+
+/**
+ * Release the layers
+ */
+Compositor::~Compositor() {
+	free(planes);
+	free(output);
+}
+
+/**
+ * Change the number of LEDs, making all the layers transparent again. In
+ * case of error a LedStripException is thrown and the layers are kept
+ * 
+ * @param	count	number of LEDs in the strip
+ */
+void Compositor::resize(unsigned short count) {
+	unsigned int stride = (count + COMPOSITOR_ALIGNMENT - 1) / COMPOSITOR_ALIGNMENT * COMPOSITOR_ALIGNMENT;
+
+	void* memory;
+	if(posix_memalign(&memory, COMPOSITOR_ALIGNMENT, LAYERS * 4 * stride) != 0)
+		throw LedStripException();
+	uint8_t* planes = (uint8_t*) memory;
+
+	if(posix_memalign(&memory, COMPOSITOR_ALIGNMENT, stride * sizeof(ws2811_led_t)) != 0) {
+		free(planes);
+		throw LedStripException();
+	}
+
+	free(this->planes);
+	free(this->output);
+	this->planes = planes;
+	this->output = (ws2811_led_t*) memory;
+	this->count = count;
+	this->stride = stride;
+
+	memset(this->planes, 0, LAYERS * 4 * stride);
+	memset(this->output, 0, stride * sizeof(ws2811_led_t));
+	usedLayers = 0;
+	dirtyFirst = 0;
+	dirtyEnd = 0;
+}
+
+/**
+ * Set the color of a LED in a layer
+ * 
+ * @param	layer	layer to draw on
+ * @param	pos		position of the LED in the strip
+ * @param	color	color as 0x00RRGGBB
+ * @param	alpha	opacity, from 0 (transparent) to 255 (opaque)
+ */
+void Compositor::setColor(Layer layer, unsigned short pos, ws2811_led_t color, uint8_t alpha) {
+	if(pos >= count)
+		return;
+
+	plane(layer, 0)[pos] = color >> 16;
+	plane(layer, 1)[pos] = color >> 8;
+	plane(layer, 2)[pos] = color;
+	plane(layer, 3)[pos] = alpha;
+
+	if(alpha)
+		usedLayers |= 1u << layer;
+
+	if(dirtyFirst == dirtyEnd) {
+		dirtyFirst = pos;
+		dirtyEnd = pos + 1;
+	} else {
+		dirtyFirst = std::min<unsigned int>(dirtyFirst, pos);
+		dirtyEnd = std::max<unsigned int>(dirtyEnd, pos + 1);
+	}
+}
+
+/**
+ * Make a whole layer transparent
+ * 
+ * @param	layer	layer to clear
+ */
+void Compositor::clearLayer(Layer layer) {
+	memset(plane(layer, 0), 0, 4 * stride);
+	usedLayers &= ~(1u << layer);
+	dirtyFirst = 0;
+	dirtyEnd = count;
+}
+
+/**
+ * Blend the LEDs touched since the last composition and write them to the
+ * back buffer of the strip, which is not rendered
+ * 
+ * @param	strip	strip receiving the frame
+ * 
+ * @return	true if any LED was blended
+ */
+bool Compositor::composite(LedStrip& strip) {
+	if(dirtyFirst == dirtyEnd)
+		return false;
+
+	// the range is widened to whole blocks, which the planes always contain
+	unsigned int first = dirtyFirst / COMPOSITOR_BLOCK * COMPOSITOR_BLOCK;
+	unsigned int end = (dirtyEnd + COMPOSITOR_BLOCK - 1) / COMPOSITOR_BLOCK * COMPOSITOR_BLOCK;
+	blend(first, end);
+
+	strip.setColors(dirtyFirst, output + dirtyFirst, dirtyEnd - dirtyFirst);
+	dirtyFirst = dirtyEnd = 0;
+	return true;
+}
+
+#if defined(__ARM_NEON)
+/**
+ * Blend 16 components of a layer over the ones below it
+ * 
+ * @param	below	components below the layer
+ * @param	layer	components of the layer
+ * @param	alpha	opacity of the layer
+ * 
+ * @return	blended components
+ */
+static inline uint8x16_t mix(uint8x16_t below, uint8x16_t layer, uint8x16_t alpha) {
+	uint8x16_t inverse = vmvnq_u8(alpha);
+	uint16x8_t low = vmull_u8(vget_low_u8(below), vget_low_u8(inverse));
+	uint16x8_t high = vmull_u8(vget_high_u8(below), vget_high_u8(inverse));
+	low = vaddq_u16(vmlal_u8(low, vget_low_u8(layer), vget_low_u8(alpha)), vdupq_n_u16(128));
+	high = vaddq_u16(vmlal_u8(high, vget_high_u8(layer), vget_high_u8(alpha)), vdupq_n_u16(128));
+	return vcombine_u8(vshrn_n_u16(vsraq_n_u16(low, low, 8), 8), vshrn_n_u16(vsraq_n_u16(high, high, 8), 8));
+}
+#elif defined(__SSE2__)
+/**
+ * Blend 8 components, widened to 16 bits, of a layer over the ones below it
+ * 
+ * @param	below	components below the layer
+ * @param	layer	components of the layer
+ * @param	alpha	opacity of the layer
+ * 
+ * @return	blended components, still widened
+ */
+static inline __m128i mix16(__m128i below, __m128i layer, __m128i alpha) {
+	__m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+	__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(below, inverse), _mm_mullo_epi16(layer, alpha)),
+			_mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/**
+ * Blend 16 components of a layer over the ones below it
+ * 
+ * @param	below	components below the layer
+ * @param	layer	components of the layer
+ * @param	alpha	opacity of the layer
+ * 
+ * @return	blended components
+ */
+static inline __m128i mix(__m128i below, __m128i layer, __m128i alpha) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i low = mix16(_mm_unpacklo_epi8(below, zero), _mm_unpacklo_epi8(layer, zero), _mm_unpacklo_epi8(alpha, zero));
+	__m128i high = mix16(_mm_unpackhi_epi8(below, zero), _mm_unpackhi_epi8(layer, zero), _mm_unpackhi_epi8(alpha, zero));
+	return _mm_packus_epi16(low, high);
+}
+#endif
+
+/**
+ * Blend a range of LEDs into the output frame, with the fastest
+ * implementation available on the target
+ * 
+ * @param	first	first LED, multiple of COMPOSITOR_BLOCK
+ * @param	end		LED after the last one, multiple of COMPOSITOR_BLOCK
+ */
+void Compositor::blend(unsigned int first, unsigned int end) {
+#if defined(__ARM_NEON)
+	// each block stays in registers through all the layers, then it is
+	// interleaved into B, G, R, 0 bytes: 0x00RRGGBB words on a little-endian CPU
+	for(unsigned int i = first; i < end; i += COMPOSITOR_BLOCK) {
+		uint8x16x4_t pixels;
+		pixels.val[0] = pixels.val[1] = pixels.val[2] = pixels.val[3] = vdupq_n_u8(0);
+		for(unsigned int layer = 0; layer < LAYERS; layer++) {
+			if(!(usedLayers & (1u << layer)))
+				continue;
+			uint8x16_t alpha = vld1q_u8(plane(layer, 3) + i);
+			pixels.val[2] = mix(pixels.val[2], vld1q_u8(plane(layer, 0) + i), alpha);
+			pixels.val[1] = mix(pixels.val[1], vld1q_u8(plane(layer, 1) + i), alpha);
+			pixels.val[0] = mix(pixels.val[0], vld1q_u8(plane(layer, 2) + i), alpha);
+		}
+		vst4q_u8((uint8_t*) (output + i), pixels);
+	}
+#elif defined(__SSE2__)
+	// each block stays in registers through all the layers, then it is
+	// interleaved into 0x00RRGGBB words
+	__m128i zero = _mm_setzero_si128();
+	for(unsigned int i = first; i < end; i += COMPOSITOR_BLOCK) {
+		__m128i red = zero, green = zero, blue = zero;
+		for(unsigned int layer = 0; layer < LAYERS; layer++) {
+			if(!(usedLayers & (1u << layer)))
+				continue;
+			__m128i alpha = _mm_load_si128((const __m128i*) (plane(layer, 3) + i));
+			red = mix(red, _mm_load_si128((const __m128i*) (plane(layer, 0) + i)), alpha);
+			green = mix(green, _mm_load_si128((const __m128i*) (plane(layer, 1) + i)), alpha);
+			blue = mix(blue, _mm_load_si128((const __m128i*) (plane(layer, 2) + i)), alpha);
+		}
+
+		__m128i blueGreenLow = _mm_unpacklo_epi8(blue, green);
+		__m128i blueGreenHigh = _mm_unpackhi_epi8(blue, green);
+		__m128i redLow = _mm_unpacklo_epi8(red, zero);
+		__m128i redHigh = _mm_unpackhi_epi8(red, zero);
+		__m128i* out = (__m128i*) (output + i);
+		_mm_store_si128(out, _mm_unpacklo_epi16(blueGreenLow, redLow));
+		_mm_store_si128(out + 1, _mm_unpackhi_epi16(blueGreenLow, redLow));
+		_mm_store_si128(out + 2, _mm_unpacklo_epi16(blueGreenHigh, redHigh));
+		_mm_store_si128(out + 3, _mm_unpackhi_epi16(blueGreenHigh, redHigh));
+	}
+#else
+	blendScalar(first, end);
+#endif
+}
+
+/**
+ * Reference implementation of blend(), one LED at a time
+ * 
+ * @param	first	first LED
+ * @param	end		LED after the last one
+ */
+void Compositor::blendScalar(unsigned int first, unsigned int end) {
+	for(unsigned int i = first; i < end; i++) {
+		unsigned int red = 0, green = 0, blue = 0;
+		for(unsigned int layer = 0; layer < LAYERS; layer++) {
+			if(!(usedLayers & (1u << layer)))
+				continue;
+			unsigned int alpha = plane(layer, 3)[i];
+			red = mix(red, plane(layer, 0)[i], alpha);
+			green = mix(green, plane(layer, 1)[i], alpha);
+			blue = mix(blue, plane(layer, 2)[i], alpha);
+		}
+		output[i] = (red << 16) | (green << 8) | blue;
+	}
+}
@@ -86,7 +86,7 @@ Config Config::parse(const std::string& filename) {
 
 	configFile.open(filename);
 	if(!configFile.is_open())
-		throw OpenFileException();
+		throw OpenFileException(filename);
 
 	std::string line;
 	std::string value;
@@ -136,6 +136,19 @@ std::string Config::operator[](const std::string &key) {
 	return this->options[key];
 }
 
+/**
+ * Return the value associated to an optional key
+ * 
+ * @param	key				key of the pair
+ * @param	defaultValue	value returned if the key is not present
+ * 
+ * @return	the value associated to that key, or the default one
+ */
+std::string Config::get(const std::string& key, const std::string& defaultValue) const {
+	auto it = this->options.find(key);
+	return (it != this->options.end() && !it->second.empty()) ? it->second : defaultValue;
+}
+
 /**
  * Parse the provided string, returning the integer value
  * 
@@ -177,8 +190,8 @@ double Config::parseDouble(const std::string& str) {
  * @return	boolean value
  */
 bool Config::parseBoolean(const std::string& str) {
-    std::string val;
-    std::transform(str.begin(), str.end(), val.begin(), ::tolower);
-    return str == "true";
+    std::string val(str);
+    std::transform(val.begin(), val.end(), val.begin(), ::tolower);
+    return val == "true";
 }
 
@@ -0,0 +1,104 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+
+#include "ConfigWatcher.h"
+#include "Logger.h"
+
+#define WATCH_EVENTS	(IN_CLOSE_WRITE | IN_MOVED_TO)	// file written in place, or renamed over
+
+/**
+ * Start watching the provided files. If inotify is not available, a warning
+ * is printed and no change is ever reported
+ * 
+ * @param	files	names of the configuration files
+ */
+ConfigWatcher::ConfigWatcher(const std::vector<std::string>& files) {
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fd < 0) {
+		LOG_WARNING("Unable to watch the configuration files: %s", strerror(errno));
+		return;
+	}
+
+	for(const std::string& file : files) {
+		size_t slash = file.rfind('/');
+		std::string dir = slash == std::string::npos ? "." : file.substr(0, slash + 1);
+
+		// a directory holding many files is watched once, with the same descriptor
+		int wd = inotify_add_watch(fd, dir.c_str(), WATCH_EVENTS);
+		if(wd < 0)
+			LOG_WARNING("Unable to watch the directory of a configuration file: %s", strerror(errno));
+
+		watches.push_back(wd);
+		names.push_back(slash == std::string::npos ? file : file.substr(slash + 1));
+	}
+}
+
+/**
+ * Stop watching the files
+ */
+ConfigWatcher::~ConfigWatcher() {
+	if(fd >= 0)
+		close(fd);
+}
+
+/**
+ * Read the pending notifications, collecting the files written since the
+ * last call. Each file is reported once, however many times it was written
+ * 
+ * @param	changed		vector receiving the indexes of the changed files
+ */
+void ConfigWatcher::readChanges(std::vector<size_t>& changed) {
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length;
+
+	while((length = read(fd, buffer, sizeof(buffer))) > 0) {
+		for(ssize_t offset = 0; offset < length; ) {
+			const inotify_event* event = (const inotify_event*) (buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			// after an overflow, any of the files may have been written
+			bool lost = event->mask & IN_Q_OVERFLOW;
+			if(event->len == 0 && !lost)
+				continue;
+
+			for(size_t i = 0; i < names.size(); i++)
+				if((lost || (watches[i] == event->wd && names[i] == event->name)) &&
+						std::find(changed.begin(), changed.end(), i) == changed.end())
+					changed.push_back(i);
+		}
+	}
+}
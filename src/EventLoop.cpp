@@ -0,0 +1,143 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <functional>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "EventLoop.h"
+#include "Logger.h"
+
+/**
+ * Build an empty event loop
+ */
+EventLoop::EventLoop() : signalFd(-1), running(false) {
+	sigemptyset(&signalMask);
+}
+
+/**
+ * Destroy the event loop, closing the signalfd (if any)
+ */
+EventLoop::~EventLoop() {
+	if(signalFd >= 0)
+		close(signalFd);
+}
+
+/**
+ * Watch a file descriptor, invoking the handler when one of the requested
+ * events occurs
+ * 
+ * @param	fd			file descriptor to watch
+ * @param	events		poll() events of interest (ex. POLLIN)
+ * @param	handler		callback to execute, receiving the returned events
+ * 
+ * @return	reference to the object
+ */
+EventLoop& EventLoop::addFd(int fd, short events, std::function<void(short)> handler) {
+	fds.push_back({fd, events, 0});
+	handlers.push_back(handler);
+	return *this;
+}
+
+/**
+ * Handle the provided signal inside the loop. The signal is blocked for the
+ * calling thread, so this method has to be called before spawning any other
+ * thread, which would otherwise still receive it asynchronously. In case of
+ * error an EventLoopException is thrown
+ * 
+ * @param	signum		number of the signal
+ * @param	handler		callback to execute when the signal is received
+ * 
+ * @return	reference to the object
+ */
+EventLoop& EventLoop::addSignal(int signum, std::function<void()> handler) {
+	bool first = (signalFd < 0);
+
+	sigaddset(&signalMask, signum);
+	if(sigprocmask(SIG_BLOCK, &signalMask, nullptr) < 0)
+		throw EventLoopException();
+
+	// passing the old descriptor just updates its mask
+	signalFd = signalfd(signalFd, &signalMask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(signalFd < 0)
+		throw EventLoopException();
+
+	signalHandlers[signum] = handler;
+
+	if(first)
+		addFd(signalFd, POLLIN, [this](short revents) {
+			dispatchSignals();
+		});
+
+	return *this;
+}
+
+/**
+ * Read all the pending signals from the signalfd, invoking the registered handlers
+ */
+void EventLoop::dispatchSignals() {
+	signalfd_siginfo info;
+
+	while(read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+		LOG_VERBOSE("Received signal %d", info.ssi_signo);
+		auto it = signalHandlers.find(info.ssi_signo);
+		if(it != signalHandlers.end())
+			it->second();
+	}
+}
+
+/**
+ * Block waiting for events and dispatch them, until stop() is called
+ */
+void EventLoop::run() {
+	running = true;
+
+	while(running) {
+		if(poll(fds.data(), fds.size(), -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			throw EventLoopException();
+		}
+
+		// handlers may register new descriptors, so only the ones polled are visited
+		std::size_t count = fds.size();
+		for(std::size_t i = 0; i < count && running; i++) {
+			if(fds[i].revents != 0)
+				handlers[i](fds[i].revents);
+		}
+	}
+}
+
+/**
+ * Make run() return after the current iteration
+ */
+void EventLoop::stop() {
+	running = false;
+}
@@ -0,0 +1,107 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <iomanip>
+#include <ostream>
+
+#include "Histogram.h"
+
+/**
+ * Build an empty histogram
+ */
+Histogram::Histogram() : count(0), max(0) {
+	for(auto& bucket : buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Return the bucket holding the provided value
+ */
+unsigned int Histogram::bucketOf(uint64_t value) {
+	if(value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+
+	unsigned int msb = 63 - __builtin_clzll(value);
+	unsigned int shift = msb - HISTOGRAM_SUB_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * Return the highest value held by the provided bucket
+ */
+uint64_t Histogram::upperBound(unsigned int bucket) {
+	if(bucket < HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	unsigned int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+	return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * Return the value below which the provided fraction of the recorded values lies
+ * 
+ * @param	fraction	fraction of the values, between 0 and 1 (ex. 0.99)
+ * 
+ * @return	upper bound of the bucket holding the percentile
+ */
+uint64_t Histogram::getPercentile(double fraction) const {
+	uint64_t total = getCount();
+	if(total == 0)
+		return 0;
+
+	uint64_t target = fraction * total;
+	if(target >= total)
+		target = total - 1;
+
+	uint64_t seen = 0;
+	for(unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if(seen > target) {
+			uint64_t bound = upperBound(i);
+			return bound < getMax() ? bound : getMax();
+		}
+	}
+	return getMax();
+}
+
+/**
+ * Print count, p50, p99, p999 and max, converting ns into us
+ * 
+ * @param	os		output stream
+ * @param	name	name of the histogram
+ */
+void Histogram::print(std::ostream& os, const char* name) const {
+	os << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1)
+		<< " count " << std::setw(10) << getCount()
+		<< "  p50 " << std::setw(9) << getPercentile(0.5) / 1000.0
+		<< "  p99 " << std::setw(9) << getPercentile(0.99) / 1000.0
+		<< "  p999 " << std::setw(9) << getPercentile(0.999) / 1000.0
+		<< "  max " << std::setw(9) << getMax() / 1000.0 << " us" << std::endl;
+	os.unsetf(std::ios_base::floatfield);
+}
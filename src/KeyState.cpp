@@ -0,0 +1,93 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <string.h>
+
+#include "KeyState.h"
+
+/**
+ * Build the object with all the keys released
+ */
+KeyState::KeyState() {
+	clear();
+}
+
+/**
+ * Register a key press
+ * 
+ * @param	note	MIDI note
+ * @param	holder	index of the holder pressing the key
+ * 
+ * @return	true if the holder shown on the key changed
+ */
+bool KeyState::press(unsigned char note, unsigned int holder) {
+	note &= MIDI_NOTES - 1;
+	if(holder >= KEY_STATE_HOLDERS)
+		return false;
+
+	int before = getHolder(note);
+
+	if(counts[note][holder] < UINT16_MAX)
+		counts[note][holder]++;
+	active[note] |= 1u << holder;
+
+	return getHolder(note) != before;
+}
+
+/**
+ * Register a key release. Releases without a matching press are ignored
+ * 
+ * @param	note	MIDI note
+ * @param	holder	index of the holder releasing the key
+ * 
+ * @return	true if the holder shown on the key changed
+ */
+bool KeyState::release(unsigned char note, unsigned int holder) {
+	note &= MIDI_NOTES - 1;
+	if(holder >= KEY_STATE_HOLDERS || counts[note][holder] == 0)
+		return false;
+
+	// a saturated count has lost track of the presses
+	if(counts[note][holder] == UINT16_MAX)
+		return false;
+
+	int before = getHolder(note);
+
+	if(--counts[note][holder] == 0)
+		active[note] &= ~(1u << holder);
+
+	return getHolder(note) != before;
+}
+
+/**
+ * Release all the keys
+ */
+void KeyState::clear() {
+	memset(counts, 0, sizeof(counts));
+	memset(active, 0, sizeof(active));
+}
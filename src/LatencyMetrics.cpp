@@ -26,22 +26,19 @@
  */
 
 
-#ifndef __DEBUG_H__
-#define __DEBUG_H__
+#include <ostream>
 
-#include <iostream>
-#include <stdio.h>
+#include "LatencyMetrics.h"
 
-#define DEBUG_MSG_BUF_LEN   128
-
-#ifdef DEBUG
-#define dprintf(...) {\
-            char str[DEBUG_MSG_BUF_LEN];\
-            sprintf(str, __VA_ARGS__);\
-            std::cout << "[" << __FUNCTION__ << "()@line" << __LINE__ << "] " << str << std::endl;\
-        }
-#else
-#define dprintf(...) 
-#endif
+/**
+ * Print the percentiles of all the stages
+ * 
+ * @param	os		output stream
+ */
+void LatencyMetrics::print(std::ostream& os) const {
+	static const char* names[STAGES] = {"dequeue", "map", "render submit", "render complete", "end-to-end"};
 
-#endif
+	os << "Latency (" << (settings.empty() ? "default scheduling" : settings) << "):" << std::endl;
+	for(int stage = 0; stage < STAGES; stage++)
+		histograms[stage].print(os, names[stage]);
+}
@@ -0,0 +1,266 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "LedBackend.h"
+#include "LedStrip.h"
+#include "Logger.h"
+#include "PianoTutorPlusConfig.h"
+
+#define WS2811_BITS_PER_LED		24
+#define WS2811_RESET_TIME_NS	50000
+
+/**
+ * Parse a string, obtaining the corresponding backend. Only the backends
+ * built into the program are accepted
+ * 
+ * @param	type	string representing the backend
+ * 
+ * @return	corresponding Type value
+ */
+LedBackendType::Type LedBackendType::parse(std::string type) {
+	std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+#ifndef NO_WS2811
+	if(type == "ws2811")
+		return WS2811;
+#endif
+	if(type == "null")
+		return NONE;
+	else if(type == "memory")
+		return MEMORY;
+	else if(type == "file")
+		return FILE;
+	else
+		throw LedBackendNotFoundException();
+}
+
+/**
+ * Return the name of the provided backend
+ * 
+ * @param	type	backend
+ * 
+ * @return	name of the backend
+ */
+const char* LedBackendType::toString(LedBackendType::Type type) {
+	switch(type) {
+		case WS2811:
+			return "WS2811";
+		case NONE:
+			return "NULL";
+		case MEMORY:
+			return "MEMORY";
+		case FILE:
+			return "FILE";
+		default:
+			return nullptr;
+	}
+}
+
+/**
+ * Return the list of all the backends built into the program
+ * 
+ * @return	vector containing all the available backends
+ */
+const std::vector<LedBackendType::Type>& LedBackendType::getAllBackendTypes() {
+#ifndef NO_WS2811
+	static const std::vector<LedBackendType::Type> types({WS2811, NONE, MEMORY, FILE});
+#else
+	static const std::vector<LedBackendType::Type> types({NONE, MEMORY, FILE});
+#endif
+	return types;
+}
+
+/**
+ * Build the backend selected by the configuration. In case of error a
+ * LedStripException is thrown
+ * 
+ * @param	config	program configuration
+ * 
+ * @return	the new backend
+ */
+std::unique_ptr<LedBackend> LedBackend::create(const PianoTutorPlusConfig& config) {
+	switch(config.getLedBackend()) {
+#ifndef NO_WS2811
+		case LedBackendType::WS2811:
+			return std::unique_ptr<LedBackend>(new Ws2811Backend(config.getFreq(),
+					config.getDmaChannel(), config.getLedChannels(), config.getLedSegments()));
+#endif
+		default:
+			break;
+	}
+
+	std::unique_ptr<SimulatedBackend> backend;
+	switch(config.getLedBackend()) {
+		case LedBackendType::NONE:
+			backend.reset(new NullBackend(config.getFreq(), config.getSimulateDma()));
+			break;
+		case LedBackendType::MEMORY:
+			backend.reset(new MemoryBackend(config.getFreq(), config.getSimulateDma()));
+			break;
+		case LedBackendType::FILE:
+			backend.reset(new FileBackend(config.getLedBackendFile(),
+					config.getFreq(), config.getSimulateDma()));
+			break;
+		default:
+			throw LedStripException();
+	}
+
+	unsigned int longest = 0;
+	for(const LedChannel& channel : config.getLedChannels())
+		if(channel.gpioPin != 0)
+			longest = std::max(longest, channel.count);
+	backend->setTransferLength(longest);
+	return std::unique_ptr<LedBackend>(std::move(backend));
+}
+
+/**
+ * Build the backend
+ * 
+ * @param	freq			driving frequency of the simulated strip
+ * @param	simulateDma		true to make wait() last as a real transfer
+ */
+SimulatedBackend::SimulatedBackend(unsigned int freq, bool simulateDma)
+	: freq(freq), simulateDma(simulateDma), transferLeds(0), transferEnd({0, 0}) {
+}
+
+/**
+ * Start the transfer of a frame, computing when a real strip would be done
+ * 
+ * @param	leds		values of the LEDs
+ * @param	count		number of LEDs
+ * @param	brightness	brightness of the whole strip
+ */
+void SimulatedBackend::render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) {
+	if(!simulateDma || freq == 0)
+		return;
+
+	if(transferLeds != 0)
+		count = transferLeds;
+
+	uint64_t ns = (uint64_t) count * WS2811_BITS_PER_LED * 1000000000ull / freq + WS2811_RESET_TIME_NS;
+
+	clock_gettime(CLOCK_MONOTONIC, &transferEnd);
+	ns += transferEnd.tv_nsec;
+	transferEnd.tv_sec += ns / 1000000000ull;
+	transferEnd.tv_nsec = ns % 1000000000ull;
+}
+
+/**
+ * Block until the simulated transfer is complete
+ */
+void SimulatedBackend::wait() {
+	if(simulateDma)
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &transferEnd, nullptr) != 0);
+}
+
+/**
+ * Store a copy of the frame
+ * 
+ * @param	leds		values of the LEDs
+ * @param	count		number of LEDs
+ * @param	brightness	brightness of the whole strip
+ */
+void MemoryBackend::render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) {
+	SimulatedBackend::render(leds, count, brightness);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	frames.emplace_back(leds, leds + count);
+}
+
+/**
+ * Return a copy of all the frames rendered so far
+ * 
+ * @return	vector of frames, oldest first
+ */
+std::vector<std::vector<ws2811_led_t>> MemoryBackend::getFrames() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return frames;
+}
+
+/**
+ * Forget all the frames rendered so far
+ */
+void MemoryBackend::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	frames.clear();
+}
+
+/**
+ * Open the output file. In case of error a LedStripException is thrown
+ * 
+ * @param	filename		name of the output file
+ * @param	freq			driving frequency of the simulated strip
+ * @param	simulateDma		true to make wait() last as a real transfer
+ */
+FileBackend::FileBackend(const std::string& filename, unsigned int freq, bool simulateDma)
+	: SimulatedBackend(freq, simulateDma) {
+	file = fopen(filename.c_str(), "wb");
+	if(file == nullptr)
+		throw LedStripException();
+	LOG_INFO("Dumping frames to %s", filename.c_str());
+}
+
+/**
+ * Flush and close the output file
+ */
+FileBackend::~FileBackend() {
+	fclose(file);
+}
+
+/**
+ * Append the frame to the file
+ * 
+ * @param	leds		values of the LEDs
+ * @param	count		number of LEDs
+ * @param	brightness	brightness of the whole strip
+ */
+void FileBackend::render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) {
+	SimulatedBackend::render(leds, count, brightness);
+
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	struct {
+		uint64_t timestamp;
+		uint32_t count;
+		uint8_t brightness;
+		uint8_t padding[3];
+	} header = {(uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec, count, brightness, {0, 0, 0}};
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(leds, sizeof(ws2811_led_t), count, file);
+}
@@ -27,11 +27,16 @@
 
 
 #include <algorithm>
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
-#include "debug.h"
+#include "Clock.h"
 #include "LedStrip.h"
+#include "Logger.h"
 
 /**
  * Parse a string, obtaining the corresponding Color
@@ -64,6 +69,34 @@ LedColor::Color LedColor::parse(std::string color) {
 		throw LedColor::ColorNotFoundException();
 }
 
+/**
+ * Parse a string holding either the name of a color or an arbitrary one,
+ * written as 0xRRGGBB or rgb(R, G, B) with components from 0 to 255
+ * 
+ * @param	color	string representing the color
+ * 
+ * @return	color as 0x00RRGGBB, ready to be sent to the strip
+ */
+ws2811_led_t LedColor::parseRgb(std::string color) {
+	unsigned int red, green, blue;
+	int length = 0;
+
+	std::transform(color.begin(), color.end(), color.begin(), ::tolower);
+
+	if(color.size() == 8 && color.compare(0, 2, "0x") == 0 &&
+			std::all_of(color.begin() + 2, color.end(), ::isxdigit))
+		return std::stoul(color, nullptr, 16);
+
+	if(sscanf(color.c_str(), "rgb ( %u , %u , %u )%n", &red, &green, &blue, &length) == 3 &&
+			(size_t) length == color.size()) {
+		if(red > 255 || green > 255 || blue > 255)
+			throw LedColor::ColorNotFoundException();
+		return (red << 16) | (green << 8) | blue;
+	}
+
+	return LedColor::parse(color);
+}
+
 /**
  * Return the name of the provided color
  * 
@@ -100,8 +133,9 @@ const char* LedColor::toString(LedColor::Color color) {
  * 
  * @return	vector containing all the available colors
  */
-std::vector<LedColor::Color> LedColor::getAllColors() {
-	return std::vector<LedColor::Color>({RED, ORANGE, YELLOW, GREEN, LIGHTBLUE, BLUE, PURPLE, PINK});
+const std::vector<LedColor::Color>& LedColor::getAllColors() {
+	static const std::vector<LedColor::Color> colors({RED, ORANGE, YELLOW, GREEN, LIGHTBLUE, BLUE, PURPLE, PINK});
+	return colors;
 }
 
 /**
@@ -161,8 +195,9 @@ const char* StripType::toString(StripType::Type type) {
  * 
  * @return	vector containing all the available strip types
  */
-std::vector<StripType::Type> StripType::getAllStripTypes() {
-	return std::vector<StripType::Type>({RGB, RBG, GRB, GBR, BRG, BGR});
+const std::vector<StripType::Type>& StripType::getAllStripTypes() {
+	static const std::vector<StripType::Type> types({RGB, RBG, GRB, GBR, BRG, BGR});
+	return types;
 }
 
 /**
@@ -207,46 +242,134 @@ const char* LedOrder::toString(LedOrder::Order order) {
  * 
  * @return	vector containing all the available LED orders
  */
-std::vector<LedOrder::Order> LedOrder::getAllLedOrders() {
-	return std::vector<LedOrder::Order>({DIR, INV});
+const std::vector<LedOrder::Order>& LedOrder::getAllLedOrders() {
+	static const std::vector<LedOrder::Order> orders({DIR, INV});
+	return orders;
 }
 
+#define SLOT_FRESH		0x4u
+#define SLOT_INDEX_MASK	0x3u
+
 /**
- * Initialize the LED strip starting from the provided parameters. In case of error a
- * LedStripException is thrown
+ * Initialize the LED strip, starting the render thread unless a pool is
+ * provided. In case of error a LedStripException is thrown
  * 
- * @param	freq		driving frequency
- * @param	dmaChannel	number of the DMA channel
- * @param	gpioPin		number of the GPIO pin
- * @param	stripType	type of the LED strip
+ * @param	backend		output stage receiving the frames
  * @param	count		number of LEDs in the strip
+ * @param	pool		workers sending the frames, nullptr for a dedicated thread
  */
-LedStrip::LedStrip(unsigned int freq, unsigned char dmaChannel, unsigned char gpioPin, StripType::Type stripType, unsigned char count) {
+LedStrip::LedStrip(std::unique_ptr<LedBackend> backend, unsigned short count, RenderPool* pool)
+	: backend(std::move(backend)), frame(count, 0), publishBuffer(0), renderBuffer(1), slot(2),
+	brightness(255), stopping(false), wakeFd(-1), pool(pool), poolOwned(false),
+	dirty(false), changedLeds(0), renders(0), skippedRenders(0), droppedFrames(0), sentFrames(0),
+	metrics(nullptr), corrected(count, 0) {
 
-    memset(&ledstring, 0, sizeof(ledstring));
-
-    ledstring.freq = freq;
-    ledstring.dmanum = dmaChannel;
+	for(unsigned int i = 0; i < 3; i++) {
+		buffers[i].assign(count, 0);
+		eventStamps[i] = 0;
+		publishStamps[i] = 0;
+	}
 
-    ledstring.channel[0].gpionum = gpioPin;
-    ledstring.channel[0].count = count;
-    ledstring.channel[0].invert = 0;
-    ledstring.channel[0].brightness = 255;
-    ledstring.channel[0].strip_type = stripType;
+	if(pool)
+		return;
 
-    if (ws2811_init(&ledstring) != WS2811_SUCCESS)
+	wakeFd = eventfd(0, EFD_CLOEXEC);
+	if(wakeFd < 0)
 		throw LedStripException();
 
+	renderThread = std::thread(&LedStrip::renderLoop, this);
 }
 
 /**
  * Destroy the LedStrip object and perfrom clean-up
  */
 LedStrip::~LedStrip() {
-    dprintf("LED strip clean-up");
+    LOG_VERBOSE("LED strip clean-up");
+
+	if(!pool) {
+		uint64_t one = 1;
+		stopping = true;
+		if(::write(wakeFd, &one, sizeof(one)) < 0)
+			LOG_ERROR("Unable to wake up the render thread");
+		renderThread.join();
+		close(wakeFd);
+	}
+
     clearAll();
-    render();
-    ws2811_fini(&ledstring);
+	send(frame, correction.get());
+}
+
+/**
+ * Body of the render thread: wait for published frames and send them to
+ * the strip, one at a time
+ */
+void LedStrip::renderLoop() {
+	uint64_t count;
+
+	Logger::registerThread();
+
+	while(true) {
+		if(read(wakeFd, &count, sizeof(count)) < 0 && errno != EINTR)
+			break;
+		if(stopping)
+			break;
+
+		sendPublished();
+	}
+}
+
+/**
+ * Send the last published frame, if it has not been sent yet
+ */
+void LedStrip::sendPublished() {
+	// a wakeup may refer to a frame already sent
+	if(!(slot.load(std::memory_order_acquire) & SLOT_FRESH))
+		return;
+
+	renderBuffer = slot.exchange(renderBuffer, std::memory_order_acq_rel) & SLOT_INDEX_MASK;
+	send(buffers[renderBuffer], corrections[renderBuffer].get());
+	sentFrames++;
+
+	if(metrics) {
+		uint64_t now = Clock::now();
+		metrics->record(LatencyMetrics::Stage::COMPLETE, publishStamps[renderBuffer], now);
+		if(eventStamps[renderBuffer])
+			metrics->record(LatencyMetrics::Stage::TOTAL, eventStamps[renderBuffer], now);
+	}
+}
+
+/**
+ * Invoked by a worker of the pool: send the published frames until none is
+ * left, then give the strip back to the pool
+ */
+void LedStrip::renderQueued() {
+	do {
+		sendPublished();
+		poolOwned.exchange(false, std::memory_order_acq_rel);
+
+		// a frame published after the last check, by a caller which found the strip
+		// still owned, is left to this worker: take the strip back, unless the caller
+		// has already queued it again
+	} while((slot.load(std::memory_order_acquire) & SLOT_FRESH) &&
+			!poolOwned.exchange(true, std::memory_order_acq_rel));
+}
+
+/**
+ * Send the provided frame through the backend, waiting for the transfer
+ * to complete
+ * 
+ * @param	leds		frame to send
+ * @param	correction	tables to apply, or nullptr to send the frame as it is
+ */
+void LedStrip::send(const std::vector<ws2811_led_t>& leds, const ColorCorrection* correction) {
+	const ws2811_led_t* values = leds.data();
+	if(correction) {
+		correction->apply(values, corrected.data(), leds.size());
+		values = corrected.data();
+	}
+
+	backend->render(values, leds.size(), brightness.load(std::memory_order_relaxed));
+	backend->wait();
 }
 
 /**
@@ -257,11 +380,30 @@ LedStrip::~LedStrip() {
  * @return	a reference to the object
  */
 LedStrip& LedStrip::setBrightness(unsigned char intensity){
-	dprintf("Set brightness to %d", intensity);
-    ledstring.channel[0].brightness = intensity;
+	LOG_VERBOSE("Set brightness to %d", intensity);
+	if(brightness.load(std::memory_order_relaxed) != intensity) {
+		brightness.store(intensity, std::memory_order_relaxed);
+		dirty = true;
+	}
     return *this;
 }
 
+/**
+ * Write a value into the desired LED, marking the frame as dirty only if
+ * the value actually changed
+ * 
+ * @param	pos		position of the LED in the strip
+ * @param	value	raw value of the LED
+ */
+void LedStrip::write(unsigned short pos, ws2811_led_t value) {
+	ws2811_led_t& led = frame[pos];
+	if(led != value) {
+		led = value;
+		changedLeds++;
+		dirty = true;
+	}
+}
+
 /**
  * Set the color of the desired LED
  * 
@@ -270,9 +412,41 @@ LedStrip& LedStrip::setBrightness(unsigned char intensity){
  * 
  * @return	a reference to the object
  */
-LedStrip& LedStrip::switchOn(unsigned char pos, LedColor::Color color) {
-    dprintf("Set color %s to LED %d", LedColor::toString(color), pos);
-    ledstring.channel[0].leds[pos] = color;
+LedStrip& LedStrip::switchOn(unsigned short pos, LedColor::Color color) {
+    LOG_TRACE("Set color %s to LED %d", LedColor::toString(color), pos);
+    write(pos, color);
+    return *this;
+}
+
+/**
+ * Set the desired LED to a raw 0xWWRRGGBB value
+ * 
+ * @param	pos		position of the LED in the strip
+ * @param	value	raw value of the LED
+ * 
+ * @return	a reference to the object
+ */
+LedStrip& LedStrip::setColor(unsigned short pos, ws2811_led_t value) {
+    LOG_TRACE("Set value %08x to LED %d", value, pos);
+    write(pos, value);
+    return *this;
+}
+
+/**
+ * Copy a range of raw 0xWWRRGGBB values into the LEDs
+ * 
+ * @param	first	position of the first LED in the strip
+ * @param	values	raw values of the LEDs
+ * @param	count	number of LEDs
+ * 
+ * @return	a reference to the object
+ */
+LedStrip& LedStrip::setColors(unsigned short first, const ws2811_led_t* values, unsigned short count) {
+    for(unsigned short i = 0; i < count; i++) {
+        if(frame[first + i] != values[i])
+            LOG_TRACE("Set value %08x to LED %d", values[i], first + i);
+        write(first + i, values[i]);
+    }
     return *this;
 }
 
@@ -283,9 +457,9 @@ LedStrip& LedStrip::switchOn(unsigned char pos, LedColor::Color color) {
  * 
  * @return	a reference to the object
  */
-LedStrip& LedStrip::switchOff(uint8_t pos) {
-    dprintf("Switch off LED %d", pos);
-    ledstring.channel[0].leds[pos] = 0;
+LedStrip& LedStrip::switchOff(unsigned short pos) {
+    LOG_TRACE("Switch off LED %d", pos);
+    write(pos, 0);
     return *this;
 }
 
@@ -296,14 +470,119 @@ LedStrip& LedStrip::switchOff(uint8_t pos) {
  */
 LedStrip& LedStrip::clearAll()
 {
-    memset(ledstring.channel[0].leds, 0, sizeof(ws2811_led_t) * ledstring.channel[0].count);
+	for(std::size_t pos = 0; pos < frame.size(); pos++)
+		write(pos, 0);
     return *this;
 }
 
 /**
- * Send commands to switch on/off the LEDs in the strip
+ * Set the metrics receiving the render latencies. It must be called before
+ * the first render
+ * 
+ * @param	metrics		latency metrics, or nullptr to disable them
+ * 
+ * @return	a reference to the object
+ */
+LedStrip& LedStrip::setMetrics(LatencyMetrics* metrics) {
+	this->metrics = metrics;
+	return *this;
+}
+
+/**
+ * Set the gamma and white balance correction applied to every frame right
+ * before it is sent. It can be changed between two renders: every frame is
+ * corrected with the tables set when it was published, which are kept alive
+ * until the frame is gone
+ * 
+ * @param	correction	tables to apply, or nullptr to send the frames as they are
+ * 
+ * @return	a reference to the object
+ */
+LedStrip& LedStrip::setColorCorrection(std::shared_ptr<const ColorCorrection> correction) {
+	this->correction = std::move(correction);
+	return *this;
+}
+
+/**
+ * Set the brightness of an output channel of the backend, shown by the
+ * next render
+ * 
+ * @param	channel		output channel
+ * @param	brightness	brightness of the channel
+ * 
+ * @return	a reference to the object
+ */
+LedStrip& LedStrip::setChannelBrightness(unsigned char channel, unsigned char brightness) {
+	LOG_VERBOSE("Set brightness of channel %d to %d", channel, brightness);
+	backend->setChannelBrightness(channel, brightness);
+	dirty = true;
+	return *this;
+}
+
+/**
+ * Map the strip on the output channels of the backend with new segments,
+ * keeping the number of LEDs of each channel. The next render sends the
+ * whole frame with the new mapping
+ * 
+ * @param	segments	mapping of the strip on the channels
+ * 
+ * @return	a reference to the object
  */
-void LedStrip::render()
+LedStrip& LedStrip::setSegments(const std::vector<LedSegment>& segments) {
+	backend->setSegments(segments);
+	dirty = true;
+	return *this;
+}
+
+/**
+ * Publish the back buffer to the render thread, which switches on/off the
+ * LEDs in the strip asynchronously. If nothing changed since the last render,
+ * the frame is not published at all
+ * 
+ * @param	eventStamp	arrival time of the oldest event shown by the frame, in ns
+ * 						(0 if unknown), used for the end-to-end latency
+ * 
+ * @return	true if the frame has been published, false if it was skipped
+ */
+bool LedStrip::render(uint64_t eventStamp)
 {
-    ws2811_render(&ledstring);
+	if(!dirty) {
+		skippedRenders++;
+		return false;
+	}
+
+	std::copy(frame.begin(), frame.end(), buffers[publishBuffer].begin());
+
+	// the events of a frame about to be dropped are shown by this one: inherit
+	// their stamp, so that the end-to-end latency accounts for the drop
+	unsigned int pending = slot.load(std::memory_order_acquire);
+	if(pending & SLOT_FRESH) {
+		uint64_t dropped = eventStamps[pending & SLOT_INDEX_MASK];
+		if(dropped && (!eventStamp || dropped < eventStamp))
+			eventStamp = dropped;
+	}
+	eventStamps[publishBuffer] = eventStamp;
+	publishStamps[publishBuffer] = Clock::now();
+	// the reference count is touched only after the correction changed
+	if(corrections[publishBuffer] != correction)
+		corrections[publishBuffer] = correction;
+
+	// swap the buffer into the slot: if the previous one was never picked up it is dropped
+	unsigned int previous = slot.exchange(publishBuffer | SLOT_FRESH, std::memory_order_acq_rel);
+	if(previous & SLOT_FRESH)
+		droppedFrames++;
+	publishBuffer = previous & SLOT_INDEX_MASK;
+
+	if(pool) {
+		if(!poolOwned.exchange(true, std::memory_order_acq_rel))
+			pool->post(this);
+	} else {
+		uint64_t one = 1;
+		if(::write(wakeFd, &one, sizeof(one)) < 0)
+			LOG_ERROR("Unable to wake up the render thread");
+	}
+
+	dirty = false;
+	renders++;
+	return true;
 }
@@ -0,0 +1,412 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Logger.h"
+
+#define LOG_FLUSH_PERIOD_MS	10		// period of the background thread, if it cannot be woken up
+#define LOG_LINE_LEN		256
+
+/**
+ * Parse a string, obtaining the corresponding level
+ * 
+ * @param	level	string representing the level
+ * 
+ * @return	corresponding Level value
+ */
+LogLevel::Level LogLevel::parse(std::string level) {
+	std::transform(level.begin(), level.end(), level.begin(), ::tolower);
+
+	if(level == "error")
+		return ERROR;
+	else if(level == "warning")
+		return WARNING;
+	else if(level == "info")
+		return INFO;
+	else if(level == "verbose")
+		return VERBOSE;
+	else if(level == "trace")
+		return TRACE;
+	else
+		throw LogLevelNotFoundException();
+}
+
+/**
+ * Return the name of the provided level
+ * 
+ * @param	level	log level
+ * 
+ * @return	name of the level
+ */
+const char* LogLevel::toString(LogLevel::Level level) {
+	switch(level) {
+		case ERROR:
+			return "ERROR";
+		case WARNING:
+			return "WARNING";
+		case INFO:
+			return "INFO";
+		case VERBOSE:
+			return "VERBOSE";
+		case TRACE:
+			return "TRACE";
+		default:
+			return nullptr;
+	}
+}
+
+/**
+ * Return the list of all the available levels
+ * 
+ * @return	vector containing all the available levels
+ */
+const std::vector<LogLevel::Level>& LogLevel::getAllLevels() {
+	static const std::vector<LogLevel::Level> levels({ERROR, WARNING, INFO, VERBOSE, TRACE});
+	return levels;
+}
+
+std::atomic<int> Logger::level(LOG_DEFAULT_LEVEL);
+
+/**
+ * Shared state of the logger: the rings of all the threads and the background
+ * thread. It is a single static object, so that at exit the thread is stopped
+ * before the rings are released
+ */
+struct LoggerState {
+	std::mutex mutex;		// guards the registration of the rings
+	std::mutex drainMutex;	// allows a single consumer at a time
+	std::unique_ptr<LogRing> rings[LOG_MAX_THREADS];
+	bool owned[LOG_MAX_THREADS];	// the ring belongs to a running thread
+	std::atomic<std::size_t> ringCount;
+	std::atomic<uint64_t> unregistered;	// records of threads left without a ring
+
+	std::thread thread;
+	int wakeupFd;			// eventfd waking the thread up, -1 to run it periodically
+	std::atomic<bool> pending;	// the thread has been woken up and has not run yet
+	std::atomic<bool> stopping;
+	FILE* output;
+
+	LoggerState() : owned(), ringCount(0), unregistered(0), wakeupFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+		pending(false), stopping(false), output(nullptr) {}
+	~LoggerState() {
+		Logger::stop();
+		if(wakeupFd >= 0)
+			close(wakeupFd);
+	}
+};
+
+static LoggerState state;
+
+/**
+ * Ring of a thread, given back when the thread exits. The records still in it
+ * are formatted as usual, the next owner appending its own after them
+ */
+struct ThreadRing {
+	LogRing* ring;
+
+	constexpr ThreadRing() : ring(nullptr) {}
+	~ThreadRing() {
+		if(!ring)
+			return;
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.owned[ring->getIndex()] = false;
+	}
+};
+
+static thread_local ThreadRing threadRing;
+
+/**
+ * Format the arguments of a record, following the conversions of its format string
+ * 
+ * @param	record	record to format
+ * @param	buf		output buffer
+ * @param	size	size of the buffer
+ */
+static void formatRecord(const LogRecord& record, char* buf, std::size_t size) {
+	const char* f = record.format;
+	std::size_t pos = 0;
+	unsigned int arg = 0;
+
+	while(*f && pos + 1 < size) {
+		if(*f != '%') {
+			buf[pos++] = *f++;
+			continue;
+		}
+		if(f[1] == '%') {
+			buf[pos++] = '%';
+			f += 2;
+			continue;
+		}
+
+		// copy flags, width and precision, dropping the length modifiers
+		char spec[16] = "%";
+		std::size_t len = 1;
+		for(f++; *f && strchr("-+ #0123456789.", *f) && len < sizeof(spec) - 4; f++)
+			spec[len++] = *f;
+		while(*f && strchr("hlLqjzt", *f))
+			f++;
+		char conversion = *f;
+		if(!conversion)
+			break;
+		f++;
+
+		if(arg >= record.argc) {
+			pos += snprintf(buf + pos, size - pos, "<?>");
+		} else if(strchr("diouxXc", conversion)) {
+			if(conversion != 'c') {
+				spec[len++] = 'l';
+				spec[len++] = 'l';
+			}
+			spec[len++] = conversion;
+			spec[len] = '\0';
+			if(conversion == 'c')
+				pos += snprintf(buf + pos, size - pos, spec, (int) record.args[arg]);
+			else if(conversion == 'd' || conversion == 'i')
+				pos += snprintf(buf + pos, size - pos, spec, (long long) record.args[arg]);
+			else
+				pos += snprintf(buf + pos, size - pos, spec, (unsigned long long) record.args[arg]);
+		} else if(strchr("fFeEgGaA", conversion)) {
+			double d;
+			memcpy(&d, &record.args[arg], sizeof(d));
+			spec[len++] = conversion;
+			spec[len] = '\0';
+			pos += snprintf(buf + pos, size - pos, spec, d);
+		} else if(conversion == 's') {
+			uint64_t offset = record.args[arg] < LOG_TEXT_LEN ? record.args[arg] : LOG_TEXT_LEN - 1;
+			spec[len++] = 's';
+			spec[len] = '\0';
+			pos += snprintf(buf + pos, size - pos, spec, record.text + offset);
+		} else if(conversion == 'p') {
+			pos += snprintf(buf + pos, size - pos, "%p", (void*) (uintptr_t) record.args[arg]);
+		} else {
+			pos += snprintf(buf + pos, size - pos, "<?>");
+		}
+		arg++;
+	}
+
+	if(pos >= size)
+		pos = size - 1;
+	buf[pos] = '\0';
+}
+
+/**
+ * Format all the pending records into the output file, merging the rings by
+ * timestamp. Nothing is allocated, so the loop can run while the event path
+ * forbids allocations
+ */
+static void drain() {
+	std::lock_guard<std::mutex> lock(state.drainMutex);
+	char message[LOG_LINE_LEN];
+	std::size_t count = state.ringCount.load(std::memory_order_acquire);
+
+	if(!state.output)
+		return;
+
+	while(true) {
+		LogRing* oldest = nullptr;
+		const LogRecord* record = nullptr;
+
+		for(std::size_t i = 0; i < count; i++) {
+			const LogRecord* candidate = state.rings[i]->peek();
+			if(candidate && (!record || candidate->timestamp < record->timestamp)) {
+				record = candidate;
+				oldest = state.rings[i].get();
+			}
+		}
+		if(!record)
+			break;
+
+		formatRecord(*record, message, sizeof(message));
+		fprintf(state.output, "[%5llu.%06llu] [%s] [T%u] [%s()@line%d] %s\n",
+				(unsigned long long) (record->timestamp / NS_PER_SEC),
+				(unsigned long long) (record->timestamp % NS_PER_SEC / NS_PER_US),
+				LogLevel::toString(record->site->level), record->thread,
+				record->site->function, record->site->line, message);
+		oldest->pop();
+	}
+
+	fflush(state.output);
+}
+
+/**
+ * Body of the background thread: format the pending records whenever it is
+ * woken up, so that it does not run at all while nothing is logged
+ */
+static void formatLoop() {
+	pollfd wakeup = {state.wakeupFd, POLLIN, 0};
+	uint64_t count;
+
+	while(!state.stopping.load(std::memory_order_acquire)) {
+		if(poll(&wakeup, 1, state.wakeupFd >= 0 ? -1 : LOG_FLUSH_PERIOD_MS) < 0)
+			continue;
+		if(state.wakeupFd >= 0 && read(state.wakeupFd, &count, sizeof(count)) < 0)
+			continue;
+
+		// the records written from now on wake the thread up again. The fence pairs
+		// with the one of wake(): either the records are seen here, or the writer
+		// sees that the thread must be woken up
+		state.pending.store(false, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		drain();
+	}
+}
+
+/**
+ * Set the level of the recorded statements. It can be changed at any time
+ * 
+ * @param	level	most verbose level to record
+ */
+void Logger::setLevel(LogLevel::Level level) {
+	Logger::level.store(level, std::memory_order_relaxed);
+}
+
+/**
+ * Return the current log level
+ */
+LogLevel::Level Logger::getLevel() {
+	return (LogLevel::Level) level.load(std::memory_order_relaxed);
+}
+
+/**
+ * Wake the background thread up after a record was written, unless another
+ * record already did since it last ran
+ */
+void Logger::wake() {
+	uint64_t one = 1;
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(state.pending.load(std::memory_order_relaxed) || state.pending.exchange(true))
+		return;
+	if(state.wakeupFd >= 0 && ::write(state.wakeupFd, &one, sizeof(one)) < 0)
+		state.pending.store(false);
+}
+
+/**
+ * Return the ring of the calling thread, registering it if needed. Return
+ * nullptr, counting the record as dropped, if all the LOG_MAX_THREADS rings
+ * belong to running threads
+ */
+LogRing* Logger::getRing() {
+	if(!threadRing.ring) {
+		registerThread();
+		if(!threadRing.ring)
+			state.unregistered.fetch_add(1, std::memory_order_relaxed);
+	}
+	return threadRing.ring;
+}
+
+/**
+ * Allocate the ring of the calling thread, or take the one of a thread which
+ * exited. It is done automatically by the first statement of the thread, so
+ * this is needed only by the threads which must not allocate while logging
+ */
+void Logger::registerThread() {
+	if(threadRing.ring)
+		return;
+
+	// a ring given back by a thread which exited is taken before allocating a new one
+	std::lock_guard<std::mutex> lock(state.mutex);
+	std::size_t count = state.ringCount.load(std::memory_order_relaxed);
+	std::size_t index = 0;
+	while(index < count && state.owned[index])
+		index++;
+
+	if(index == LOG_MAX_THREADS)
+		return;
+	if(index == count) {
+		state.rings[count].reset(new LogRing(count));
+		state.ringCount.store(count + 1, std::memory_order_release);
+	}
+
+	state.owned[index] = true;
+	threadRing.ring = state.rings[index].get();
+}
+
+/**
+ * Start the background thread formatting the records into the provided file.
+ * Records written earlier are kept and formatted as soon as it starts
+ * 
+ * @param	output	output file, which must stay open until stop()
+ */
+void Logger::start(FILE* output) {
+	if(state.thread.joinable())
+		return;
+
+	state.output = output;
+	state.stopping.store(false, std::memory_order_relaxed);
+	state.thread = std::thread(formatLoop);
+}
+
+/**
+ * Format all the pending records and stop the background thread
+ */
+void Logger::stop() {
+	if(!state.thread.joinable())
+		return;
+
+	uint64_t one = 1;
+	state.stopping.store(true, std::memory_order_release);
+	if(state.wakeupFd >= 0 && ::write(state.wakeupFd, &one, sizeof(one)) < 0)
+		LOG_WARNING("Unable to wake the logging thread up");
+	state.thread.join();
+
+	drain();
+}
+
+/**
+ * Format all the pending records into the output file right away
+ */
+void Logger::flush() {
+	drain();
+}
+
+/**
+ * Return the number of records dropped because a ring was full, or because
+ * no ring was left for the thread
+ */
+uint64_t Logger::getDropped() {
+	std::lock_guard<std::mutex> lock(state.mutex);
+	uint64_t dropped = state.unregistered.load(std::memory_order_relaxed);
+	for(std::size_t i = 0; i < state.ringCount.load(std::memory_order_relaxed); i++)
+		dropped += state.rings[i]->getDropped();
+	return dropped;
+}
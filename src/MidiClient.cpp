@@ -26,46 +26,109 @@
  */
 
 
-#include <algorithm>
 #include <alsa/asoundlib.h>
-#include <regex>
+#include <errno.h>
 #include <stdlib.h>
 #include <string>
+#include <vector>
 
-#include "debug.h"
+#include "Clock.h"
+#include "Logger.h"
 #include "MidiClient.h"
+#include "NoteName.h"
 
 /**
  * Open the MIDI sequencer in non-blocking mode, creates a client and a port, subscribing to it.
+ * The port is attached to a real-time queue, so every event is timestamped on arrival.
  * If something goes wrong, trows a MidiDeviceException()
  * 
  * @param	clientName		name of the MIDI client
  * @param	portName		name of the MIDI port
  */
 MidiClient::MidiClient(const char* clientName, const char* portName)
+	: MidiClient(clientName, std::vector<std::string>(1, portName)) {
+}
+
+/**
+ * Open the MIDI sequencer as above, creating one port per name. Port i gets
+ * number i, which is reported by the events it receives. Only note events are
+ * delivered by the kernel, the rest (clock, active sensing, ...) is filtered out.
+ * If something goes wrong, trows a MidiDeviceException()
+ * 
+ * @param	clientName		name of the MIDI client
+ * @param	portNames		names of the MIDI ports
+ * @param	inputBuffer		size of the user-space input buffer in bytes, 0 for the default
+ * @param	inputPool		size of the kernel input pool in events, 0 for the default
+ */
+MidiClient::MidiClient(const char* clientName, const std::vector<std::string>& portNames,
+		size_t inputBuffer, size_t inputPool) : overruns(0), lostEvents(false)
 {
-	int port;
+	snd_seq_port_info_t *portInfo;
+	snd_seq_client_pool_t *poolInfo;
 
-	if (snd_seq_open(&(this->seq_handle), "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0) {
+	// the queue is started through an event, so the output direction is needed as well
+	if (snd_seq_open(&(this->seq_handle), "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0) {
 		throw MidiDeviceException();
     }
-	dprintf("Open sequential handler: correct");
+	LOG_VERBOSE("Open sequential handler: correct");
 
 
 	snd_seq_set_client_name(this->seq_handle, clientName);
 
-    if ((port = snd_seq_create_simple_port(seq_handle, portName,
-			SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE,
-			SND_SEQ_PORT_TYPE_APPLICATION | SND_SEQ_PORT_TYPE_MIDI_GENERIC)) < 0)  {
+	// events of any other type are discarded by the kernel, instead of being copied
+	// into the input pool just to be thrown away here
+	snd_seq_set_client_event_filter(this->seq_handle, SND_SEQ_EVENT_NOTEON);
+	snd_seq_set_client_event_filter(this->seq_handle, SND_SEQ_EVENT_NOTEOFF);
+
+	if (inputBuffer > 0 && snd_seq_set_input_buffer_size(this->seq_handle, inputBuffer) < 0)
+		LOG_WARNING("Unable to set the input buffer to %zu bytes", inputBuffer);
+	if (inputPool > 0 && snd_seq_set_client_pool_input(this->seq_handle, inputPool) < 0)
+		LOG_WARNING("Unable to set the input pool to %zu events", inputPool);
+
+	// the sizes are read back, as the sequencer may have refused or adjusted them
+	this->inputBuffer = snd_seq_get_input_buffer_size(this->seq_handle);
+	snd_seq_client_pool_alloca(&poolInfo);
+	this->inputPool = snd_seq_get_client_pool(this->seq_handle, poolInfo) < 0 ? 0 :
+			snd_seq_client_pool_get_input_pool(poolInfo);
+	if (this->inputBuffer < inputBuffer || this->inputPool < inputPool)
+		LOG_WARNING("Input buffer of %zu bytes and pool of %zu events, smaller than requested",
+				this->inputBuffer, this->inputPool);
+	LOG_INFO("Input buffer of %zu bytes, input pool of %zu events", this->inputBuffer, this->inputPool);
+
+	if ((this->queue = snd_seq_alloc_named_queue(this->seq_handle, clientName)) < 0) {
+		snd_seq_close(this->seq_handle);
 		throw MidiDeviceException();
-    }
-	dprintf("Create simple port: correct");
+	}
+
+	// the port number tells the stations apart, so it is chosen rather than assigned
+	snd_seq_port_info_alloca(&portInfo);
+	for (size_t i = 0; i < portNames.size(); i++) {
+		snd_seq_port_info_set_name(portInfo, portNames[i].c_str());
+		snd_seq_port_info_set_port(portInfo, i);
+		snd_seq_port_info_set_port_specified(portInfo, 1);
+		snd_seq_port_info_set_capability(portInfo, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE);
+		snd_seq_port_info_set_type(portInfo, SND_SEQ_PORT_TYPE_APPLICATION | SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+		snd_seq_port_info_set_timestamping(portInfo, 1);
+		snd_seq_port_info_set_timestamp_real(portInfo, 1);
+		snd_seq_port_info_set_timestamp_queue(portInfo, this->queue);
+
+		if (snd_seq_create_port(this->seq_handle, portInfo) < 0)  {
+			snd_seq_close(this->seq_handle);
+			throw MidiDeviceException();
+		}
+	}
+	LOG_VERBOSE("Create %zu timestamped ports: correct", portNames.size());
+
+	snd_seq_start_queue(this->seq_handle, this->queue, NULL);
+	snd_seq_drain_output(this->seq_handle);
+	this->queueStart = Clock::now();
+	LOG_VERBOSE("Start timestamping queue: correct");
 
-    if (snd_seq_connect_from(this->seq_handle, port, SND_SEQ_CLIENT_SYSTEM,
+    if (snd_seq_connect_from(this->seq_handle, 0, SND_SEQ_CLIENT_SYSTEM,
 				SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0) {
 		throw MidiDeviceException();
     }
-	dprintf("Subscribe to port events: correct");
+	LOG_VERBOSE("Subscribe to port events: correct");
 }
 
 /**
@@ -73,38 +136,67 @@ MidiClient::MidiClient(const char* clientName, const char* portName)
  */
 MidiClient::~MidiClient()
 {
-	dprintf("Closing sequencer");
+	LOG_VERBOSE("Closing sequencer");
+	snd_seq_free_queue(this->seq_handle, this->queue);
 	snd_seq_close(this->seq_handle);
 }
 
+/**
+ * Fill a MidiEvent from a sequencer event
+ * 
+ * @param	ev		sequencer event
+ * @param	event	event to fill
+ * 
+ * @return	true for a NOTE_ON or NOTE_OFF event, false for any other type
+ */
+bool MidiClient::decode(const snd_seq_event_t* ev, MidiEvent& event) const
+{
+	if((ev->type != SND_SEQ_EVENT_NOTEON) && (ev->type != SND_SEQ_EVENT_NOTEOFF)) {
+		event.type = MidiEvent::Type::UNKNOWN;
+		return false;
+	}
+
+	event.note = ev->data.note.note;
+	event.velocity = ev->data.note.velocity;
+	event.channel = ev->data.note.channel & 0x0F;
+	event.port = ev->dest.port;
+	event.track = MIDI_NO_TRACK;
+
+	if(ev->type == SND_SEQ_EVENT_NOTEOFF || ev->data.note.velocity == 0)
+		event.type = MidiEvent::Type::NOTE_OFF;
+	else
+		event.type = MidiEvent::Type::NOTE_ON;
+
+	event.hand = event.channel == 0 ? MidiEvent::Hand::RIGHT : MidiEvent::Hand::LEFT;
+
+	// real-time stamps are relative to the start of the queue
+	if((ev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL)
+		event.timestamp = this->queueStart + ev->time.time.tv_sec * NS_PER_SEC + ev->time.time.tv_nsec;
+	else
+		event.timestamp = Clock::now();
+
+	return true;
+}
+
 /**
  * Return a MidiEvent of type
  *  - NO_EVENT if no event is present (the semantics is non-blocking)
  *  - NOTE_ON if a key has been pressed
  *  - NOTE_OFF if a key has been released
  *  - UNKNOWN otherwise (all of them are meaningless for this applicaton)
- * When needed, note and hand are correctly set
+ * When needed, note, velocity, channel, hand and port are correctly set
  */
 MidiEvent MidiClient::getEvent()
 {
 	MidiEvent ret;
 	snd_seq_event_t *ev = NULL;
-	
-	if(snd_seq_event_input(this->seq_handle, &ev) != -EAGAIN) {
-		if((ev->type == SND_SEQ_EVENT_NOTEON) || (ev->type == SND_SEQ_EVENT_NOTEOFF)) {
-			
-			ret.note = ev->data.note.note;
+	int result = snd_seq_event_input(this->seq_handle, &ev);
 
-			if(ev->type == SND_SEQ_EVENT_NOTEOFF || (ev->type == SND_SEQ_EVENT_NOTEON && ev->data.note.velocity == 0))
-				ret.type = MidiEvent::Type::NOTE_OFF;
-			else
-				ret.type = MidiEvent::Type::NOTE_ON;
-
-
-			ret.hand = ev->data.control.channel == 0 ? MidiEvent::Hand::RIGHT : MidiEvent::Hand::LEFT;
-		} else {
-			ret.type = MidiEvent::Type::UNKNOWN;
-		}
+	if(result == -ENOSPC) {
+		recordOverrun();
+		ret.type = MidiEvent::Type::NO_EVENT;
+	} else if(result >= 0 && ev != NULL) {
+		decode(ev, ret);
 		snd_seq_free_event(ev);
 	} else {
 		ret.type = MidiEvent::Type::NO_EVENT;
@@ -114,6 +206,89 @@ MidiEvent MidiClient::getEvent()
 
 }
 
+/**
+ * Read the pending note events straight into a caller-owned array. It
+ * returns as soon as the input is empty, the array is full or an overrun
+ * is detected, so that the events read before the overrun can be applied
+ * before resynchronising
+ * 
+ * @param	events	array receiving the events
+ * @param	size	capacity of the array
+ * 
+ * @return	number of events read, 0 if none is pending
+ */
+unsigned int MidiClient::getEvents(MidiEvent* events, unsigned int size)
+{
+	unsigned int count = 0;
+	snd_seq_event_t *ev = NULL;
+
+	while(count < size) {
+		int result = snd_seq_event_input(this->seq_handle, &ev);
+		if(result == -ENOSPC) {
+			recordOverrun();
+			break;
+		}
+		if(result < 0 || ev == NULL)
+			break;
+
+		if(decode(ev, events[count]))
+			count++;
+		snd_seq_free_event(ev);
+	}
+
+	return count;
+}
+
+/**
+ * Return the number of events ready to be read with getEvent(). If the input
+ * buffer is empty, the sequencer is checked for new events as well
+ * 
+ * @return	number of pending events
+ */
+int MidiClient::getPendingEvents() {
+	int pending = snd_seq_event_input_pending(this->seq_handle, 1);
+	if(pending == -ENOSPC)
+		recordOverrun();
+	return pending > 0 ? pending : 0;
+}
+
+/**
+ * Account for an overrun of the kernel input pool: the events it held are
+ * gone, and the sequencer has already dropped the rest of the input
+ */
+void MidiClient::recordOverrun() {
+	overruns++;
+	lostEvents = true;
+	LOG_WARNING("MIDI input overrun, events lost");
+}
+
+/**
+ * Return true if the kernel input pool overflowed since the last call, so
+ * that some events (possibly note-offs) have been lost
+ */
+bool MidiClient::checkLostEvents() {
+	bool lost = lostEvents;
+	lostEvents = false;
+	return lost;
+}
+
+/**
+ * Return the poll descriptors of the sequencer, so that the caller can block
+ * (ex. with poll()) until new events are available, instead of busy-waiting
+ * on getEvent()
+ * 
+ * @return	vector containing the descriptors to be polled for input
+ */
+std::vector<pollfd> MidiClient::getPollDescriptors() {
+	int count = snd_seq_poll_descriptors_count(this->seq_handle, POLLIN);
+	std::vector<pollfd> fds(count > 0 ? count : 0);
+
+	if(count > 0)
+		snd_seq_poll_descriptors(this->seq_handle, fds.data(), count, POLLIN);
+
+	return fds;
+}
+
 /**
  * Return a string representing the provided midi note
  * 
@@ -122,57 +297,42 @@ MidiEvent MidiClient::getEvent()
  * @return	string encoding corresponding note
  */
 std::string MidiClient::midi2note(int midi) {
-    const char* notes[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
-    int note = midi % 12;
-    int octave = midi / 12 - 1;
-	std::string ret = notes[note];
-	return ret + std::to_string(octave);
+	return NoteName::toString(midi);
 }
 
+/**
+ * Check, at compile time, that every MIDI note is parsed back from its own name
+ */
+static constexpr bool parsesAllNoteNames() {
+	for(int midi = 0; midi < MIDI_NOTES; midi++)
+		if(NoteName::parse(NoteName::toString(midi)) != midi)
+			return false;
+	return true;
+}
+
+static_assert(parsesAllNoteNames(), "Note names of all the 128 MIDI notes must round-trip");
+static_assert(NoteName::parse("C-1") == 0, "Lowest MIDI note");
+static_assert(NoteName::parse("G9") == 127, "Highest MIDI note");
+static_assert(NoteName::parse("c4") == 60, "Letters are case insensitive");
+static_assert(NoteName::parse("Bb3") == 58, "Flats");
+static_assert(NoteName::parse("Db4") == NoteName::parse("C#4"), "Enharmonic notes");
+static_assert(NoteName::parse("Cb4") == 59 && NoteName::parse("E#4") == 65, "Accidentals crossing a letter");
+static_assert(NoteName::parse("G#9") == NoteName::OUT_OF_RANGE, "Notes above G9");
+static_assert(NoteName::parse("Cb-1") == NoteName::OUT_OF_RANGE, "Notes below C-1");
+static_assert(NoteName::parse("H3") == NoteName::INVALID_NAME, "Unknown letters");
+static_assert(NoteName::parse("C10") == NoteName::INVALID_NAME, "Octaves above 9");
+static_assert(NoteName::parse("C-2") == NoteName::INVALID_NAME, "Octaves below -1");
+static_assert(NoteName::parse("C##4") == NoteName::INVALID_NAME, "Double accidentals");
+static_assert(NoteName::parse("") == NoteName::INVALID_NAME, "Empty names");
+
 /**
  * Return the MIDI value representing the provided note
  * 
  * @param	note	string encoding a note
  * 
- * @return	integer representing corresponding MIDI value
+ * @return	integer representing corresponding MIDI value, negative if the
+ * 			note is not valid
  */
-int MidiClient::note2midi(std::string note) {
-	std::transform(note.begin(), note.end(), note.begin(), ::toupper);
-
-	int ret = -1;
-
-	std::regex expr("^([A-G]|[A|C|D|F|G][\\#])([0-9])$");
-	std::cmatch cm;
-	if(std::regex_match(note.c_str(), cm, expr)) {
-		if(cm[1] == "C")
-			ret = 0;
-		else if(cm[1] == "C#")
-			ret = 1;
-		else if(cm[1] == "D")
-			ret = 2;
-		else if(cm[1] == "D#")
-			ret = 3;
-		else if(cm[1] == "E")
-			ret = 4;
-		else if(cm[1] == "F")
-			ret = 5;
-		else if(cm[1] == "F#")
-			ret = 6;
-		else if(cm[1] == "G")
-			ret = 7;
-		else if(cm[1] == "G#")
-			ret = 8;
-		else if(cm[1] == "A")
-			ret = 9;
-		else if(cm[1] == "A#")
-			ret = 10;
-		else if(cm[1] == "B")
-			ret = 11;
-
-		ret += (std::stoi(cm[2]) + 1) * 12;
-
-	}
-
-	return ret;
-
-}
\ No newline at end of file
+int MidiClient::note2midi(const std::string& note) {
+	return NoteName::parse(note.c_str(), note.size());
+}
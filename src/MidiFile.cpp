@@ -0,0 +1,366 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Clock.h"
+#include "Config.h"
+#include "Logger.h"
+#include "MidiFile.h"
+
+#define DEFAULT_US_PER_QUARTER	500000	// 120 BPM
+
+#define META_END_OF_TRACK		0x2F
+#define META_TEMPO				0x51
+
+#define DECODE_END				-1
+#define DECODE_OTHER			0
+#define DECODE_NOTE				1
+#define DECODE_TEMPO			2
+
+/**
+ * Read a big-endian 16-bit value
+ */
+static inline uint32_t read16(const uint8_t* p) {
+	return (p[0] << 8) | p[1];
+}
+
+/**
+ * Read a big-endian 32-bit value
+ */
+static inline uint32_t read32(const uint8_t* p) {
+	return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * Open and map the file, locating the tracks and building the tempo map. In case
+ * of error an OpenFileException or a ParsingException is thrown
+ * 
+ * @param	filename	name of the MIDI file
+ */
+MidiFile::MidiFile(const std::string& filename) : data(nullptr), size(0), ticksPerSecond(0), tempoIndex(0) {
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		throw OpenFileException(filename);
+
+	struct stat info;
+	if(fstat(fd, &info) < 0 || info.st_size < 14) {
+		close(fd);
+		throw ParsingException();
+	}
+
+	size = info.st_size;
+	void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		throw OpenFileException(filename);
+	data = (const uint8_t*) map;
+
+	try {
+		if(std::string((const char*) data, 4) != "MThd" || read32(data + 4) < 6)
+			throw ParsingException();
+
+		format = read16(data + 8);
+		unsigned int count = read16(data + 10);
+		uint32_t timeDivision = read16(data + 12);
+
+		if(format > 1 || timeDivision == 0)
+			throw ParsingException();
+
+		if(timeDivision & 0x8000) {
+			// SMPTE: frames per second (negative) and ticks per frame
+			int fps = -(int8_t) (timeDivision >> 8);
+			ticksPerSecond = (uint64_t) fps * (timeDivision & 0xFF);
+			if(ticksPerSecond == 0)
+				throw ParsingException();
+			division = 1;
+		} else {
+			division = timeDivision;
+		}
+
+		// locate the tracks, skipping unknown chunks
+		const uint8_t* pos = data + 8 + read32(data + 4);
+		const uint8_t* end = data + size;
+		tracks.reserve(count);
+		while(pos + 8 <= end && tracks.size() < count) {
+			uint32_t length = read32(pos + 4);
+			const uint8_t* body = pos + 8;
+			if(length > (std::size_t) (end - body))
+				length = end - body;	// truncated file: keep what is there
+
+			if(std::string((const char*) pos, 4) == "MTrk") {
+				Track track = {body, body + length, 0, 0, (unsigned int) tracks.size()};
+				tracks.push_back(track);
+			}
+			pos = body + length;
+		}
+
+		if(tracks.empty())
+			throw ParsingException();
+
+		buildTempoMap();
+
+		heap.reserve(tracks.size());
+		for(Track& track : tracks)
+			if(advance(track))
+				heap.push_back(&track);
+		std::make_heap(heap.begin(), heap.end(), laterThan);
+
+	} catch(ParsingException& e) {
+		munmap((void*) data, size);
+		throw;
+	}
+
+	LOG_INFO("Opened %s: format %u, %zu tracks, division %u", filename.c_str(), format, tracks.size(), division);
+}
+
+/**
+ * Unmap the file
+ */
+MidiFile::~MidiFile() {
+	munmap((void*) data, size);
+}
+
+/**
+ * Heap ordering: the track with the earliest event (the lowest index on ties) on top
+ * 
+ * @param	a	first track
+ * @param	b	second track
+ * 
+ * @return	true if the next event of a comes after the one of b
+ */
+bool MidiFile::laterThan(const Track* a, const Track* b) {
+	return a->tick != b->tick ? a->tick > b->tick : a->index > b->index;
+}
+
+/**
+ * Decode a variable-length quantity, advancing the pointer
+ * 
+ * @param	pos		position of the quantity, moved past it
+ * @param	end		end of the track
+ * @param	value	decoded value
+ * 
+ * @return	false if the track is truncated
+ */
+bool MidiFile::readVarLen(const uint8_t*& pos, const uint8_t* end, uint32_t& value) {
+	value = 0;
+	for(int i = 0; i < 4; i++) {
+		if(pos >= end)
+			return false;
+		uint8_t byte = *pos++;
+		value = (value << 7) | (byte & 0x7F);
+		if(!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Read the delta time of the next event of a track
+ * 
+ * @param	track	track to advance
+ * 
+ * @return	false at the end of the track
+ */
+bool MidiFile::advance(Track& track) {
+	uint32_t delta;
+	if(!readVarLen(track.pos, track.end, delta) || track.pos >= track.end)
+		return false;
+	track.tick += delta;
+	return true;
+}
+
+/**
+ * Decode the next event of a track, advancing it to the following one
+ * 
+ * @param	track	track to decode
+ * @param	event	filled if the event is a note
+ * @param	tempo	filled with the new tempo if the event is a tempo change
+ * 
+ * @return	1 if the event is a note, 2 if it is a tempo change, 0 for any other
+ * 			event and -1 at the end of the track
+ */
+int MidiFile::decode(Track& track, MidiEvent& event, uint32_t& tempo) {
+	const uint8_t*& pos = track.pos;
+	uint8_t status = *pos;
+	uint32_t length;
+
+	if(status & 0x80) {
+		pos++;
+		// meta, sysex and system messages cancel the running status
+		if(status >= 0xF0)
+			track.runningStatus = 0;
+	} else {
+		// running status: the byte is already the first data byte
+		status = track.runningStatus;
+		if(!(status & 0x80))
+			return DECODE_END;
+	}
+
+	if(status == 0xFF) {
+		if(pos >= track.end)
+			return DECODE_END;
+		uint8_t type = *pos++;
+		if(!readVarLen(pos, track.end, length) || length > (std::size_t) (track.end - pos))
+			return DECODE_END;
+		const uint8_t* body = pos;
+		pos += length;
+
+		if(type == META_END_OF_TRACK)
+			return DECODE_END;
+		if(type == META_TEMPO && length == 3) {
+			tempo = (body[0] << 16) | (body[1] << 8) | body[2];
+			return DECODE_TEMPO;
+		}
+		return DECODE_OTHER;
+	}
+
+	if(status == 0xF0 || status == 0xF7) {
+		if(!readVarLen(pos, track.end, length) || length > (std::size_t) (track.end - pos))
+			return DECODE_END;
+		pos += length;
+		return DECODE_OTHER;
+	}
+
+	if(status >= 0xF0) {
+		// system common and real-time messages have no place in a file, but they are
+		// skipped if their length is known; the undefined ones end the track
+		std::size_t dataBytes = (status == 0xF2) ? 2 : (status == 0xF1 || status == 0xF3) ? 1 : 0;
+		if(status == 0xF4 || status == 0xF5 || dataBytes > (std::size_t) (track.end - pos))
+			return DECODE_END;
+		pos += dataBytes;
+		return DECODE_OTHER;
+	}
+
+	// channel messages: program change and channel pressure have a single data byte
+	track.runningStatus = status;
+	uint8_t kind = status & 0xF0;
+	std::size_t dataBytes = (kind == 0xC0 || kind == 0xD0) ? 1 : 2;
+	if(dataBytes > (std::size_t) (track.end - pos))
+		return DECODE_END;
+	const uint8_t* body = pos;
+	pos += dataBytes;
+
+	if(kind != 0x80 && kind != 0x90)
+		return DECODE_OTHER;
+
+	event.note = body[0] & 0x7F;
+	event.velocity = body[1] & 0x7F;
+	event.channel = status & 0x0F;
+	event.port = 0;
+	event.track = track.index < MIDI_NO_TRACK ? track.index : MIDI_NO_TRACK - 1;
+	event.type = (kind == 0x90 && body[1] != 0) ? MidiEvent::Type::NOTE_ON : MidiEvent::Type::NOTE_OFF;
+	event.hand = event.channel == 0 ? MidiEvent::Hand::RIGHT : MidiEvent::Hand::LEFT;
+	return DECODE_NOTE;
+}
+
+/**
+ * Scan the first track for tempo changes, building the tempo map
+ */
+void MidiFile::buildTempoMap() {
+	Tempo initial = {0, 0, DEFAULT_US_PER_QUARTER};
+	tempoMap.push_back(initial);
+
+	if(ticksPerSecond != 0)
+		return;
+
+	// the scan works on a copy of the cursor, leaving the track untouched
+	Track track = tracks[0];
+	MidiEvent event;
+	uint32_t usPerQuarter;
+	int result;
+
+	while(advance(track) && (result = decode(track, event, usPerQuarter)) != DECODE_END) {
+		if(result != DECODE_TEMPO)
+			continue;
+
+		Tempo& last = tempoMap.back();
+		uint64_t time = last.time + (track.tick - last.tick) * last.usPerQuarter * NS_PER_US / division;
+		if(track.tick == last.tick)
+			last.usPerQuarter = usPerQuarter;
+		else
+			tempoMap.push_back({track.tick, time, usPerQuarter});
+	}
+}
+
+/**
+ * Convert a tick into the time elapsed from the beginning of the file. Ticks
+ * must be provided in non-decreasing order
+ * 
+ * @param	tick	absolute tick
+ * 
+ * @return	time in ns
+ */
+uint64_t MidiFile::tickToTime(uint64_t tick) {
+	if(ticksPerSecond != 0)
+		return tick * NS_PER_SEC / ticksPerSecond;
+
+	while(tempoIndex + 1 < tempoMap.size() && tempoMap[tempoIndex + 1].tick <= tick)
+		tempoIndex++;
+
+	const Tempo& tempo = tempoMap[tempoIndex];
+	return tempo.time + (tick - tempo.tick) * tempo.usPerQuarter * NS_PER_US / division;
+}
+
+/**
+ * Return the next note of the file, merging all the tracks
+ * 
+ * @param	event	event to fill (NOTE_ON or NOTE_OFF)
+ * @param	time	time of the event from the beginning of the file, in ns
+ * 
+ * @return	false at the end of the file
+ */
+bool MidiFile::next(MidiEvent& event, uint64_t& time) {
+	uint32_t tempo;
+
+	while(!heap.empty()) {
+		std::pop_heap(heap.begin(), heap.end(), laterThan);
+		Track& track = *heap.back();
+		uint64_t tick = track.tick;
+
+		int result = decode(track, event, tempo);
+		if(result != DECODE_END && advance(track))
+			std::push_heap(heap.begin(), heap.end(), laterThan);
+		else
+			heap.pop_back();
+
+		if(result == DECODE_NOTE) {
+			time = tickToTime(tick);
+			return true;
+		}
+	}
+
+	return false;
+}
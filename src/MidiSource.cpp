@@ -0,0 +1,495 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Clock.h"
+#include "Config.h"
+#include "Logger.h"
+#include "MidiClient.h"
+#include "MidiFile.h"
+#include "MidiSource.h"
+#include "PianoTutorPlusConfig.h"
+
+#define REPLAY_DEFAULT_VELOCITY		64
+
+/**
+ * Parse a string, obtaining the corresponding source
+ * 
+ * @param	type	string representing the source
+ * 
+ * @return	corresponding Type value
+ */
+MidiSourceType::Type MidiSourceType::parse(std::string type) {
+	std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+	if(type == "alsa")
+		return ALSA;
+	else if(type == "replay")
+		return REPLAY;
+	else if(type == "synthetic")
+		return SYNTHETIC;
+	else if(type == "file")
+		return FILE;
+	else
+		throw MidiSourceNotFoundException();
+}
+
+/**
+ * Return the name of the provided source
+ * 
+ * @param	type	source
+ * 
+ * @return	name of the source
+ */
+const char* MidiSourceType::toString(MidiSourceType::Type type) {
+	switch(type) {
+		case ALSA:
+			return "ALSA";
+		case REPLAY:
+			return "REPLAY";
+		case SYNTHETIC:
+			return "SYNTHETIC";
+		case FILE:
+			return "FILE";
+		default:
+			return nullptr;
+	}
+}
+
+/**
+ * Return the list of all the available sources
+ * 
+ * @return	vector containing all the available sources
+ */
+const std::vector<MidiSourceType::Type>& MidiSourceType::getAllSourceTypes() {
+	static const std::vector<MidiSourceType::Type> types({ALSA, REPLAY, SYNTHETIC, FILE});
+	return types;
+}
+
+/**
+ * Build the source selected by the configuration. In case of error a
+ * MidiDeviceException (or the exception of the failing file operation) is thrown
+ * 
+ * @param	config		program configuration
+ * @param	clientName	name of the MIDI client, for the ALSA source
+ * @param	portName	name of the MIDI port, for the ALSA source
+ * 
+ * @return	the new source
+ */
+std::unique_ptr<MidiSource> MidiSource::create(const PianoTutorPlusConfig& config,
+		const char* clientName, const char* portName) {
+	switch(config.getMidiSource()) {
+		case MidiSourceType::ALSA:
+			return std::unique_ptr<MidiSource>(new MidiClient(clientName, std::vector<std::string>(1, portName),
+					config.getMidiInputBuffer(), config.getMidiInputPool()));
+		case MidiSourceType::REPLAY:
+			return std::unique_ptr<MidiSource>(new ReplaySource(config.getReplayFile(), config.getReplaySpeed(),
+					config.getPreviewTime() * NS_PER_MS));
+		case MidiSourceType::SYNTHETIC:
+			return std::unique_ptr<MidiSource>(new SyntheticSource(config.getKeyboardMinNote(),
+					config.getKeyboardMaxNote(), config.getSynthChordRate(), config.getSynthChordSize(),
+					config.getSynthBurstRate(), config.getSynthDuration()));
+		case MidiSourceType::FILE:
+			return std::unique_ptr<MidiSource>(new MidiFileSource(config.getMidiFile(), config.getReplaySpeed(),
+					config.getPreviewTime() * NS_PER_MS));
+		default:
+			throw MidiDeviceException();
+	}
+}
+
+/**
+ * Read the pending NOTE_ON, NOTE_OFF and PREVIEW events into a caller-owned
+ * array, skipping any other event. It returns as soon as no event is pending
+ * or the array is full
+ * 
+ * @param	events	array receiving the events
+ * @param	size	capacity of the array
+ * 
+ * @return	number of events read, 0 if none is pending
+ */
+unsigned int MidiSource::getEvents(MidiEvent* events, unsigned int size) {
+	unsigned int count = 0;
+
+	while(count < size && getPendingEvents() > 0) {
+		events[count] = getEvent();
+		if(events[count].type == MidiEvent::Type::NOTE_ON || events[count].type == MidiEvent::Type::NOTE_OFF ||
+				events[count].type == MidiEvent::Type::PREVIEW)
+			count++;
+	}
+
+	return count;
+}
+
+/**
+ * Build the source. In case of error a MidiDeviceException is thrown
+ * 
+ * @param	speed	playback speed (1 = real time, 2 = twice as fast, ...)
+ * @param	preview	preview window, in ns (0 = no preview)
+ */
+ScheduledSource::ScheduledSource(double speed, uint64_t preview)
+	: speed(speed > 0 ? speed : 1), preview(preview), started(false), finished(false), buffered(false),
+	start(0), nextTime(0), released(0), pendingHead(0), pendingCount(0) {
+
+	// the queue is never resized, so that releasing the events does not allocate
+	if(preview > 0)
+		pending.resize(PREVIEW_QUEUE_EVENTS);
+
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(timerFd < 0)
+		throw MidiDeviceException();
+}
+
+/**
+ * Release the timer
+ */
+ScheduledSource::~ScheduledSource() {
+	close(timerFd);
+}
+
+/**
+ * Start the stream and arm the timer for the first event
+ */
+void ScheduledSource::begin() {
+	started = true;
+	start = Clock::now();
+	fetch();
+	rearm();
+}
+
+/**
+ * Read the next event into the buffer, if it is empty. With a preview,
+ * the events that are not announced go straight to the queue, so that
+ * the buffer holds the next NOTE_ON
+ */
+void ScheduledSource::fetch() {
+	while(true) {
+		if(!buffered && !finished) {
+			if(read(next, nextTime)) {
+				nextTime = nextTime / speed + preview;
+				buffered = true;
+			} else {
+				finished = true;
+			}
+		}
+
+		if(!buffered || preview == 0 || next.type == MidiEvent::Type::NOTE_ON || pendingCount == pending.size())
+			return;
+
+		enqueue(nextTime, next);
+		buffered = false;
+	}
+}
+
+/**
+ * Append an announced event to the queue, which must not be full
+ * 
+ * @param	time	time of the event from the beginning, in ns
+ * @param	event	event
+ */
+void ScheduledSource::enqueue(uint64_t time, const MidiEvent& event) {
+	PendingEvent& entry = pending[(pendingHead + pendingCount) % pending.size()];
+	entry.time = time;
+	entry.event = event;
+	pendingCount++;
+}
+
+/**
+ * Return the time of the next event to release, either the head of the
+ * queue or the next event of the stream (its announcement, with a preview)
+ * 
+ * @return	time from the beginning, in ns, UINT64_MAX if nothing is left
+ */
+uint64_t ScheduledSource::getDueTime() const {
+	uint64_t due = UINT64_MAX;
+
+	// with a full queue, the announcement waits for the head to be released
+	if(buffered && (preview == 0 || pendingCount < pending.size()))
+		due = nextTime - preview;
+	if(pendingCount > 0 && pending[pendingHead].time < due)
+		due = pending[pendingHead].time;
+
+	return due;
+}
+
+/**
+ * Consume the expirations of the timer and arm it for the buffered event
+ */
+void ScheduledSource::rearm() {
+	uint64_t expirations;
+	itimerspec timer = {{0, 0}, {0, 0}};
+
+	if(::read(timerFd, &expirations, sizeof(expirations)) < 0)
+		LOG_TRACE("No timer expiration to consume");
+
+	uint64_t due = getDueTime();
+	if(due != UINT64_MAX)
+		timer.it_value = Clock::toTimespec(start + due);
+	timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, nullptr);
+}
+
+/**
+ * Return the next event if its time has come, NO_EVENT otherwise. On ties,
+ * the queued events go before the next announcement
+ */
+MidiEvent ScheduledSource::getEvent() {
+	MidiEvent ret;
+
+	if(getPendingEvents() == 0) {
+		ret.type = MidiEvent::Type::NO_EVENT;
+		return ret;
+	}
+
+	// the events are considered arrived when they were due
+	uint64_t due = getDueTime();
+	if(pendingCount > 0 && pending[pendingHead].time == due) {
+		ret = pending[pendingHead].event;
+		ret.timestamp = start + due;
+		released = due;
+		pendingHead = (pendingHead + 1) % pending.size();
+		pendingCount--;
+	} else if(preview > 0) {
+		// an announcement held back by a full queue comes after the event freeing it
+		ret = next;
+		ret.type = MidiEvent::Type::PREVIEW;
+		ret.timestamp = start + std::max(due, released);
+		enqueue(nextTime, next);
+		buffered = false;
+	} else {
+		ret = next;
+		ret.timestamp = start + nextTime;
+		buffered = false;
+	}
+
+	return ret;
+}
+
+/**
+ * Return 1 if the buffered event is due, 0 otherwise. In the latter case the
+ * timer is armed for the next event
+ * 
+ * @return	number of pending events
+ */
+int ScheduledSource::getPendingEvents() {
+	if(!started)
+		begin();
+
+	fetch();
+	uint64_t due = getDueTime();
+	if(due != UINT64_MAX && Clock::now() >= start + due)
+		return 1;
+
+	rearm();
+	return 0;
+}
+
+/**
+ * Return the timer descriptor, starting the stream if needed
+ * 
+ * @return	vector containing the timer descriptor
+ */
+std::vector<pollfd> ScheduledSource::getPollDescriptors() {
+	if(!started)
+		begin();
+	return std::vector<pollfd>({{timerFd, POLLIN, 0}});
+}
+
+/**
+ * Return true if all the events have been delivered
+ */
+bool ScheduledSource::isFinished() {
+	return finished && !buffered && pendingCount == 0;
+}
+
+/**
+ * Load the whole stream. In case of error an OpenFileException or a
+ * ParsingException is thrown
+ * 
+ * @param	filename	name of the recorded stream
+ * @param	speed		playback speed (1 = real time, 2 = twice as fast, ...)
+ * @param	preview		preview window, in ns (0 = no preview)
+ */
+ReplaySource::ReplaySource(const std::string& filename, double speed, uint64_t preview)
+	: ScheduledSource(speed, preview), position(0) {
+	std::ifstream file(filename);
+	if(!file.is_open())
+		throw OpenFileException(filename);
+
+	std::string line;
+	uint64_t previous = 0;
+
+	while(std::getline(file, line)) {
+		std::istringstream fields(line);
+		uint64_t time;
+		std::string type;
+		unsigned int note, channel, velocity = REPLAY_DEFAULT_VELOCITY;
+
+		if(!(fields >> time))
+			continue;	// empty line or comment
+		if(!(fields >> type >> note >> channel) || note >= MIDI_NOTES || channel > 15 || time < previous)
+			throw ParsingException();
+		// the velocity is optional, for recordings made before it was stored
+		if(!(fields >> velocity))
+			velocity = REPLAY_DEFAULT_VELOCITY;
+		else if(velocity > 127)
+			throw ParsingException();
+
+		TimedEvent timed;
+		timed.time = time * NS_PER_US;
+		timed.event.note = note;
+		timed.event.velocity = velocity;
+		timed.event.channel = channel;
+		timed.event.port = 0;
+		timed.event.track = MIDI_NO_TRACK;
+		timed.event.hand = channel == 0 ? MidiEvent::Hand::RIGHT : MidiEvent::Hand::LEFT;
+		if(type == "on")
+			timed.event.type = MidiEvent::Type::NOTE_ON;
+		else if(type == "off")
+			timed.event.type = MidiEvent::Type::NOTE_OFF;
+		else
+			throw ParsingException();
+
+		events.push_back(timed);
+		previous = time;
+	}
+
+	LOG_INFO("Loaded %zu events from %s", events.size(), filename.c_str());
+}
+
+/**
+ * Produce the next recorded event
+ * 
+ * @param	event	event to fill
+ * @param	time	time of the event from the beginning of the stream, in ns
+ * 
+ * @return	false if the stream is over
+ */
+bool ReplaySource::read(MidiEvent& event, uint64_t& time) {
+	if(position >= events.size())
+		return false;
+
+	event = events[position].event;
+	time = events[position].time;
+	position++;
+	return true;
+}
+
+/**
+ * Build the generator
+ * 
+ * @param	minNote		lowest note to play
+ * @param	maxNote		highest note to play
+ * @param	chordRate	chords per second
+ * @param	chordSize	notes per chord
+ * @param	burstRate	bursts per second, 0 to deliver each chord on time
+ * @param	duration	seconds of load, 0 to never stop
+ */
+SyntheticSource::SyntheticSource(unsigned char minNote, unsigned char maxNote, double chordRate,
+		unsigned int chordSize, double burstRate, double duration)
+	: ScheduledSource(1), minNote(minNote), maxNote(maxNote),
+	chordPeriod(chordRate > 0 ? NS_PER_SEC / chordRate : NS_PER_SEC),
+	burstPeriod(burstRate > 0 ? NS_PER_SEC / burstRate : 0),
+	duration(duration * NS_PER_SEC), chordSize(chordSize > 0 ? chordSize : 1), seed(0x9E3779B9u),
+	chord(0), step(0), ending(false) {
+	held.reserve(this->chordSize);
+	pressed.reserve(this->chordSize);
+}
+
+/**
+ * Return a pseudo-random number (xorshift)
+ */
+uint32_t SyntheticSource::random() {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+/**
+ * Produce the next event: for each chord, the notes of the previous one are
+ * released first, then the new notes are pressed
+ * 
+ * @param	event	event to fill
+ * @param	time	time of the event from the beginning of the stream, in ns
+ * 
+ * @return	false if the load is over
+ */
+bool SyntheticSource::read(MidiEvent& event, uint64_t& time) {
+	time = chord * chordPeriod;
+	if(burstPeriod > 0)
+		time = (time + burstPeriod - 1) / burstPeriod * burstPeriod;
+
+	if(step == 0) {
+		ending = duration > 0 && chord * chordPeriod >= duration;
+		pressed.clear();
+		if(!ending) {
+			for(unsigned int i = 0; i < chordSize; i++) {
+				MidiEvent note;
+				uint32_t r = random();
+				note.note = minNote + r % (maxNote - minNote + 1);
+				note.hand = (r >> 16) & 1 ? MidiEvent::Hand::LEFT : MidiEvent::Hand::RIGHT;
+				note.channel = note.hand == MidiEvent::Hand::LEFT ? 1 : 0;
+				note.velocity = 1 + (r >> 17) % 127;
+				note.port = 0;
+				note.track = MIDI_NO_TRACK;
+				note.type = MidiEvent::Type::NOTE_ON;
+				pressed.push_back(note);
+			}
+		}
+	}
+
+	if(step < held.size()) {
+		event = held[step];
+		event.type = MidiEvent::Type::NOTE_OFF;
+		step++;
+		return true;
+	}
+
+	if(step - held.size() < pressed.size()) {
+		event = pressed[step - held.size()];
+		step++;
+		return true;
+	}
+
+	if(ending)
+		return false;
+
+	// move on to the next chord
+	held.swap(pressed);
+	step = 0;
+	chord++;
+	return read(event, time);
+}
@@ -0,0 +1,187 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <algorithm>
+#include <string.h>
+
+#include "NoteMapper.h"
+
+static_assert(PALETTE_SIZE <= KEY_STATE_HOLDERS, "Every palette entry must be a key holder");
+
+/**
+ * Build the mapper with all the keys released
+ * 
+ * @param	config		configuration providing the LED spans and the colors
+ * @param	compositor	layers of the strip, the keys being drawn on the NOTES one
+ * @param	animator	envelopes of the keys, nullptr to switch them on and off at once
+ */
+NoteMapper::NoteMapper(const PianoTutorPlusConfig& config, Compositor& compositor, Animator* animator)
+	: compositor(compositor) {
+
+	memset(velocities, VELOCITIES - 1, sizeof(velocities));
+	configure(config, animator);
+}
+
+/**
+ * Take the LED spans and the colors from a new configuration, keeping the
+ * state of the keyboard: the keys being held are drawn again, while the
+ * hints are dropped
+ * 
+ * @param	config		configuration providing the LED spans and the colors
+ * @param	animator	envelopes of the keys, nullptr to switch them on and off at once
+ */
+void NoteMapper::configure(const PianoTutorPlusConfig& config, Animator* animator) {
+	this->config = &config;
+	this->animator = animator;
+
+	const ColorCorrection& correction = config.getColorCorrection();
+	for(unsigned int part = 0; part < PALETTE_SIZE; part++)
+		for(unsigned int v = 0; v < VELOCITIES; v++)
+			colors[part][v] = ColorCorrection::scale(config.getPaletteColor(part), correction.getLevel(v));
+
+	for(unsigned int track = 0; track <= PALETTE_TRACKS; track++)
+		for(unsigned int channel = 0; channel < PALETTE_CHANNELS; channel++)
+			parts[track][channel] = config.hasTrackColor(track) ? PALETTE_CHANNELS + track : channel;
+
+	// the spans may have moved, so the layers are drawn again from scratch
+	memset(hints, 0, sizeof(hints));
+	compositor.clearLayer(Compositor::HINTS);
+	compositor.clearLayer(Compositor::NOTES);
+	for(unsigned char note = 0; note < MIDI_NOTES; note++)
+		if(keys.getHolder(note) >= 0)
+			draw(note);
+}
+
+/**
+ * Apply a NOTE_ON or NOTE_OFF event to the layer of the keys, or a PREVIEW
+ * to the layer of the hints. Any other event is ignored
+ * 
+ * @param	event	MIDI event
+ * 
+ * @return	true if the LEDs of the key have been updated
+ */
+bool NoteMapper::apply(const MidiEvent& event) {
+	bool changed;
+	bool hinted = false;
+	unsigned char note = event.note & (MIDI_NOTES - 1);
+	unsigned int part = parts[std::min<unsigned int>(event.track, PALETTE_TRACKS)][event.channel & (PALETTE_CHANNELS - 1)];
+
+	// a key stays hinted until all the notes announced on it have been played
+	if(event.type == MidiEvent::Type::PREVIEW) {
+		if(hints[note] == UINT8_MAX || hints[note]++ > 0)
+			return false;
+		drawHint(note, colors[part][event.velocity & (VELOCITIES - 1)], config->getPreviewBrightness());
+		return true;
+	}
+
+	// the strip is touched only when the part shown on the key, or its velocity, changes
+	if(event.type == MidiEvent::Type::NOTE_ON) {
+		if(hints[note] > 0 && --hints[note] == 0) {
+			drawHint(note, 0, 0);
+			hinted = true;
+		}
+
+		changed = keys.press(note, part);
+		if(velocities[note][part] != (event.velocity & (VELOCITIES - 1))) {
+			velocities[note][part] = event.velocity & (VELOCITIES - 1);
+			changed |= keys.getHolder(note) == (int) part;
+		}
+	} else if(event.type == MidiEvent::Type::NOTE_OFF) {
+		changed = keys.release(note, part);
+	} else {
+		return false;
+	}
+
+	if(!changed)
+		return hinted;
+
+	draw(note);
+	return true;
+}
+
+/**
+ * Draw a key on the layer of the keys, or hand it to the animator, with
+ * the color of the part holding it
+ * 
+ * @param	note	MIDI note of the key
+ */
+void NoteMapper::draw(unsigned char note) {
+	int holder = keys.getHolder(note);
+
+	if(animator) {
+		if(holder >= 0)
+			animator->press(note, colors[holder][velocities[note][holder]]);
+		else
+			animator->release(note);
+		return;
+	}
+
+	const LedSpan& span = config->getLedSpan(note);
+	unsigned short end = span.first + span.length;
+
+	if(holder >= 0) {
+		ws2811_led_t color = colors[holder][velocities[note][holder]];
+		for(unsigned short pos = span.first; pos < end; pos++)
+			compositor.setColor(Compositor::NOTES, pos, color);
+	} else {
+		for(unsigned short pos = span.first; pos < end; pos++)
+			compositor.clear(Compositor::NOTES, pos);
+	}
+}
+
+/**
+ * Release all the keys and drop the hints, switching off their LEDs
+ */
+void NoteMapper::clear() {
+	keys.clear();
+	if(animator)
+		animator->clear();
+	compositor.clearLayer(Compositor::NOTES);
+
+	memset(hints, 0, sizeof(hints));
+	compositor.clearLayer(Compositor::HINTS);
+}
+
+/**
+ * Draw the hint of a key on the layer of the hints
+ * 
+ * @param	note	MIDI note of the key
+ * @param	color	color of the hint
+ * @param	alpha	opacity of the hint, 0 to remove it
+ */
+void NoteMapper::drawHint(unsigned char note, ws2811_led_t color, uint8_t alpha) {
+	const LedSpan& span = config->getLedSpan(note);
+	unsigned short end = span.first + span.length;
+	for(unsigned short pos = span.first; pos < end; pos++) {
+		if(alpha)
+			compositor.setColor(Compositor::HINTS, pos, color, alpha);
+		else
+			compositor.clear(Compositor::HINTS, pos);
+	}
+}
@@ -26,8 +26,12 @@
  */
 
 
+#include <algorithm>
 #include <exception>
 #include <iostream>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string>
 #include <vector>
 
@@ -53,7 +57,7 @@ void PianoTutorPlusConfig::throwParsingError(const std::string& msg) {
  * 
  * @param	filename	name of the configuration file
  */
-PianoTutorPlusConfig::PianoTutorPlusConfig(const std::string &filename) {
+PianoTutorPlusConfig::PianoTutorPlusConfig(const std::string &filename) : filename(filename) {
 	
     Config conf = Config::parse(filename);
 
@@ -71,49 +75,368 @@ PianoTutorPlusConfig::PianoTutorPlusConfig(const std::string &filename) {
 		if (this->dmaChannel <= 0)
 			this->throwParsingError("The DMA channel must be a non-null positive integer");
 
-        this->ledCount = (unsigned short) Config::parseInt(conf[KEY_LED_COUNT]);
-		if (this->ledCount <= 0)
-			this->throwParsingError("The LED count must be a non-null positive integer");
+        int ledCount = Config::parseInt(conf[KEY_LED_COUNT]);
+		if (ledCount <= 0 || ledCount > 65535)
+			this->throwParsingError("The LED count must be between 1 and 65535");
+		this->ledCount = (unsigned short) ledCount;
 
 		this->ledPerKey = Config::parseFloat(conf[KEY_LED_PER_KEY]);
 		if(this->ledPerKey <= 0)
 			this->throwParsingError("The number of LED(s) per key must be a non-negative real number");
 
-		this->keyboardMinNote = (unsigned char) MidiClient::note2midi(conf[KEY_KEYBOARD_MIN_NOTE]);
-		if(this->keyboardMinNote <= 0)
+		int minNote = MidiClient::note2midi(conf[KEY_KEYBOARD_MIN_NOTE]);
+		if(minNote < 0)
 			this->throwParsingError("The min keyboard note has to be a proper note, such as C2");
-		
-		this->keyboardMaxNote = (unsigned char) MidiClient::note2midi(conf[KEY_KEYBOARD_MAX_NOTE]);
-		if(this->keyboardMaxNote <= 0)
+		this->keyboardMinNote = (unsigned char) minNote;
+
+		int maxNote = MidiClient::note2midi(conf[KEY_KEYBOARD_MAX_NOTE]);
+		if(maxNote < 0)
 			this->throwParsingError("The max keyboard note has to be a proper note, such as C7");
+		this->keyboardMaxNote = (unsigned char) maxNote;
+
+		if(this->keyboardMaxNote < this->keyboardMinNote)
+			this->throwParsingError("The max keyboard note cannot be lower than the min one");
 
 		try {
 			this->ledOrder = LedOrder::parse(conf[KEY_LED_ORDER]);
 			this->stripType = StripType::parse(conf[KEY_LED_TYPE]);
-			this->colorRightHand = LedColor::parse(conf[KEY_COLOR_RIGHT]);
-			this->colorLeftHand = LedColor::parse(conf[KEY_COLOR_LEFT]);
+			this->ledChannels[1].stripType = StripType::parse(conf.get(KEY_CHANNEL1_LED_TYPE, conf[KEY_LED_TYPE]));
+			this->parsePalette(conf);
+			this->ledBackend = LedBackendType::parse(conf.get(KEY_LED_BACKEND,
+					LedBackendType::toString(LedBackendType::getAllBackendTypes().front())));
+			this->midiSource = MidiSourceType::parse(conf.get(KEY_MIDI_SOURCE, "alsa"));
+			this->rtPolicy = SchedPolicy::parse(conf.get(KEY_RT_POLICY, "other"));
+			this->logLevel = LogLevel::parse(conf.get(KEY_LOG_LEVEL, LogLevel::toString(LOG_DEFAULT_LEVEL)));
 		}catch(LedColor::ColorNotFoundException& e) {
-			std::vector<LedColor::Color> colors = LedColor::getAllColors();
+			const std::vector<LedColor::Color>& colors = LedColor::getAllColors();
 			std::string s = "";
 			for(auto c : colors)
 				s += std::string(LedColor::toString(c)) + " ";
-			this->throwParsingError("Available colors: " + s);
+			this->throwParsingError("Available colors: " + s + "or 0xRRGGBB, rgb(R, G, B)");
 		}catch(StripType::StripTypeNotFoundException& e) {
-			std::vector<StripType::Type> types = StripType::getAllStripTypes();
+			const std::vector<StripType::Type>& types = StripType::getAllStripTypes();
 			std::string s = "";
 			for(auto t : types)
 				s += std::string(StripType::toString(t)) + " ";
 			this->throwParsingError("Available types: " + s);
 		}catch(LedOrder::LedOrderNotFoundException& e) {
-			std::vector<LedOrder::Order> orders = LedOrder::getAllLedOrders();
+			const std::vector<LedOrder::Order>& orders = LedOrder::getAllLedOrders();
 			std::string s = "";
 			for(auto o : orders)
 				s += std::string(LedOrder::toString(o)) + " ";
 			this->throwParsingError("Available orders: " + s);
+		}catch(LedBackendType::LedBackendNotFoundException& e) {
+			const std::vector<LedBackendType::Type>& backends = LedBackendType::getAllBackendTypes();
+			std::string s = "";
+			for(auto b : backends)
+				s += std::string(LedBackendType::toString(b)) + " ";
+			this->throwParsingError("Available backends: " + s);
+		}catch(MidiSourceType::MidiSourceNotFoundException& e) {
+			const std::vector<MidiSourceType::Type>& sources = MidiSourceType::getAllSourceTypes();
+			std::string s = "";
+			for(auto t : sources)
+				s += std::string(MidiSourceType::toString(t)) + " ";
+			this->throwParsingError("Available MIDI sources: " + s);
+		}catch(SchedPolicy::SchedPolicyNotFoundException& e) {
+			const std::vector<SchedPolicy::Policy>& policies = SchedPolicy::getAllPolicies();
+			std::string s = "";
+			for(auto p : policies)
+				s += std::string(SchedPolicy::toString(p)) + " ";
+			this->throwParsingError("Available scheduling policies: " + s);
+		}catch(LogLevel::LogLevelNotFoundException& e) {
+			const std::vector<LogLevel::Level>& levels = LogLevel::getAllLevels();
+			std::string s = "";
+			for(auto l : levels)
+				s += std::string(LogLevel::toString(l)) + " ";
+			this->throwParsingError("Available log levels: " + s);
+		}
+
+		this->ledBackendFile = conf.get(KEY_LED_BACKEND_FILE, "");
+		if(this->ledBackend == LedBackendType::FILE && this->ledBackendFile.empty())
+			this->throwParsingError("The file backend requires " KEY_LED_BACKEND_FILE " to be set");
+
+		this->simulateDma = Config::parseBoolean(conf.get(KEY_SIMULATE_DMA, "false"));
+
+		this->replayFile = conf.get(KEY_REPLAY_FILE, "");
+		if(this->midiSource == MidiSourceType::REPLAY && this->replayFile.empty())
+			this->throwParsingError("The replay source requires " KEY_REPLAY_FILE " to be set");
+
+		this->midiFile = conf.get(KEY_MIDI_FILE, "");
+		if(this->midiFile.empty() && this->midiSource == MidiSourceType::FILE)
+			this->throwParsingError("The file source requires " KEY_MIDI_FILE " to be set");
+
+		int inputBuffer = Config::parseInt(conf.get(KEY_MIDI_INPUT_BUFFER, "0"));
+		int inputPool = Config::parseInt(conf.get(KEY_MIDI_INPUT_POOL, "0"));
+		if(inputBuffer < 0 || inputPool < 0)
+			this->throwParsingError("The MIDI input buffer and pool sizes must be non-negative integers (0 = default)");
+		this->midiInputBuffer = inputBuffer;
+		this->midiInputPool = inputPool;
+
+		this->replaySpeed = Config::parseDouble(conf.get(KEY_REPLAY_SPEED, "1"));
+		if(this->replaySpeed <= 0)
+			this->throwParsingError("The replay speed must be a positive real number");
+
+		this->synthChordRate = Config::parseDouble(conf.get(KEY_SYNTH_CHORD_RATE, "10"));
+		if(this->synthChordRate <= 0)
+			this->throwParsingError("The synthetic chord rate must be a positive real number");
+
+		int chordSize = Config::parseInt(conf.get(KEY_SYNTH_CHORD_SIZE, "3"));
+		if(chordSize <= 0 || chordSize > MIDI_NOTES)
+			this->throwParsingError("The synthetic chord size must be between 1 and 128");
+		this->synthChordSize = chordSize;
+
+		this->synthBurstRate = Config::parseDouble(conf.get(KEY_SYNTH_BURST_RATE, "0"));
+		if(this->synthBurstRate < 0)
+			this->throwParsingError("The synthetic burst rate must be a non-negative real number");
+
+		this->synthDuration = Config::parseDouble(conf.get(KEY_SYNTH_DURATION, "0"));
+		if(this->synthDuration < 0)
+			this->throwParsingError("The synthetic load duration must be a non-negative real number");
+
+		this->rtPriority = Config::parseInt(conf.get(KEY_RT_PRIORITY, "50"));
+		if(this->rtPriority < 1 || this->rtPriority > 99)
+			this->throwParsingError("The real-time priority must be between 1 and 99");
+
+		this->midiThreadCpu = Config::parseInt(conf.get(KEY_MIDI_THREAD_CPU, "-1"));
+		this->renderThreadCpu = Config::parseInt(conf.get(KEY_RENDER_THREAD_CPU, "-1"));
+		if(this->midiThreadCpu < -1 || this->renderThreadCpu < -1)
+			this->throwParsingError("The thread CPUs must be non-negative integers, or -1 to disable pinning");
+
+		this->lockMemory = Config::parseBoolean(conf.get(KEY_LOCK_MEMORY, "false"));
+
+		this->logFile = conf.get(KEY_LOG_FILE, "");
+		this->stationName = conf.get(KEY_STATION_NAME, "");
+
+		int brightness0 = Config::parseInt(conf.get(KEY_LED_BRIGHTNESS, "255"));
+		int brightness1 = Config::parseInt(conf.get(KEY_CHANNEL1_BRIGHTNESS, "255"));
+		if(brightness0 < 0 || brightness0 > 255 || brightness1 < 0 || brightness1 > 255)
+			this->throwParsingError("The channel brightness must be between 0 and 255");
+
+		int channel1Pin = Config::parseInt(conf.get(KEY_CHANNEL1_GPIO_PIN, "0"));
+		if(channel1Pin < 0)
+			this->throwParsingError("The GPIO pin of channel 1 must be a positive integer, or 0 to disable it");
+
+		this->ledChannels[0].gpioPin = this->gpioPin;
+		this->ledChannels[0].stripType = this->stripType;
+		this->ledChannels[0].brightness = brightness0;
+		this->ledChannels[1].gpioPin = channel1Pin;
+		this->ledChannels[1].brightness = brightness1;
+
+		double gamma = Config::parseDouble(conf.get(KEY_GAMMA, "1"));
+		if(gamma <= 0)
+			this->throwParsingError("The gamma must be a positive real number");
+
+		int red, green, blue;
+		char tail;
+		std::string balance = conf.get(KEY_WHITE_BALANCE, "255, 255, 255");
+		if(sscanf(balance.c_str(), " %d , %d , %d %c", &red, &green, &blue, &tail) != 3 ||
+				red < 0 || red > 255 || green < 0 || green > 255 || blue < 0 || blue > 255)
+			this->throwParsingError("The white balance must be written as red, green, blue, each from 0 to 255");
+		const uint8_t whiteBalance[3] = {(uint8_t) red, (uint8_t) green, (uint8_t) blue};
+
+		double velocityGamma = 0;
+		if(Config::parseBoolean(conf.get(KEY_VELOCITY_BRIGHTNESS, "false"))) {
+			velocityGamma = Config::parseDouble(conf.get(KEY_VELOCITY_GAMMA, "2"));
+			if(velocityGamma <= 0)
+				this->throwParsingError("The velocity gamma must be a positive real number");
 		}
+		int minLevel = Config::parseInt(conf.get(KEY_VELOCITY_MIN_BRIGHTNESS, "32"));
+		if(minLevel < 0 || minLevel > 255)
+			this->throwParsingError("The brightness of the softest note must be between 0 and 255");
+
+		this->colorCorrection = ColorCorrection(gamma, whiteBalance, velocityGamma, minLevel);
+
+		int attackTime = Config::parseInt(conf.get(KEY_ATTACK_TIME, "0"));
+		int decayTime = Config::parseInt(conf.get(KEY_DECAY_TIME, "0"));
+		if(attackTime < 0 || decayTime < 0)
+			this->throwParsingError("The attack and decay times must be non-negative integers, in ms (0 = off)");
+		this->attackTime = attackTime;
+		this->decayTime = decayTime;
+
+		int animationFps = Config::parseInt(conf.get(KEY_ANIMATION_FPS, "100"));
+		if(animationFps < 1 || animationFps > 1000)
+			this->throwParsingError("The animation frame rate must be between 1 and 1000");
+		this->animationFps = animationFps;
+
+		int previewTime = Config::parseInt(conf.get(KEY_PREVIEW_TIME, "0"));
+		if(previewTime < 0)
+			this->throwParsingError("The preview time must be a non-negative integer, in ms (0 = off)");
+		this->previewTime = previewTime;
+
+		int previewBrightness = Config::parseInt(conf.get(KEY_PREVIEW_BRIGHTNESS, "48"));
+		if(previewBrightness < 0 || previewBrightness > 255)
+			this->throwParsingError("The preview brightness must be between 0 and 255");
+		this->previewBrightness = previewBrightness;
+
+		this->parseLedSegments(conf.get(KEY_LED_SEGMENTS, "0-" + std::to_string(this->ledCount - 1) + ":0"));
+
+		this->buildLedSpans();
 
 	} catch (std::exception& e) {
 		throw ParsingException();
 	}
 
 }
+
+/**
+ * Tell whether another configuration drives the strip with the same
+ * settings (backend, GPIO pins, DMA channel, frequency, LED count, types
+ * and LEDs per channel), so that the strip can be kept when switching to
+ * it. The brightness of the channels and the segments can be changed on
+ * the strip in use
+ * 
+ * @param	other	configuration to compare
+ * 
+ * @return	true if the strip does not need to be initialized again
+ */
+bool PianoTutorPlusConfig::hasSameStrip(const PianoTutorPlusConfig& other) const {
+	if(this->ledBackend != other.ledBackend || this->ledBackendFile != other.ledBackendFile ||
+			this->simulateDma != other.simulateDma || this->freq != other.freq ||
+			this->dmaChannel != other.dmaChannel || this->ledCount != other.ledCount)
+		return false;
+
+	for(int i = 0; i < LED_CHANNELS; i++) {
+		const LedChannel& a = this->ledChannels[i];
+		const LedChannel& b = other.ledChannels[i];
+		if(a.gpioPin != b.gpioPin || a.stripType != b.stripType || a.count != b.count)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Tell whether another configuration maps the strip on the channels with
+ * the same segments
+ * 
+ * @param	other	configuration to compare
+ * 
+ * @return	true if the segments are the same
+ */
+bool PianoTutorPlusConfig::hasSameSegments(const PianoTutorPlusConfig& other) const {
+	if(this->ledSegments.size() != other.ledSegments.size())
+		return false;
+	for(size_t i = 0; i < this->ledSegments.size(); i++) {
+		const LedSegment& a = this->ledSegments[i];
+		const LedSegment& b = other.ledSegments[i];
+		if(a.first != b.first || a.count != b.count || a.channel != b.channel ||
+				a.offset != b.offset || a.reversed != b.reversed)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Fill the palette: the channels take the color of the hand playing them
+ * (channel 1 the right one, any other the left one) unless they have a color
+ * of their own, while tracks have an entry only when a color is set for them
+ * 
+ * @param	conf	parsed configuration file
+ */
+void PianoTutorPlusConfig::parsePalette(Config& conf) {
+	ws2811_led_t right = LedColor::parseRgb(conf[KEY_COLOR_RIGHT]);
+	ws2811_led_t left = LedColor::parseRgb(conf[KEY_COLOR_LEFT]);
+
+	for(unsigned int channel = 0; channel < PALETTE_CHANNELS; channel++) {
+		std::string key = KEY_COLOR_CHANNEL + std::to_string(channel + 1);
+		std::string color = conf.get(key, "");
+		this->palette[channel] = color.empty() ? (channel == 0 ? right : left) : LedColor::parseRgb(color);
+	}
+
+	for(unsigned int track = 0; track < PALETTE_TRACKS; track++) {
+		std::string key = KEY_COLOR_TRACK + std::to_string(track + 1);
+		std::string color = conf.get(key, "");
+		this->trackColors[track] = !color.empty();
+		this->palette[PALETTE_CHANNELS + track] = color.empty() ? 0 : LedColor::parseRgb(color);
+	}
+}
+
+/**
+ * Parse the list of segments splitting the strip among the channels, and
+ * compute the number of LEDs driven by each channel. Segments cannot
+ * overlap, each LED of the strip is driven by at most one channel
+ * 
+ * @param	str		comma-separated list of first-last:channel segments
+ */
+void PianoTutorPlusConfig::parseLedSegments(const std::string& str) {
+	this->ledSegments.clear();
+	for(LedChannel& channel : this->ledChannels)
+		channel.count = 0;
+
+	// LEDs of the strip already covered by a segment
+	std::vector<bool> covered(this->ledCount, false);
+
+	size_t start = 0;
+	while(start < str.size()) {
+		size_t end = str.find(',', start);
+		if(end == std::string::npos)
+			end = str.size();
+		std::string item = str.substr(start, end - start);
+		start = end + 1;
+
+		int first, last, channel;
+		char tail;
+		if(sscanf(item.c_str(), " %d - %d : %d %c", &first, &last, &channel, &tail) != 3)
+			this->throwParsingError("Segments must be written as first-last:channel, e.g. 0-143:0, 144-287:1");
+		if(first < 0 || last < 0 || first >= this->ledCount || last >= this->ledCount)
+			this->throwParsingError("Segment " + item + " goes past the end of the strip");
+		if(channel < 0 || channel >= LED_CHANNELS)
+			this->throwParsingError("Segment " + item + " refers to a missing channel");
+		if(this->ledChannels[channel].gpioPin == 0)
+			this->throwParsingError("Segment " + item + " uses channel 1, but " KEY_CHANNEL1_GPIO_PIN " is not set");
+
+		// a segment written backwards is sent in reverse order
+		LedSegment segment;
+		segment.reversed = first > last;
+		segment.first = std::min(first, last);
+		segment.count = std::abs(last - first) + 1;
+		segment.channel = channel;
+		segment.offset = this->ledChannels[channel].count;
+		if(segment.offset + segment.count > 65535)
+			this->throwParsingError("A channel cannot drive more than 65535 LEDs");
+
+		for(int led = segment.first; led < segment.first + segment.count; led++) {
+			if(covered[led])
+				this->throwParsingError("Segment " + item + " overlaps another segment at LED " + std::to_string(led));
+			covered[led] = true;
+		}
+
+		this->ledChannels[channel].count += segment.count;
+		this->ledSegments.push_back(segment);
+	}
+
+	if(this->ledSegments.empty())
+		this->throwParsingError("At least one segment is required");
+}
+
+/**
+ * Fill the note-to-LED table, starting from the keyboard range, the number
+ * of LEDs per key and the LED order
+ */
+void PianoTutorPlusConfig::buildLedSpans() {
+	for(int note = 0; note < MIDI_NOTES; note++) {
+		LedSpan& span = this->ledSpans[note];
+		span.first = 0;
+		span.length = 0;
+
+		if(note < this->keyboardMinNote || note > this->keyboardMaxNote)
+			continue;
+
+		int key = (this->ledOrder == LedOrder::Order::DIR) ?
+				note - this->keyboardMinNote : this->keyboardMaxNote - note;
+		int first = round(key * this->ledPerKey);
+		int last = round((key + 1) * this->ledPerKey);
+
+		// every key lights at least one LED, and no key goes past the strip
+		if(last <= first)
+			last = first + 1;
+		if(last > this->ledCount)
+			last = this->ledCount;
+		if(first >= last)
+			continue;
+
+		span.first = first;
+		span.length = last - first;
+	}
+}
@@ -0,0 +1,210 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <algorithm>
+#include <alloca.h>
+#include <errno.h>
+#include <iostream>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Logger.h"
+#include "RealTime.h"
+
+/**
+ * Parse a string, obtaining the corresponding policy
+ * 
+ * @param	policy	string representing the policy
+ * 
+ * @return	corresponding Policy value
+ */
+SchedPolicy::Policy SchedPolicy::parse(std::string policy) {
+	std::transform(policy.begin(), policy.end(), policy.begin(), ::tolower);
+
+	if(policy == "other")
+		return OTHER;
+	else if(policy == "fifo")
+		return FIFO;
+	else if(policy == "rr")
+		return RR;
+	else
+		throw SchedPolicyNotFoundException();
+}
+
+/**
+ * Return the name of the provided policy
+ * 
+ * @param	policy	scheduling policy
+ * 
+ * @return	name of the policy
+ */
+const char* SchedPolicy::toString(SchedPolicy::Policy policy) {
+	switch(policy) {
+		case OTHER:
+			return "OTHER";
+		case FIFO:
+			return "FIFO";
+		case RR:
+			return "RR";
+		default:
+			return nullptr;
+	}
+}
+
+/**
+ * Return the list of all the available policies
+ * 
+ * @return	vector containing all the available policies
+ */
+const std::vector<SchedPolicy::Policy>& SchedPolicy::getAllPolicies() {
+	static const std::vector<SchedPolicy::Policy> policies({OTHER, FIFO, RR});
+	return policies;
+}
+
+/**
+ * Set the scheduling policy and priority of a thread
+ * 
+ * @param	thread		thread to configure
+ * @param	name		name of the thread, for the warnings
+ * @param	policy		scheduling policy
+ * @param	priority	real-time priority (ignored by the OTHER policy)
+ * 
+ * @return	true if the setting has been applied
+ */
+bool RealTime::setScheduling(pthread_t thread, const char* name, SchedPolicy::Policy policy, int priority) {
+	sched_param param;
+	int native;
+
+	switch(policy) {
+		case SchedPolicy::FIFO:
+			native = SCHED_FIFO;
+			break;
+		case SchedPolicy::RR:
+			native = SCHED_RR;
+			break;
+		default:
+			native = SCHED_OTHER;
+			priority = 0;
+	}
+
+	param.sched_priority = priority;
+	int err = pthread_setschedparam(thread, native, &param);
+	if(err != 0) {
+		std::cerr << "Warning: unable to set the " << SchedPolicy::toString(policy) << " policy with priority "
+				<< priority << " on the " << name << " thread (" << strerror(err)
+				<< "), keeping the default scheduler" << std::endl;
+		return false;
+	}
+
+	LOG_INFO("Scheduling of the %s thread: %s, priority %d", name, SchedPolicy::toString(policy), priority);
+	return true;
+}
+
+/**
+ * Pin a thread to a single CPU
+ * 
+ * @param	thread		thread to configure
+ * @param	name		name of the thread, for the warnings
+ * @param	cpu			index of the CPU
+ * 
+ * @return	true if the setting has been applied
+ */
+bool RealTime::setAffinity(pthread_t thread, const char* name, int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	int err = EINVAL;
+	if(cpu >= 0 && cpu < CPU_SETSIZE) {
+		CPU_SET(cpu, &set);
+		err = pthread_setaffinity_np(thread, sizeof(set), &set);
+	}
+
+	if(err != 0) {
+		std::cerr << "Warning: unable to pin the " << name << " thread to CPU " << cpu
+				<< " (" << strerror(err) << "), leaving it free to migrate" << std::endl;
+		return false;
+	}
+
+	LOG_INFO("Affinity of the %s thread: CPU %d", name, cpu);
+	return true;
+}
+
+/**
+ * Touch the provided amount of stack, so that its pages are mapped
+ * 
+ * @param	size	bytes of stack to touch
+ */
+static void __attribute__((noinline)) prefaultStack(std::size_t size) {
+	volatile unsigned char* stack = (volatile unsigned char*) alloca(size);
+	long page = sysconf(_SC_PAGESIZE);
+
+	for(std::size_t offset = 0; offset < size; offset += page)
+		stack[offset] = 0;
+}
+
+/**
+ * Lock the current and future memory of the process in RAM, then prefault
+ * RT_PREFAULT_STACK bytes of the calling thread's stack and RT_PREFAULT_HEAP bytes
+ * of heap, which is never given back to the system. Threads started later get
+ * their whole stack locked on creation
+ * 
+ * @return	true if the memory has been locked
+ */
+bool RealTime::lockMemory() {
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		std::cerr << "Warning: unable to lock the memory (" << strerror(errno)
+				<< "), pages may be faulted in while running" << std::endl;
+		return false;
+	}
+
+	// freed memory must stay in the heap, and large blocks must come from it
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	prefaultStack(RT_PREFAULT_STACK);
+
+	volatile unsigned char* heap = (volatile unsigned char*) malloc(RT_PREFAULT_HEAP);
+	if(heap) {
+		long page = sysconf(_SC_PAGESIZE);
+		for(std::size_t offset = 0; offset < RT_PREFAULT_HEAP; offset += page)
+			heap[offset] = 0;
+		free((void*) heap);
+	}
+
+	LOG_INFO("Memory locked, %d KiB of stack and %d KiB of heap prefaulted",
+			RT_PREFAULT_STACK / 1024, RT_PREFAULT_HEAP / 1024);
+	return true;
+}
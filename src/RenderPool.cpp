@@ -0,0 +1,189 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <algorithm>
+#include <condition_variable>
+#include <errno.h>
+#include <mutex>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "LedStrip.h"
+#include "Logger.h"
+#include "RenderPool.h"
+
+/**
+ * Start the workers. In case of error a LedStripException is thrown
+ * 
+ * @param	strips		maximum number of strips sharing the pool
+ * @param	threads		number of workers, 0 to use one per CPU (at most one per strip)
+ */
+RenderPool::RenderPool(unsigned int strips, unsigned int threads)
+	: queue(std::max(strips, 1u), nullptr), head(0), queued(0), stopping(false) {
+
+	if(threads == 0)
+		threads = std::max(1u, std::min(std::thread::hardware_concurrency(), strips));
+
+	wakeFd = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
+	if(wakeFd < 0)
+		throw LedStripException();
+
+	serving.assign(threads, nullptr);
+
+	LOG_VERBOSE("Starting %u render workers for %u strips", threads, strips);
+	for(unsigned int i = 0; i < threads; i++)
+		workers.emplace_back(&RenderPool::workerLoop, this, i);
+}
+
+/**
+ * Stop the workers, if still running, and release the resources
+ */
+RenderPool::~RenderPool() {
+	stop();
+	close(wakeFd);
+}
+
+/**
+ * Body of the workers: wait for queued strips and send their frames
+ * 
+ * @param	index	index of the worker
+ */
+void RenderPool::workerLoop(unsigned int index) {
+	uint64_t count;
+
+	Logger::registerThread();
+
+	while(true) {
+		// every read takes a single token, so each queued strip wakes a single worker
+		if(read(wakeFd, &count, sizeof(count)) < 0 && errno != EINTR)
+			break;
+		if(stopping)
+			break;
+
+		LedStrip* strip = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(queued > 0) {
+				strip = queue[head];
+				head = (head + 1) % queue.size();
+				queued--;
+				serving[index] = strip;
+			}
+		}
+
+		if(strip) {
+			strip->renderQueued();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				serving[index] = nullptr;
+			}
+			served.notify_all();
+		}
+	}
+}
+
+/**
+ * Queue a strip having a frame to send. It must not be called again for the
+ * same strip until a worker has picked it up
+ * 
+ * @param	strip	LED strip to serve
+ */
+void RenderPool::post(LedStrip* strip) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(queued == queue.size()) {
+			LOG_ERROR("Render queue full, frame not sent");
+			return;
+		}
+		queue[(head + queued) % queue.size()] = strip;
+		queued++;
+	}
+
+	uint64_t one = 1;
+	if(write(wakeFd, &one, sizeof(one)) < 0)
+		LOG_ERROR("Unable to wake up the render workers");
+}
+
+/**
+ * Wait until a strip is neither queued nor served by any worker, so that
+ * it can be destroyed while the pool keeps running. The strip must not
+ * publish any frame meanwhile
+ * 
+ * @param	strip	LED strip to give back
+ */
+void RenderPool::release(LedStrip* strip) {
+	// a strip leaves the queue and gets a worker under the same lock
+	std::unique_lock<std::mutex> lock(mutex);
+	served.wait(lock, [this, strip]() {
+		bool busy = false;
+		for(unsigned int i = 0; i < queued; i++)
+			busy |= queue[(head + i) % queue.size()] == strip;
+		for(LedStrip* current : serving)
+			busy |= current == strip;
+		return !busy || stopping;
+	});
+}
+
+/**
+ * Wait for the workers to finish the frame they are sending, and stop them.
+ * It must be called before destroying the strips using the pool
+ */
+void RenderPool::stop() {
+	if(workers.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	served.notify_all();
+
+	uint64_t tokens = workers.size();
+	if(write(wakeFd, &tokens, sizeof(tokens)) < 0)
+		LOG_ERROR("Unable to wake up the render workers");
+
+	for(std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+/**
+ * Return the handles of the workers, to tune their scheduling
+ * 
+ * @return	vector containing one handle per worker
+ */
+std::vector<std::thread::native_handle_type> RenderPool::getThreads() {
+	std::vector<std::thread::native_handle_type> threads;
+	for(std::thread& worker : workers)
+		threads.push_back(worker.native_handle());
+	return threads;
+}
@@ -0,0 +1,243 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <memory>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+
+#include "Clock.h"
+#include "LedBackend.h"
+#include "Logger.h"
+#include "NoteName.h"
+#include "Station.h"
+
+/**
+ * Build the station, creating the LED backend selected by its configuration.
+ * In case of error a LedStripException is thrown
+ * 
+ * @param	name		name of the station, shown in the reports
+ * @param	config		configuration of the station
+ * @param	pool		workers sending the frames, nullptr for a dedicated render thread
+ */
+Station::Station(const std::string& name, std::shared_ptr<const PianoTutorPlusConfig> config, RenderPool* pool)
+	: name(name), config(std::move(config)), pool(pool),
+	strip(new LedStrip(LedBackend::create(*this->config), this->config->getLedCount(), pool)),
+	compositor(this->config->getLedCount()),
+	animator(this->config->getAttackTime() > 0 || this->config->getDecayTime() > 0 ?
+			new Animator(*this->config, compositor) : nullptr),
+	mapper(*this->config, compositor, animator.get()), batch(0), oldest(0), resynced(false), resyncs(0) {
+
+	setupStrip();
+}
+
+/**
+ * Attach the metrics and the color correction of the configuration to
+ * the strip, if any
+ */
+void Station::setupStrip() {
+	if(!strip)
+		return;
+
+	strip->setMetrics(&metrics);
+
+	// the tables live in the configuration, which is kept alive by the frames using them
+	if(config->getColorCorrection().isIdentity())
+		strip->setColorCorrection(nullptr);
+	else
+		strip->setColorCorrection(std::shared_ptr<const ColorCorrection>(config, &config->getColorCorrection()));
+}
+
+/**
+ * Apply an event to the back buffer of the strip, recording its latency
+ * 
+ * @param	event	MIDI event read from the source
+ * 
+ * @return	true if the event is the first of a new batch
+ */
+bool Station::apply(const MidiEvent& event) {
+	uint64_t read = Clock::now();
+	metrics.record(LatencyMetrics::Stage::DEQUEUE, event.timestamp, read);
+	if(!oldest || event.timestamp < oldest)
+		oldest = event.timestamp;
+
+	// the track is 0 for the events which do not come from a file
+	LOG_TRACE("%s %s %s (channel %u, track %u, velocity %u)", name.c_str(),
+			NoteName::toString(event.note),
+			event.type == MidiEvent::Type::NOTE_ON ? "ON" :
+			event.type == MidiEvent::Type::PREVIEW ? "PREVIEW" : "OFF",
+			event.channel + 1, event.track == MIDI_NO_TRACK ? 0 : event.track + 1, event.velocity);
+
+	mapper.apply(event);
+	metrics.record(LatencyMetrics::Stage::MAP, read, Clock::now());
+
+	return batch++ == 0 && !resynced;
+}
+
+/**
+ * Forget the state of the keyboard after some of its events have been lost:
+ * all the keys are released and their LEDs switched off, so that no LED stays
+ * on for a note-off that never arrived. The next events show the keys again
+ * 
+ * @return	true if nothing was applied since the last flush
+ */
+bool Station::resync() {
+	LOG_WARNING("%s: events lost, releasing all the keys", name.c_str());
+	mapper.clear();
+	resyncs++;
+
+	bool first = batch == 0 && !resynced;
+	resynced = true;
+	return first;
+}
+
+/**
+ * Close the current batch, composing the layers and publishing a frame if
+ * any LED changed
+ */
+void Station::flush() {
+	if(strip && (batch > 0 || resynced)) {
+		uint64_t mapped = Clock::now();
+		compositor.composite(*strip);
+		bool rendered = strip->render(oldest);
+		if(rendered)
+			metrics.record(LatencyMetrics::Stage::SUBMIT, mapped, Clock::now());
+		stats.record(batch, rendered);
+	} else {
+		stats.record(batch, false);
+	}
+
+	batch = 0;
+	oldest = 0;
+	resynced = false;
+}
+
+/**
+ * Advance the fades of the keys by the frames elapsed on the frame clock,
+ * publishing the resulting frame
+ */
+void Station::animate() {
+	animator->tick();
+	if(strip) {
+		compositor.composite(*strip);
+		strip->render();
+	}
+}
+
+/**
+ * Switch to a new configuration, keeping the state of the keyboard. The
+ * strip is initialized again only if its settings changed, or if the station
+ * has none, while the brightness of its channels and its segments are changed
+ * in place; if initializing it fails the previous configuration is kept, and if the
+ * previous strip cannot be restored either the station goes on without a
+ * strip until the next reload. It must be called between two batches
+ * 
+ * @param	next	new configuration of the station
+ * 
+ * @return	true if a new strip has been initialized
+ */
+bool Station::reload(std::shared_ptr<const PianoTutorPlusConfig> next) {
+	bool restarted = !strip || !next->hasSameStrip(*config);
+
+	if(restarted) {
+		LOG_INFO("%s: initializing the LED strip again", name.c_str());
+
+		// the old strip has to release the hardware before the new one takes it
+		if(pool && strip)
+			pool->release(strip.get());
+		strip.reset();
+		try {
+			strip.reset(new LedStrip(LedBackend::create(*next), next->getLedCount(), pool));
+		} catch(LedStripException& e) {
+			LOG_ERROR("%s: unable to initialize the LED strip, keeping the previous configuration", name.c_str());
+			next = config;
+			try {
+				strip.reset(new LedStrip(LedBackend::create(*next), next->getLedCount(), pool));
+			} catch(LedStripException& e) {
+				LOG_ERROR("%s: unable to restore the LED strip, going on without it until the next reload",
+						name.c_str());
+			}
+		}
+
+		if(next->getLedCount() != compositor.getCount())
+			compositor.resize(next->getLedCount());
+	} else {
+		// the brightness of the channels and the segments change on the strip in use
+		for(unsigned char c = 0; c < LED_CHANNELS; c++)
+			if(next->getLedChannels()[c].brightness != config->getLedChannels()[c].brightness)
+				strip->setChannelBrightness(c, next->getLedChannels()[c].brightness);
+		if(!next->hasSameSegments(*config)) {
+			LOG_INFO("%s: mapping the LED strip on the new segments", name.c_str());
+			strip->setSegments(next->getLedSegments());
+		}
+	}
+
+	config = std::move(next);
+	setupStrip();
+
+	// the frame clock, once registered, outlives the fades being switched off
+	bool fades = config->getAttackTime() > 0 || config->getDecayTime() > 0;
+	if(animator) {
+		animator->configure(*config);
+		if(!fades)
+			animator->clear();
+	} else if(fades) {
+		animator.reset(new Animator(*config, compositor));
+	}
+	mapper.configure(*config, fades ? animator.get() : nullptr);
+
+	LOG_INFO("%s: configuration reloaded", name.c_str());
+	if(!strip)
+		return false;
+
+	// a new strip starts switched off, so it receives the whole frame
+	compositor.composite(*strip);
+	if(restarted)
+		strip->setColors(0, compositor.getOutput(), compositor.getCount());
+	strip->render();
+
+	return restarted;
+}
+
+/**
+ * Print a human-readable summary of the counters and of the latencies
+ * 
+ * @param	os		output stream
+ */
+void Station::print(std::ostream& os) const {
+	stats.print(os);
+	if(strip)
+		os << "LEDs changed: " << strip->getChangedLeds()
+				<< ", renders: " << strip->getRenders()
+				<< ", renders skipped: " << strip->getSkippedRenders() << ", ";
+	os << "resyncs: " << resyncs << std::endl;
+	if(animator)
+		os << "Animation frames: " << animator->getFrames() << std::endl;
+	metrics.print(os);
+}
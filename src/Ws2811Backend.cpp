@@ -0,0 +1,159 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#include "LedBackend.h"
+#include "LedStrip.h"
+#include "Logger.h"
+
+/**
+ * Initialize the library starting from the provided parameters. In case of
+ * error a LedStripException is thrown
+ * 
+ * @param	freq		driving frequency
+ * @param	dmaChannel	number of the DMA channel
+ * @param	channels	settings of the two output channels
+ * @param	segments	mapping of the logical strip on the channels
+ */
+Ws2811Backend::Ws2811Backend(unsigned int freq, unsigned char dmaChannel, const LedChannel (&channels)[LED_CHANNELS],
+		const std::vector<LedSegment>& segments) {
+
+    memset(&ledstring, 0, sizeof(ledstring));
+
+    ledstring.freq = freq;
+    ledstring.dmanum = dmaChannel;
+
+	for(int c = 0; c < LED_CHANNELS; c++) {
+		ledstring.channel[c].gpionum = channels[c].gpioPin;
+		ledstring.channel[c].count = channels[c].gpioPin != 0 ? channels[c].count : 0;
+		ledstring.channel[c].invert = 0;
+		ledstring.channel[c].brightness = channels[c].brightness;
+		ledstring.channel[c].strip_type = channels[c].stripType;
+		this->channelBrightness[c] = channels[c].brightness;
+	}
+
+    if (ws2811_init(&ledstring) != WS2811_SUCCESS)
+		throw LedStripException();
+
+	this->segments = fit(segments);
+	this->mapped = this->segments;
+}
+
+/**
+ * Keep the segments fitting the channels, dropping the ones on a disabled
+ * channel or past its end
+ * 
+ * @param	segments	mapping of the logical strip on the channels
+ * 
+ * @return	the segments kept
+ */
+std::shared_ptr<const std::vector<LedSegment>> Ws2811Backend::fit(const std::vector<LedSegment>& segments) const {
+	std::shared_ptr<std::vector<LedSegment>> kept = std::make_shared<std::vector<LedSegment>>(segments);
+	auto invalid = [this](const LedSegment& s) {
+		return ledstring.channel[s.channel].leds == nullptr ||
+				s.offset + s.count > (unsigned int) ledstring.channel[s.channel].count;
+	};
+	kept->erase(std::remove_if(kept->begin(), kept->end(), invalid), kept->end());
+	return kept;
+}
+
+/**
+ * Release the library resources
+ */
+Ws2811Backend::~Ws2811Backend() {
+	LOG_VERBOSE("Releasing the ws2811 library");
+    ws2811_fini(&ledstring);
+}
+
+/**
+ * Copy the frame into the channel buffers, following the segment map, and start
+ * the transfer of both channels at once
+ * 
+ * @param	leds		values of the LEDs
+ * @param	count		number of LEDs
+ * @param	brightness	brightness of the whole strip
+ */
+void Ws2811Backend::render(const ws2811_led_t* leds, unsigned int count, unsigned char brightness) {
+	// a new mapping starts from dark channels, so that no LED keeps the old one
+	std::shared_ptr<const std::vector<LedSegment>> current = std::atomic_load(&segments);
+	if(current != mapped) {
+		for(int c = 0; c < LED_CHANNELS; c++)
+			if(ledstring.channel[c].leds)
+				memset(ledstring.channel[c].leds, 0, ledstring.channel[c].count * sizeof(ws2811_led_t));
+		mapped = current;
+	}
+
+	for(const LedSegment& s : *current) {
+		if(s.first >= count)
+			continue;
+		unsigned int n = std::min<unsigned int>(s.count, count - s.first);
+		ws2811_led_t* dst = ledstring.channel[s.channel].leds + s.offset;
+		const ws2811_led_t* src = leds + s.first;
+
+		if(s.reversed)
+			std::reverse_copy(src, src + n, dst + (s.count - n));
+		else
+			memcpy(dst, src, n * sizeof(ws2811_led_t));
+	}
+
+	for(int c = 0; c < LED_CHANNELS; c++)
+		ledstring.channel[c].brightness = (channelBrightness[c].load(std::memory_order_relaxed) * brightness + 127) / 255;
+
+	ws2811_render(&ledstring);
+}
+
+/**
+ * Block until the last transfer is complete
+ */
+void Ws2811Backend::wait() {
+	ws2811_wait(&ledstring);
+}
+
+/**
+ * Set the brightness of an output channel, used from the next frame on
+ * 
+ * @param	channel		output channel
+ * @param	brightness	brightness of the channel
+ */
+void Ws2811Backend::setChannelBrightness(unsigned char channel, unsigned char brightness) {
+	if(channel < LED_CHANNELS)
+		channelBrightness[channel].store(brightness, std::memory_order_relaxed);
+}
+
+/**
+ * Map the logical strip on the output channels with new segments, used from
+ * the next frame on. The segments not fitting the channels are dropped
+ * 
+ * @param	segments	mapping of the logical strip on the channels
+ */
+void Ws2811Backend::setSegments(const std::vector<LedSegment>& segments) {
+	std::atomic_store(&this->segments, fit(segments));
+}
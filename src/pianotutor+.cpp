@@ -26,19 +26,34 @@
  */
 
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
 #include <iostream>
-#include <math.h>
+#include <memory>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "AllocGuard.h"
 #include "ArgParser.h"
 #include "Config.h"
-#include "debug.h"
+#include "ConfigWatcher.h"
+#include "EventLoop.h"
 #include "LedStrip.h"
+#include "Logger.h"
 #include "MidiClient.h"
+#include "MidiSource.h"
 #include "PianoTutorPlusConfig.h"
+#include "RealTime.h"
+#include "RenderPool.h"
+#include "Station.h"
 
 
 #define PROGRAM		"pianotutor+"
@@ -48,10 +63,14 @@
 
 #define MIDI_CLIENT_NAME    "PianoTutor+"
 #define MIDI_PORT_NAME      "PianoTutor+ MIDI input"
+#define MAX_STATIONS        128     // one sequencer port each
+#define MIDI_READ_EVENTS    64      // events read from a source with a single call
 
 #define ERR_OPEN_FILE	-1
 #define ERR_PARSE_FILE	-2
 #define ERR_MIDI_DEVICE -3
+#define ERR_EVENT_LOOP	-4
+#define ERR_LED_STRIP	-5
 
 
 /**
@@ -62,12 +81,15 @@ static inline void printUsage() {
 	std::cout << DESCRIPTION << std::endl;
 	std::cout << std::endl;
     std::cout << "Usage:" << std::endl;
-	std::cout << "    " << PROGRAM << " (-f | --file) <name>" << std::endl;
+	std::cout << "    " << PROGRAM << " (-f | --file) <name> [(-f | --file) <name> ...]" << std::endl;
+	std::cout << "    " << PROGRAM << " (-s | --stations) <name>" << std::endl;
 	std::cout << "    " << PROGRAM << " (-v | --version)" << std::endl;
 	std::cout << "    " << PROGRAM << " (-h | --help)" << std::endl;
 	std::cout << std::endl;
 	std::cout << "Options:" << std::endl;
-	std::cout << "    " << "-f <name>, --file <name>\tLoad configurations from file named <name>" << std::endl;
+	std::cout << "    " << "-f <name>, --file <name>\tLoad configurations from file named <name>," << std::endl;
+	std::cout << "    " << "\t\t\t\trepeat it to drive one station per file" << std::endl;
+	std::cout << "    " << "-s <name>, --stations <name>\tDrive one station per configuration file listed in <name>" << std::endl;
 	std::cout << "    " << "-h, --help\t\t\tShow this screen" << std::endl;
 	std::cout << "    " << "-v, --version\t\tShow program version" << std::endl;
 
@@ -75,18 +97,60 @@ static inline void printUsage() {
 }
 
 
-bool run = true;
+/**
+ * Apply the real-time settings of the configuration to a thread
+ * 
+ * @param	config	program configuration
+ * @param	thread	thread to configure
+ * @param	name	name of the thread
+ * @param	cpu		CPU the thread is pinned to, -1 to leave it free
+ * 
+ * @return	description of the settings in effect
+ */
+static std::string applyRealTime(const PianoTutorPlusConfig& config, pthread_t thread, const char* name, int cpu) {
+	std::string settings = std::string(name) + " thread ";
+
+	if(config.getRtPolicy() != SchedPolicy::OTHER &&
+			RealTime::setScheduling(thread, name, config.getRtPolicy(), config.getRtPriority()))
+		settings += std::string(SchedPolicy::toString(config.getRtPolicy())) + "/" + std::to_string(config.getRtPriority());
+	else
+		settings += SchedPolicy::toString(SchedPolicy::OTHER);
+
+	if(cpu >= 0 && RealTime::setAffinity(thread, name, cpu))
+		settings += " on CPU " + std::to_string(cpu);
+
+	return settings;
+}
+
 
 /**
- * Custom SIGINT handler
+ * Read a list of station configuration files, one per line. Empty lines and
+ * comments starting with '#' are skipped, and relative names are resolved
+ * from the directory of the list. In case of error an OpenFileException is thrown
  * 
- * @param   signum      number of the signal (unused)
+ * @param	filename	name of the list
+ * @param	files		vector receiving the names of the configuration files
  */
-static inline void sigintHandler(int signum) {
-    dprintf("Invoking SIGINT handler");
-    run = false;
+static void readStationList(const std::string& filename, std::vector<std::string>& files) {
+	std::ifstream list(filename);
+	if(!list)
+		throw OpenFileException(filename);
+
+	size_t slash = filename.rfind('/');
+	std::string dir = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+	std::string line;
+	while(std::getline(list, line)) {
+		line = line.substr(0, line.find('#'));
+		size_t first = line.find_first_not_of(" \t\r");
+		if(first == std::string::npos)
+			continue;
+		line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+		files.push_back(line[0] == '/' ? line : dir + line);
+	}
 }
 
+
 /**
  * Program entry-point. It parses the command-line arguments, retrieves the name
  * of the configuration file and parse it. Then, depending on the MIDI note caught,
@@ -97,9 +161,10 @@ static inline void sigintHandler(int signum) {
  */
 int main(int argc, char* argv[]) {
 
-    signal(SIGINT, sigintHandler);
+	std::vector<std::string> configFiles;
 
-	std::string configFile;
+	// the event path must not allocate when its first record is written
+	Logger::registerThread();
 
     try {
 
@@ -112,68 +177,273 @@ int main(int argc, char* argv[]) {
 			std::cout << "Version: " << VERSION << std::endl;
 			exit(EXIT_SUCCESS);
 		})
-		.addOption("file", 'f', ArgParser::ArgumentType::REQUIRED, [&configFile](const char* arg) {
-			dprintf("Loading configuration from %s", arg);
-			configFile = std::string(arg);
+		.addOption("file", 'f', ArgParser::ArgumentType::REQUIRED, [&configFiles](const char* arg) {
+			LOG_INFO("Loading configuration from %s", arg);
+			configFiles.push_back(std::string(arg));
+		})
+		.addOption("stations", 's', ArgParser::ArgumentType::REQUIRED, [&configFiles](const char* arg) {
+			LOG_INFO("Loading the list of stations from %s", arg);
+			readStationList(arg, configFiles);
 		})
 		.parse(argc, argv);
 
-		if(configFile == "") {
+		if(configFiles.empty()) {
 			printUsage();
 			exit(ERR_OPEN_FILE);
 		}
+		if(configFiles.size() > MAX_STATIONS) {
+			std::cerr << "At most " << MAX_STATIONS << " stations are supported" << std::endl;
+			exit(ERR_PARSE_FILE);
+		}
 
-        PianoTutorPlusConfig config(configFile);
-        dprintf("Parse configuration file: correct");
-
-        LedStrip strip(config.getFreq(),
-    				config.getDmaChannel(), 
-                    config.getGpioPin(),
-                    config.getStripType(),
-                    config.getLedCount());
-
-        MidiClient midi(MIDI_CLIENT_NAME, MIDI_PORT_NAME);
-
+		// the process-wide settings (logging, real-time) come from the first station,
+		// as it was configured at startup
+		std::vector<std::shared_ptr<const PianoTutorPlusConfig>> configs;
+		for(const std::string& configFile : configFiles)
+			configs.emplace_back(new PianoTutorPlusConfig(configFile));
+		const PianoTutorPlusConfig& config = *configs.front();
+        LOG_VERBOSE("Parse configuration file: correct");
+
+        std::vector<std::unique_ptr<Station>> stations;
+        std::function<void(size_t)> reloadStation;
+
+        // signals must be blocked before any other thread is spawned
+        EventLoop loop;
+        loop.addSignal(SIGINT, [&loop]() {
+            LOG_VERBOSE("Invoking SIGINT handler");
+            loop.stop();
+        });
+        loop.addSignal(SIGUSR1, [&stations]() {
+            for(auto& station : stations) {
+                if(stations.size() > 1)
+                    std::cout << "Station " << station->getName() << std::endl;
+                station->getMetrics().print(std::cout);
+            }
+        });
+        loop.addSignal(SIGHUP, [&stations, &reloadStation]() {
+            for(size_t i = 0; i < stations.size(); i++)
+                reloadStation(i);
+        });
+        loop.addSignal(SIGUSR2, []() {
+            // cycle through the levels, so that tracing can be turned on and off while running
+            LogLevel::Level level = (LogLevel::Level) ((Logger::getLevel() + 1) % LogLevel::getAllLevels().size());
+            Logger::setLevel(level);
+            std::cout << "Log level: " << LogLevel::toString(level) << std::endl;
+        });
+
+        FILE* logFile = stdout;
+        if(!config.getLogFile().empty() && !(logFile = fopen(config.getLogFile().c_str(), "a"))) {
+            std::cerr << "Warning: unable to open the log file " << config.getLogFile()
+                    << ", logging to the standard output" << std::endl;
+            logFile = stdout;
+        }
+        Logger::setLevel(config.getLogLevel());
+        Logger::start(logFile);
 
-        MidiEvent midiEvent;
-        int pin = 0;
-        std::string note;
+        // memory is locked before the render threads start, so that their stacks are locked as well
+        bool locked = config.getLockMemory() && RealTime::lockMemory();
 
-        while(run) {
+        // a single station keeps its own render thread, many share a pool sized to the CPUs
+        std::unique_ptr<RenderPool> pool;
+        if(configs.size() > 1)
+            pool.reset(new RenderPool(configs.size()));
 
-            midiEvent = midi.getEvent();
-            if(midiEvent.type != MidiEvent::Type::UNKNOWN && midiEvent.type != MidiEvent::Type::NO_EVENT) {
+        for(size_t i = 0; i < configs.size(); i++) {
+            std::string name = configs[i]->getStationName().empty() ? configFiles[i] : configs[i]->getStationName();
+            stations.emplace_back(new Station(name, configs[i], pool.get()));
+        }
 
-                note = MidiClient::midi2note(midiEvent.note);
-                dprintf("[%c] %s %s",
-						midiEvent.hand == MidiEvent::Hand::RIGHT ? 'R' : 'L',
-						note.c_str(),
-						midiEvent.type == MidiEvent::Type::NOTE_ON ? "ON" : "OFF");
+        std::string renderSettings;
+        if(pool) {
+            // each worker is listed, as they are pinned to different CPUs, wrapping
+            // around the available ones
+            std::vector<pthread_t> workers = pool->getThreads();
+            unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+            for(size_t i = 0; i < workers.size(); i++)
+                renderSettings += (i > 0 ? ", " : "") + applyRealTime(config, workers[i], "render",
+                        config.getRenderThreadCpu() < 0 ? -1 : (int) ((config.getRenderThreadCpu() + i) % cpus));
+            renderSettings += " (" + std::to_string(workers.size()) + (workers.size() == 1 ? " worker)" : " workers)");
+        } else {
+            renderSettings = applyRealTime(config, stations.front()->getStrip().getRenderThread(),
+                    "render", config.getRenderThreadCpu());
+        }
+        std::string settings = applyRealTime(config, pthread_self(), "MIDI", config.getMidiThreadCpu()) + ", " +
+                renderSettings + (locked ? ", memory locked" : "");
+        for(auto& station : stations)
+            station->getMetrics().setSettings(settings);
+
+        // the ALSA stations share a client, with one port each: the port receiving an
+        // event selects the station, and its input buffers are the largest asked by the
+        // stations. Any other source belongs to a single station
+        std::vector<Station*> portStations;
+        std::vector<std::string> portNames;
+        size_t inputBuffer = 0, inputPool = 0;
+        std::vector<std::pair<std::unique_ptr<MidiSource>, Station*>> sources;
+        for(auto& station : stations) {
+            if(station->getConfig().getMidiSource() == MidiSourceType::ALSA) {
+                portStations.push_back(station.get());
+                portNames.push_back(stations.size() > 1 ? "PianoTutor+ " + station->getName() : MIDI_PORT_NAME);
+                inputBuffer = std::max<size_t>(inputBuffer, station->getConfig().getMidiInputBuffer());
+                inputPool = std::max<size_t>(inputPool, station->getConfig().getMidiInputPool());
+            } else {
+                sources.emplace_back(MidiSource::create(station->getConfig(), MIDI_CLIENT_NAME, MIDI_PORT_NAME),
+                        station.get());
+            }
+        }
 
-                switch(config.getLedOrder()) {
-                    case LedOrder::Order::DIR:
-                        pin = round((midiEvent.note - config.getKeyboardMinNote()) * config.getLedPerKey());
-                        break;
-                    case LedOrder::Order::INV:
-                        pin = round((config.getKeyboardMaxNote() - midiEvent.note) * config.getLedPerKey());
-                        break;
+        std::unique_ptr<MidiClient> client;
+        if(!portStations.empty())
+            client.reset(new MidiClient(MIDI_CLIENT_NAME, portNames, inputBuffer, inputPool));
+
+        // stations touched by the batch being drained, in order of arrival
+        std::vector<Station*> touched;
+        touched.reserve(stations.size());
+
+        auto onClientInput = [&client, &portStations, &touched](short revents) {
+            AllocGuard::Scope noAllocations;
+
+            // an overrun does not tell which ports lost their events: every station is reset
+            auto resync = [&portStations, &touched]() {
+                for(Station* station : portStations)
+                    if(station->resync())
+                        touched.push_back(station);
+            };
+
+            // drain everything queued so far, so that a chord becomes a single frame per station
+            MidiEvent events[MIDI_READ_EVENTS];
+            unsigned int count;
+            do {
+                count = client->getEvents(events, MIDI_READ_EVENTS);
+                for(unsigned int i = 0; i < count; i++) {
+                    if(events[i].port >= portStations.size())
+                        continue;
+
+                    Station* station = portStations[events[i].port];
+                    if(station->apply(events[i]))
+                        touched.push_back(station);
                 }
 
-                if(midiEvent.type == MidiEvent::Type::NOTE_ON) {
-                    LedColor::Color color = midiEvent.hand == MidiEvent::Hand::RIGHT ? config.getColorRightHand() : config.getColorLeftHand();
-                    strip.switchOn(pin, color);
-                } else {
-                    strip.switchOff(pin);
+                // the events read so far came before the overrun
+                if(client->checkLostEvents())
+                    resync();
+            } while(count > 0);
+
+            for(Station* station : touched)
+                station->flush();
+            touched.clear();
+        };
+
+        if(client)
+            for(pollfd& pfd : client->getPollDescriptors())
+                loop.addFd(pfd.fd, pfd.events, onClientInput);
+
+        // without a sequencer client, the program ends with the last source
+        size_t running = sources.size();
+        for(auto& source : sources) {
+            MidiSource* midi = source.first.get();
+            Station* station = source.second;
+
+            auto onMidiInput = [midi, station, &client, &running, &loop, finished = false](short revents) mutable {
+                AllocGuard::Scope noAllocations;
+
+                MidiEvent events[MIDI_READ_EVENTS];
+                unsigned int count;
+                do {
+                    count = midi->getEvents(events, MIDI_READ_EVENTS);
+                    for(unsigned int i = 0; i < count; i++)
+                        station->apply(events[i]);
+                    if(midi->checkLostEvents())
+                        station->resync();
+                } while(count > 0);
+                station->flush();
+
+                // a finished source is never ready again
+                if(!finished && midi->isFinished()) {
+                    finished = true;
+                    if(--running == 0 && !client)
+                        loop.stop();
                 }
+            };
+
+            for(pollfd& pfd : midi->getPollDescriptors())
+                loop.addFd(pfd.fd, pfd.events, onMidiInput);
+        }
 
-                strip.render();
+        // the frame clock of a station runs only while some of its keys are fading,
+        // and it is watched from the first configuration enabling the fades
+        std::vector<bool> animated(stations.size(), false);
+        auto watchAnimation = [&loop, &stations, &animated](size_t i) {
+            Station* station = stations[i].get();
+            if(animated[i] || station->getAnimationFd() < 0)
+                return;
+            animated[i] = true;
+            loop.addFd(station->getAnimationFd(), POLLIN, [station](short revents) {
+                AllocGuard::Scope noAllocations;
+                station->animate();
+            });
+        };
+        for(size_t i = 0; i < stations.size(); i++)
+            watchAnimation(i);
+
+        // a new configuration is parsed aside and swapped in between two batches, so the
+        // sequencer ports and their connections survive it. A file which cannot be parsed
+        // leaves the station as it is, and a strip which cannot be started only leaves
+        // the station dark until the next reload
+        reloadStation = [&stations, &pool, &config, &watchAnimation](size_t i) {
+            Station* station = stations[i].get();
+            std::shared_ptr<const PianoTutorPlusConfig> next;
+            try {
+                next.reset(new PianoTutorPlusConfig(station->getConfig().getFilename()));
+            } catch(OpenFileException& e) {
+                LOG_ERROR("%s: unable to open the configuration file, nothing changed", station->getName().c_str());
+                return;
+            } catch(ParsingException& e) {
+                LOG_ERROR("%s: unable to parse the configuration file, nothing changed", station->getName().c_str());
+                return;
             }
 
-            usleep(10000);
+            // a new render thread gets the scheduling of the old one
+            if(station->reload(next) && !pool)
+                applyRealTime(config, station->getStrip().getRenderThread(), "render", config.getRenderThreadCpu());
+            watchAnimation(i);
+        };
+
+        ConfigWatcher watcher(configFiles);
+        std::vector<size_t> changed;
+        if(watcher.getFd() >= 0)
+            loop.addFd(watcher.getFd(), POLLIN, [&watcher, &changed, &reloadStation](short revents) {
+                watcher.readChanges(changed);
+                for(size_t i : changed)
+                    reloadStation(i);
+                changed.clear();
+            });
+
+        // block until MIDI input or a signal arrives
+        auto begin = std::chrono::steady_clock::now();
+        loop.run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        // the workers must be done with the strips before they are destroyed
+        if(pool)
+            pool->stop();
+
+        unsigned long events = 0;
+        for(auto& station : stations)
+            events += station->getStats().getEvents();
+        std::cout << "Elapsed: " << elapsed.count() << " s, events per second: "
+                << events / elapsed.count() << std::endl;
+        for(auto& station : stations) {
+            if(stations.size() > 1)
+                std::cout << "Station " << station->getName() << std::endl;
+            station->print(std::cout);
         }
+        if(client)
+            std::cout << "MIDI input overruns: " << client->getOverruns() << std::endl;
+        if(Logger::getDropped() > 0)
+            std::cout << "Log records dropped: " << Logger::getDropped() << std::endl;
 
     } catch(OpenFileException& e) {
-        std::cerr << "Error opening the configuration file " << std::endl << std::flush;
+        std::cerr << "Error opening the file " << e.getFilename() << std::endl << std::flush;
         exit(ERR_OPEN_FILE);
     } catch(ParsingException& e) {
         std::cerr << "Error parsing the configuration file" << std::endl  << std::flush;
@@ -181,6 +451,12 @@ int main(int argc, char* argv[]) {
     } catch(MidiDeviceException& e) {
 		std::cerr << "Error accessing the MIDI device" << std::endl  << std::flush;
         exit(ERR_MIDI_DEVICE);
+    } catch(LedStripException& e) {
+		std::cerr << "Error accessing the LED strip" << std::endl  << std::flush;
+        exit(ERR_LED_STRIP);
+    } catch(EventLoopException& e) {
+		std::cerr << "Error waiting for events" << std::endl  << std::flush;
+        exit(ERR_EVENT_LOOP);
     }
 
     return 0;
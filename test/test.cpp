@@ -0,0 +1,861 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Gabriele Baris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "AllocGuard.h"
+#include "Animator.h"
+#include "Clock.h"
+#include "ColorCorrection.h"
+#include "Compositor.h"
+#include "Config.h"
+#include "KeyState.h"
+#include "LedBackend.h"
+#include "LedStrip.h"
+#include "Logger.h"
+#include "MidiClient.h"
+#include "MidiFile.h"
+#include "MidiSource.h"
+#include "NoteMapper.h"
+#include "PianoTutorPlusConfig.h"
+#include "Station.h"
+
+
+#define PROGRAM		"pianotutor+-test"
+
+/**
+ * A test case: the body checks its expectations through CHECK()
+ */
+struct Test {
+	std::string name;
+	std::function<void()> body;
+};
+
+// failed checks of the test being run
+static unsigned int failures;
+
+// temporary directory holding the files written by the tests
+static std::string dir;
+
+// keeps the compiler from optimizing away the results of the operations
+static volatile uint64_t sink;
+
+/**
+ * Record a failed expectation, printing where it was checked
+ * 
+ * @param	passed		outcome of the check
+ * @param	expr		text of the checked expression
+ * @param	file		source file of the check
+ * @param	line		line of the check
+ */
+static void check(bool passed, const char* expr, const char* file, int line) {
+	if(passed)
+		return;
+	std::cerr << file << ":" << line << ": check failed: " << expr << std::endl;
+	failures++;
+}
+
+#define CHECK(expr)		check((expr), #expr, __FILE__, __LINE__)
+
+/**
+ * Write a file into the temporary directory. In case of error an
+ * OpenFileException is thrown
+ * 
+ * @param	name		name of the file within the directory
+ * @param	content		content of the file
+ * 
+ * @return	full name of the file
+ */
+static std::string writeFile(const std::string& name, const std::string& content) {
+	std::string filename = dir + "/" + name;
+	std::ofstream file(filename, std::ios::binary);
+	if(!file.is_open())
+		throw OpenFileException(filename);
+	file << content;
+	return filename;
+}
+
+/**
+ * Return the next value of a xorshift generator, so that the random buffers
+ * are the same on every run
+ * 
+ * @param	seed	state of the generator, updated
+ * 
+ * @return	the new value
+ */
+static uint32_t nextRandom(uint32_t& seed) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+/**
+ * Scheduled source replaying a list of events, each with its time from the
+ * beginning of the stream
+ */
+class ListSource : public ScheduledSource {
+
+	std::vector<std::pair<uint64_t, MidiEvent>> events;
+	std::size_t position;
+
+protected:
+
+	bool read(MidiEvent& event, uint64_t& time) override {
+		if(position == events.size())
+			return false;
+		time = events[position].first;
+		event = events[position++].second;
+		return true;
+	}
+
+public:
+
+	ListSource(uint64_t preview) : ScheduledSource(1, preview), position(0) {}
+
+	/**
+	 * Append an event to the stream, after the ones already added
+	 * 
+	 * @param	time	time of the event from the beginning, in ns
+	 * @param	type	NOTE_ON or NOTE_OFF
+	 * @param	note	MIDI note
+	 */
+	void add(uint64_t time, MidiEvent::Type type, unsigned char note) {
+		MidiEvent event = {};
+		event.type = type;
+		event.note = note;
+		event.velocity = type == MidiEvent::Type::NOTE_ON ? 100 : 0;
+		event.track = MIDI_NO_TRACK;
+		events.push_back({time, event});
+	}
+};
+
+/**
+ * Take all the events of a source, waiting on its descriptors for them to be due
+ * 
+ * @param	source	source to drain
+ * 
+ * @return	events, in the order they were released
+ */
+static std::vector<MidiEvent> drain(MidiSource& source) {
+	std::vector<MidiEvent> events;
+	std::vector<pollfd> fds = source.getPollDescriptors();
+	while(!source.isFinished()) {
+		if(source.getPendingEvents() > 0)
+			events.push_back(source.getEvent());
+		else if(poll(fds.data(), fds.size(), 1000) <= 0)
+			break;
+	}
+	return events;
+}
+
+/**
+ * Build a complete program configuration for a 61-key keyboard, one LED per
+ * key, keeping the frames in memory
+ * 
+ * @param	extra	further lines appended to the configuration
+ * 
+ * @return	content of the file
+ */
+static std::string programConfig(const std::string& extra = "") {
+	return "FREQUENCY = 800000\n"
+			"GPIO_PIN = 10\n"
+			"DMA_CHANNEL = 10\n"
+			"LED_BACKEND = memory\n"
+			"MIDI_SOURCE = synthetic\n"
+			"KEYBOARD_MIN_NOTE = C2\n"
+			"KEYBOARD_MAX_NOTE = C7\n"
+			"LED_COUNT = 61\n"
+			"LED_PER_KEY = 1\n"
+			"LED_ORDER = DIR\n"
+			"LED_TYPE = GRB\n"
+			"COLOR_RIGHT_HAND = orange\n"
+			"COLOR_LEFT_HAND = green\n" + extra;
+}
+
+/**
+ * Press a key on a fresh keyboard and return the color it gets
+ * 
+ * @param	config	program configuration
+ * @param	event	NOTE_ON event
+ * 
+ * @return	color of the first LED lit
+ */
+static ws2811_led_t pressedColor(const PianoTutorPlusConfig& config, const MidiEvent& event) {
+	Compositor compositor(config.getLedCount());
+	NoteMapper mapper(config, compositor);
+	mapper.apply(event);
+
+	compositor.blend(0, (compositor.getCount() + COMPOSITOR_BLOCK - 1) / COMPOSITOR_BLOCK * COMPOSITOR_BLOCK);
+	for(unsigned short pos = 0; pos < compositor.getCount(); pos++)
+		if(compositor.getOutput()[pos] != 0)
+			return compositor.getOutput()[pos];
+	return 0;
+}
+
+/**
+ * Build a format 0 Standard MIDI File, 96 ticks per quarter note, holding a
+ * single track
+ * 
+ * @param	events	body of the track, delta times included, without the end of track
+ * 
+ * @return	content of the file
+ */
+static std::string smfFile(const std::vector<uint8_t>& events) {
+	std::string track = std::string(events.begin(), events.end()) + std::string("\x00\xFF\x2F\x00", 4);
+	std::string length = {(char) (track.size() >> 24), (char) (track.size() >> 16),
+			(char) (track.size() >> 8), (char) track.size()};
+	return std::string("MThd\x00\x00\x00\x06\x00\x00\x00\x01\x00\x60", 14) + "MTrk" + length + track;
+}
+
+/**
+ * Decode all the notes of a MIDI file
+ * 
+ * @param	filename	name of the file
+ * 
+ * @return	notes of the file, in order
+ */
+static std::vector<MidiEvent> readNotes(const std::string& filename) {
+	MidiFile file(filename);
+	std::vector<MidiEvent> notes;
+	MidiEvent event;
+	uint64_t time;
+	while(file.next(event, time))
+		notes.push_back(event);
+	return notes;
+}
+
+
+/**
+ * Test entry-point. It runs the tests whose name contains the optional
+ * argument, and exits with status 1 if any of them failed
+ * 
+ * @param	argc	number of arguments
+ * @param	argv	vector of arguments
+ */
+int main(int argc, char* argv[]) {
+
+	std::string filter = argc > 1 ? argv[1] : "";
+	std::vector<Test> tests;
+
+	// the event path must not allocate when its first record is written
+	Logger::registerThread();
+
+	// a station fed by a source, with the allocation guard armed around the event path
+	// as the MIDI handler does: built with ALLOC_CHECK, any heap allocation aborts. A
+	// second thread allocating meanwhile must not trip the guard, which is per thread
+	tests.push_back({"alloc_guard_event_path", []() {
+		std::shared_ptr<const PianoTutorPlusConfig> config(
+				new PianoTutorPlusConfig(writeFile("guard.conf", programConfig())));
+		Station station("guard", config, nullptr);
+		SyntheticSource source(config->getKeyboardMinNote(), config->getKeyboardMaxNote(), 1e9, 4, 0, 0);
+
+		std::atomic<bool> done(false);
+		std::thread other([&done]() {
+			while(!done)
+				sink = std::vector<uint64_t>(64).size();
+		});
+
+		{
+			AllocGuard::Scope noAllocations;
+
+			// a batch per chord, so that every frame changes
+			MidiEvent events[4];
+			for(unsigned int batch = 0; batch < 1000; batch++) {
+				unsigned int count = source.getEvents(events, 4);
+				for(unsigned int i = 0; i < count; i++)
+					station.apply(events[i]);
+				station.flush();
+			}
+		}
+
+		done = true;
+		other.join();
+
+		CHECK(station.getStats().getEvents() > 0);
+		CHECK(station.getStrip().getRenders() > 0);
+	}});
+
+	// a frame is published only when some LED changed: writing the color a LED
+	// already has leaves nothing to render
+	tests.push_back({"strip_skips_unchanged_frames", []() {
+		LedStrip strip(std::unique_ptr<LedBackend>(new MemoryBackend(800000, false)), 10);
+
+		strip.setColor(3, 0x102030);
+		CHECK(strip.render());
+		CHECK(strip.getRenders() == 1);
+		CHECK(strip.getSkippedRenders() == 0);
+
+		strip.setColor(3, 0x102030);
+		CHECK(!strip.render());
+		CHECK(strip.getRenders() == 1);
+		CHECK(strip.getSkippedRenders() == 1);
+		CHECK(strip.getChangedLeds() == 1);
+
+		strip.setColor(3, 0x203040);
+		CHECK(strip.render());
+		CHECK(!strip.render());
+		CHECK(strip.getRenders() == 2);
+		CHECK(strip.getSkippedRenders() == 2);
+		CHECK(strip.getChangedLeds() == 2);
+	}});
+
+	// LEDs lit by each key, from C2 (36) to C7 (96): the notes off the keyboard light
+	// nothing, and the spans stop at the end of the strip
+	tests.push_back({"led_spans", []() {
+		PianoTutorPlusConfig twoLeds(writeFile("spans.conf", programConfig("LED_COUNT = 122\nLED_PER_KEY = 2\n")));
+		CHECK(twoLeds.getLedSpan(36).first == 0 && twoLeds.getLedSpan(36).length == 2);
+		CHECK(twoLeds.getLedSpan(37).first == 2 && twoLeds.getLedSpan(37).length == 2);
+		CHECK(twoLeds.getLedSpan(96).first == 120 && twoLeds.getLedSpan(96).length == 2);
+		CHECK(twoLeds.getLedSpan(35).length == 0);
+		CHECK(twoLeds.getLedSpan(97).length == 0);
+		CHECK(twoLeds.getLedSpan(0).length == 0);
+
+		PianoTutorPlusConfig inverted(writeFile("inverted.conf",
+				programConfig("LED_COUNT = 122\nLED_PER_KEY = 2\nLED_ORDER = INV\n")));
+		CHECK(inverted.getLedSpan(96).first == 0 && inverted.getLedSpan(96).length == 2);
+		CHECK(inverted.getLedSpan(36).first == 120 && inverted.getLedSpan(36).length == 2);
+
+		// the last key keeps the LED left on the strip, the ones after it get none
+		PianoTutorPlusConfig clamped(writeFile("clamped.conf", programConfig("LED_COUNT = 121\nLED_PER_KEY = 2\n")));
+		CHECK(clamped.getLedSpan(96).first == 120 && clamped.getLedSpan(96).length == 1);
+		PianoTutorPlusConfig shorter(writeFile("shorter.conf", programConfig("LED_COUNT = 119\nLED_PER_KEY = 2\n")));
+		CHECK(shorter.getLedSpan(95).first == 118 && shorter.getLedSpan(95).length == 1);
+		CHECK(shorter.getLedSpan(96).length == 0);
+	}});
+
+	// a key pressed on two channels, or twice on the same one, stays lit until its
+	// last release, whatever the order of the releases
+	tests.push_back({"overlapping_presses", []() {
+		PianoTutorPlusConfig config(writeFile("overlap.conf", programConfig()));
+		Compositor compositor(config.getLedCount());
+		NoteMapper mapper(config, compositor);
+		const unsigned int end = (compositor.getCount() + COMPOSITOR_BLOCK - 1) / COMPOSITOR_BLOCK * COMPOSITOR_BLOCK;
+		const unsigned short led = config.getLedSpan(60).first;
+
+		auto play = [&mapper, &compositor, end, led](uint8_t channel, MidiEvent::Type type) {
+			MidiEvent event = {};
+			event.note = 60;
+			event.velocity = 100;
+			event.channel = channel;
+			event.hand = channel == 0 ? MidiEvent::Hand::RIGHT : MidiEvent::Hand::LEFT;
+			event.track = MIDI_NO_TRACK;
+			event.type = type;
+			mapper.apply(event);
+			compositor.blend(0, end);
+			return compositor.getOutput()[led];
+		};
+
+		ws2811_led_t right = play(0, MidiEvent::Type::NOTE_ON);
+		ws2811_led_t both = play(1, MidiEvent::Type::NOTE_ON);
+		CHECK(right != 0 && both == right);
+		ws2811_led_t left = play(0, MidiEvent::Type::NOTE_OFF);
+		CHECK(left != 0 && left != right);
+		CHECK(play(1, MidiEvent::Type::NOTE_OFF) == 0);
+
+		play(1, MidiEvent::Type::NOTE_ON);
+		play(0, MidiEvent::Type::NOTE_ON);
+		CHECK(play(1, MidiEvent::Type::NOTE_OFF) == right);
+		CHECK(play(0, MidiEvent::Type::NOTE_OFF) == 0);
+
+		play(0, MidiEvent::Type::NOTE_ON);
+		play(0, MidiEvent::Type::NOTE_ON);
+		CHECK(play(0, MidiEvent::Type::NOTE_OFF) == right);
+		CHECK(play(0, MidiEvent::Type::NOTE_OFF) == 0);
+
+		// far more presses than a byte counts, each one matched by a release
+		KeyState keys;
+		for(unsigned int i = 0; i < 300; i++) {
+			keys.press(60, 0);
+			keys.press(60, 1);
+		}
+		for(unsigned int i = 0; i < 299; i++)
+			keys.release(60, 0);
+		CHECK(keys.getHolder(60) == 0);
+		keys.release(60, 0);
+		CHECK(keys.getHolder(60) == 1);
+		for(unsigned int i = 0; i < 300; i++)
+			keys.release(60, 1);
+		CHECK(keys.getHolder(60) == -1);
+
+		// a saturated count keeps the key held until everything is cleared
+		for(unsigned int i = 0; i < UINT16_MAX + 10u; i++)
+			keys.press(61, 2);
+		keys.release(61, 2);
+		CHECK(keys.getHolder(61) == 2);
+		keys.clear();
+		CHECK(keys.getHolder(61) == -1);
+	}});
+
+	// segments are split among the channels in order, a reversed one keeps its
+	// LEDs, while overlapping or out of range segments are rejected
+	tests.push_back({"led_segments", []() {
+		PianoTutorPlusConfig config(writeFile("segments.conf", programConfig(
+				"CHANNEL1_GPIO_PIN = 13\n"
+				"LED_SEGMENTS = 0-19:0, 60-41:1, 20-40:0\n")));
+		const std::vector<LedSegment>& segments = config.getLedSegments();
+		CHECK(segments.size() == 3);
+		CHECK(segments[0].first == 0 && segments[0].count == 20 && segments[0].channel == 0 &&
+				segments[0].offset == 0 && !segments[0].reversed);
+		CHECK(segments[1].first == 41 && segments[1].count == 20 && segments[1].channel == 1 &&
+				segments[1].offset == 0 && segments[1].reversed);
+		CHECK(segments[2].first == 20 && segments[2].count == 21 && segments[2].channel == 0 &&
+				segments[2].offset == 20 && !segments[2].reversed);
+		CHECK(config.getLedChannels()[0].count == 41);
+		CHECK(config.getLedChannels()[1].count == 20);
+
+		auto rejected = [](const std::string& segments) {
+			try {
+				PianoTutorPlusConfig config(writeFile("segments.conf", programConfig(
+						"CHANNEL1_GPIO_PIN = 13\n"
+						"LED_SEGMENTS = " + segments + "\n")));
+			} catch(ParsingException& e) {
+				return true;
+			}
+			return false;
+		};
+		CHECK(!rejected("0-30:0, 31-60:1"));
+		CHECK(rejected("0-30:0, 30-60:1"));
+		CHECK(rejected("0-40:0, 60-20:1"));
+		CHECK(rejected("0-30:0, 10-20:0"));
+		CHECK(rejected("0-61:0"));
+		CHECK(rejected("61-0:1"));
+		CHECK(rejected("0-60:2"));
+		CHECK(rejected("0-30 0"));
+	}});
+
+	// the color correction matches its scalar reference on random frames, whatever
+	// their length and whether the frame is corrected in place
+	tests.push_back({"color_correction_matches_scalar", []() {
+		const uint8_t neutral[3] = {255, 255, 255};
+		const uint8_t warm[3] = {255, 200, 180};
+		const ColorCorrection corrections[] = {
+				ColorCorrection(1, neutral, 0, 32),
+				ColorCorrection(2.2, warm, 0, 32),
+				ColorCorrection(2.2, warm, 2, 32),
+				ColorCorrection(0.5, warm, 1.5, 0)};
+		uint32_t seed = 0x2545F491u;
+
+		for(const ColorCorrection& correction : corrections) {
+			for(unsigned int count : {1u, 3u, 7u, 15u, 17u, 31u, 33u, 301u, 1201u}) {
+				std::vector<ws2811_led_t> frame(count);
+				for(ws2811_led_t& led : frame)
+					led = nextRandom(seed);
+
+				std::vector<ws2811_led_t> reference(count), corrected(count);
+				correction.applyScalar(frame.data(), reference.data(), count);
+				correction.apply(frame.data(), corrected.data(), count);
+				CHECK(corrected == reference);
+
+				correction.apply(frame.data(), frame.data(), count);
+				CHECK(frame == reference);
+			}
+		}
+	}});
+
+	// the layer blending matches its scalar reference on random layers, including
+	// fully transparent and opaque LEDs, for strips of odd lengths
+	tests.push_back({"blend_matches_scalar", []() {
+		uint32_t seed = 0x9E3779B9u;
+
+		for(unsigned int count : {1u, 3u, 15u, 17u, 31u, 61u, 301u}) {
+			Compositor compositor(count);
+			for(unsigned int layer = 0; layer < Compositor::LAYERS; layer++) {
+				for(unsigned short pos = 0; pos < count; pos++) {
+					uint32_t value = nextRandom(seed);
+					uint8_t alpha = value >> 24;
+					if((value & 0x3) == 0)
+						alpha = 0;
+					else if((value & 0x3) == 1)
+						alpha = 255;
+					compositor.setColor((Compositor::Layer) layer, pos, value & 0xFFFFFF, alpha);
+				}
+			}
+
+			const unsigned int end = (count + COMPOSITOR_BLOCK - 1) / COMPOSITOR_BLOCK * COMPOSITOR_BLOCK;
+			compositor.blendScalar(0, end);
+			std::vector<ws2811_led_t> reference(compositor.getOutput(), compositor.getOutput() + count);
+			compositor.blend(0, end);
+			CHECK(std::equal(reference.begin(), reference.end(), compositor.getOutput()));
+
+			// a range starting past the first block leaves the LEDs before it alone
+			if(end > COMPOSITOR_BLOCK) {
+				compositor.blendScalar(0, end);
+				compositor.setColor(Compositor::NOTES, 0, 0x123456, 255);
+				compositor.setColor(Compositor::NOTES, count - 1, 0x654321, 128);
+				compositor.blend(COMPOSITOR_BLOCK, end);
+				CHECK(std::equal(reference.begin(), reference.begin() + COMPOSITOR_BLOCK, compositor.getOutput()));
+				std::vector<ws2811_led_t> blended(compositor.getOutput(), compositor.getOutput() + count);
+				compositor.blendScalar(COMPOSITOR_BLOCK, end);
+				CHECK(std::equal(blended.begin(), blended.end(), compositor.getOutput()));
+			}
+		}
+	}});
+
+	// the envelopes last the configured number of frames, the first one being taken
+	// on the press, and the frame clock stops once no key is moving. The frames are
+	// driven by hand, so no expiration of the clock is ever waited for
+	tests.push_back({"animator_envelopes", []() {
+		PianoTutorPlusConfig config(writeFile("animator.conf", programConfig(
+				"ATTACK_TIME = 100\n"
+				"DECAY_TIME = 50\n"
+				"ANIMATION_FPS = 100\n")));
+		Compositor compositor(config.getLedCount());
+		Animator animator(config, compositor);
+		const unsigned int end = (compositor.getCount() + COMPOSITOR_BLOCK - 1) / COMPOSITOR_BLOCK * COMPOSITOR_BLOCK;
+		const unsigned short led = config.getLedSpan(60).first;
+
+		auto armed = [&animator]() {
+			struct itimerspec timer;
+			if(timerfd_gettime(animator.getFd(), &timer) < 0)
+				return false;
+			return timer.it_interval.tv_sec != 0 || timer.it_interval.tv_nsec != 0;
+		};
+		auto shown = [&compositor, end, led]() {
+			compositor.blend(0, end);
+			return compositor.getOutput()[led];
+		};
+
+		CHECK(!armed());
+		animator.press(60, 0xFFFFFF);
+		CHECK(animator.getActiveKeys() == 1 && armed());
+
+		// 100 ms at 100 fps: 10 frames, the press included
+		ws2811_led_t previous = shown();
+		for(unsigned int frame = 2; frame < 10; frame++) {
+			CHECK(animator.advance() == 1);
+			ws2811_led_t current = shown();
+			CHECK(current > previous && current < 0xFFFFFF);
+			previous = current;
+		}
+		CHECK(armed());
+		CHECK(animator.advance() == 0);
+		CHECK(shown() == 0xFFFFFF);
+		CHECK(!armed());
+
+		// 50 ms: 5 frames, while another key keeps the clock running
+		animator.release(60);
+		animator.press(62, 0xFFFFFF);
+		for(unsigned int frame = 2; frame < 5; frame++)
+			CHECK(animator.advance() == 2);
+		CHECK(animator.advance() == 1);
+		CHECK(shown() == 0);
+		CHECK(armed());
+		for(unsigned int frame = 6; frame < 10; frame++)
+			CHECK(animator.advance() == 1);
+		CHECK(animator.advance() == 0);
+		CHECK(!armed());
+
+		// a late clock catches up several frames at once
+		animator.release(62);
+		CHECK(armed());
+		CHECK(animator.advance(10) == 0);
+		CHECK(!armed());
+		CHECK(animator.getFrames() == 9 + 9 + 10);
+	}});
+
+	// with a preview window, each NOTE_ON is announced exactly the window before it,
+	// and the stream comes out in timestamp order
+	tests.push_back({"preview_order", []() {
+		ListSource source(2 * NS_PER_MS);
+		source.add(0, MidiEvent::Type::NOTE_ON, 60);
+		source.add(500000, MidiEvent::Type::NOTE_ON, 62);
+		source.add(1000000, MidiEvent::Type::NOTE_OFF, 60);
+		source.add(1000000, MidiEvent::Type::NOTE_ON, 64);
+		source.add(3000000, MidiEvent::Type::NOTE_ON, 60);
+		source.add(3500000, MidiEvent::Type::NOTE_OFF, 62);
+		source.add(4000000, MidiEvent::Type::NOTE_OFF, 64);
+		source.add(4000000, MidiEvent::Type::NOTE_OFF, 60);
+
+		std::vector<MidiEvent> events = drain(source);
+		CHECK(source.isFinished());
+		CHECK(events.size() == 12);
+		if(events.size() != 12)
+			return;
+
+		const uint64_t start = events[0].timestamp;
+		const MidiEvent::Type PREVIEW = MidiEvent::Type::PREVIEW, ON = MidiEvent::Type::NOTE_ON,
+				OFF = MidiEvent::Type::NOTE_OFF;
+		const struct {
+			MidiEvent::Type type;
+			unsigned char note;
+			uint64_t time;
+		} expected[] = {
+				{PREVIEW, 60, 0}, {PREVIEW, 62, 500000}, {PREVIEW, 64, 1000000},
+				{ON, 60, 2000000}, {ON, 62, 2500000}, {OFF, 60, 3000000},
+				{ON, 64, 3000000}, {PREVIEW, 60, 3000000}, {ON, 60, 5000000},
+				{OFF, 62, 5500000}, {OFF, 64, 6000000}, {OFF, 60, 6000000}};
+		for(unsigned int i = 0; i < events.size(); i++) {
+			CHECK(events[i].type == expected[i].type && events[i].note == expected[i].note);
+			CHECK(events[i].timestamp - start == expected[i].time);
+		}
+	}});
+
+	// a window holding more announcements than the queue delays the ones past its
+	// size until the head is released, without losing or reordering any event
+	tests.push_back({"preview_queue_full", []() {
+		const unsigned int notes = PREVIEW_QUEUE_EVENTS + 100;
+		const uint64_t lead = NS_PER_MS;
+		ListSource source(lead);
+		for(unsigned int i = 0; i < notes; i++)
+			source.add(i, MidiEvent::Type::NOTE_ON, i % MIDI_NOTES);
+
+		std::vector<MidiEvent> events = drain(source);
+		CHECK(source.isFinished());
+		CHECK(events.size() == 2 * notes);
+		if(events.size() != 2 * notes)
+			return;
+
+		const uint64_t start = events[0].timestamp;
+		unsigned int previews = 0, presses = 0;
+		for(unsigned int i = 0; i < events.size(); i++) {
+			CHECK(i == 0 || events[i].timestamp >= events[i - 1].timestamp);
+			if(events[i].type == MidiEvent::Type::PREVIEW) {
+				// the first announcements fill the queue, each next one waits for a press
+				CHECK(events[i].note == previews % MIDI_NOTES);
+				CHECK(previews < PREVIEW_QUEUE_EVENTS ? events[i].timestamp - start == previews :
+						events[i].timestamp == events[i - 1].timestamp);
+				previews++;
+			} else {
+				CHECK(events[i].type == MidiEvent::Type::NOTE_ON && events[i].note == presses % MIDI_NOTES);
+				CHECK(events[i].timestamp - start == presses + lead);
+				CHECK(presses < previews);
+				presses++;
+			}
+		}
+		CHECK(previews == notes && presses == notes);
+	}});
+
+	// a reload keeps the strip when only the colors, the brightness of the channels
+	// or the segments change, initializes it again when the hardware settings
+	// change, and keeps the previous configuration when the new strip fails
+	tests.push_back({"station_reload", []() {
+		auto load = [](const std::string& extra) {
+			return std::make_shared<const PianoTutorPlusConfig>(writeFile("reload.conf", programConfig(
+					"CHANNEL1_GPIO_PIN = 13\n" + extra)));
+		};
+		const std::string segments = "LED_SEGMENTS = 0-29:0, 30-60:1\n";
+		std::shared_ptr<const PianoTutorPlusConfig> initial = load(segments);
+		Station station("reload", initial, nullptr);
+		LedStrip* strip = &station.getStrip();
+
+		CHECK(!station.reload(load(segments + "COLOR_RIGHT_HAND = red\n")));
+		CHECK(!station.reload(load(segments + "LED_BRIGHTNESS = 64\n")));
+		CHECK(!station.reload(load(segments + "CHANNEL1_BRIGHTNESS = 32\n")));
+		CHECK(!station.reload(load("LED_SEGMENTS = 0-29:0, 60-30:1\n")));
+		CHECK(&station.getStrip() == strip);
+
+		CHECK(station.reload(load("LED_SEGMENTS = 0-30:0, 31-60:1\n")));
+		CHECK(station.reload(load(segments + "GPIO_PIN = 12\n")));
+		CHECK(station.reload(load(segments + "LED_COUNT = 73\nLED_SEGMENTS = 0-29:0, 30-72:1\n")));
+		CHECK(station.getConfig().getLedCount() == 73);
+
+		// the file cannot be created: the strip is rebuilt from the previous configuration
+		bool thrown = false;
+		try {
+			CHECK(station.reload(load(segments + "LED_BACKEND = file\nLED_BACKEND_FILE = /nonexistent/frames\n")));
+		} catch(std::exception& e) {
+			thrown = true;
+		}
+		CHECK(!thrown);
+		CHECK(station.getConfig().getLedCount() == 73);
+		CHECK(station.getConfig().getLedBackend() == LedBackendType::MEMORY);
+		CHECK(!station.reload(load(segments + "LED_COUNT = 73\nLED_SEGMENTS = 0-29:0, 30-72:1\n"
+				"COLOR_LEFT_HAND = blue\n")));
+	}});
+
+	// running status does not survive meta and sysex events: a data byte following them
+	// is an error, which ends the track instead of being read as a note
+	tests.push_back({"midi_file_running_status", []() {
+		std::vector<MidiEvent> notes = readNotes(writeFile("meta.mid", smfFile({
+				0x00, 0x90, 0x3C, 0x40,
+				0x00, 0xFF, 0x01, 0x01, 0x41,
+				0x00, 0x3E, 0x40})));
+		CHECK(notes.size() == 1);
+		CHECK(notes.size() > 0 && notes[0].note == 0x3C && notes[0].type == MidiEvent::Type::NOTE_ON);
+
+		notes = readNotes(writeFile("sysex.mid", smfFile({
+				0x00, 0x90, 0x3C, 0x40,
+				0x00, 0xF0, 0x01, 0xF7,
+				0x00, 0x3E, 0x40})));
+		CHECK(notes.size() == 1);
+
+		// still used between channel messages
+		notes = readNotes(writeFile("running.mid", smfFile({
+				0x00, 0x90, 0x3C, 0x40,
+				0x00, 0x3E, 0x40,
+				0x60, 0x3C, 0x00})));
+		CHECK(notes.size() == 3);
+		CHECK(notes.size() == 3 && notes[1].note == 0x3E && notes[2].type == MidiEvent::Type::NOTE_OFF);
+	}});
+
+	// system common and real-time messages are skipped along with their data bytes,
+	// undefined ones end the track
+	tests.push_back({"midi_file_system_messages", []() {
+		std::vector<MidiEvent> notes = readNotes(writeFile("system.mid", smfFile({
+				0x00, 0x90, 0x3C, 0x40,
+				0x00, 0xF2, 0x01, 0x02,
+				0x00, 0xF8,
+				0x00, 0xF3, 0x05,
+				0x60, 0x80, 0x3C, 0x40})));
+		CHECK(notes.size() == 2);
+		CHECK(notes.size() == 2 && notes[1].note == 0x3C && notes[1].type == MidiEvent::Type::NOTE_OFF);
+
+		notes = readNotes(writeFile("undefined.mid", smfFile({
+				0x00, 0x90, 0x3C, 0x40,
+				0x00, 0xF4,
+				0x00, 0x80, 0x3C, 0x40})));
+		CHECK(notes.size() == 1);
+	}});
+
+	// the ring of a thread is reused once it exits, so short-lived threads never run
+	// out of rings; when all of them belong to running threads, the records are counted
+	tests.push_back({"logger_recycles_rings", []() {
+		std::string filename = writeFile("log.txt", "");
+		FILE* output = fopen(filename.c_str(), "w");
+		CHECK(output != nullptr);
+		if(!output)
+			return;
+
+		Logger::start(output);
+		uint64_t dropped = Logger::getDropped();
+		for(unsigned int i = 0; i < 3 * LOG_MAX_THREADS; i++)
+			std::thread([i]() { LOG_ERROR("short-lived thread %u", i); }).join();
+		CHECK(Logger::getDropped() == dropped);
+
+		std::atomic<unsigned int> registered(0);
+		std::atomic<bool> done(false);
+		std::vector<std::thread> threads;
+		for(unsigned int i = 0; i < LOG_MAX_THREADS; i++) {
+			threads.emplace_back([&registered, &done]() {
+				Logger::registerThread();
+				registered++;
+				while(!done)
+					std::this_thread::yield();
+			});
+		}
+		while(registered < LOG_MAX_THREADS)
+			std::this_thread::yield();
+		std::thread([]() { LOG_ERROR("thread without a ring"); }).join();
+		CHECK(Logger::getDropped() == dropped + 1);
+
+		done = true;
+		for(std::thread& thread : threads)
+			thread.join();
+		Logger::stop();
+		fclose(output);
+
+		std::ifstream log(filename);
+		std::string line;
+		unsigned int lines = 0;
+		while(std::getline(log, line))
+			lines += line.find("short-lived thread") != std::string::npos ? 1 : 0;
+		CHECK(lines == 3 * LOG_MAX_THREADS);
+	}});
+
+	// the color of the first track of a file leaves the events of any other source,
+	// live ones included, with the color of their channel
+	tests.push_back({"live_event_channel_color", []() {
+		PianoTutorPlusConfig plain(writeFile("plain.conf", programConfig()));
+		PianoTutorPlusConfig colored(writeFile("colored.conf", programConfig("COLOR_TRACK_1 = 0x0000FF\n")));
+
+		MidiEvent live;
+		SyntheticSource source(60, 60, 1e9, 1, 0, 0);
+		while(source.getEvents(&live, 1) == 0 || live.type != MidiEvent::Type::NOTE_ON)
+			;
+		CHECK(pressedColor(colored, live) != 0);
+		CHECK(pressedColor(colored, live) == pressedColor(plain, live));
+
+		MidiEvent file = live;
+		file.track = 0;
+		CHECK(pressedColor(colored, file) != pressedColor(plain, file));
+		file.track = 1;
+		CHECK(pressedColor(colored, file) == pressedColor(plain, file));
+	}});
+
+	// the input buffer and pool asked for reach the sequencer, as read back from it.
+	// Without a sequencer there is nothing to check
+	tests.push_back({"midi_client_input_sizes", []() {
+		std::unique_ptr<MidiClient> client;
+		try {
+			client.reset(new MidiClient(PROGRAM, std::vector<std::string>(2, "test"), 65536, 1000));
+		} catch(MidiDeviceException& e) {
+			std::cerr << "No MIDI sequencer, the input sizes are not checked" << std::endl;
+			return;
+		}
+		CHECK(client->getInputBuffer() >= 65536);
+		CHECK(client->getInputPool() == 1000);
+	}});
+
+	char dirTemplate[] = "/tmp/" PROGRAM "-XXXXXX";
+	if(!mkdtemp(dirTemplate)) {
+		std::cerr << "Unable to create a temporary directory" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	dir = dirTemplate;
+
+	unsigned int failed = 0, run = 0;
+	for(const Test& test : tests) {
+		if(test.name.find(filter) == std::string::npos)
+			continue;
+
+		failures = 0;
+		try {
+			test.body();
+		} catch(std::exception& e) {
+			std::cerr << test.name << ": unexpected " << e.what() << std::endl;
+			failures++;
+		}
+
+		std::cout << (failures ? "FAIL " : "PASS ") << test.name << std::endl;
+		failed += failures ? 1 : 0;
+		run++;
+	}
+
+	if(system(("rm -rf " + dir).c_str()) != 0)
+		std::cerr << "Unable to remove " << dir << std::endl;
+
+	std::cout << run - failed << "/" << run << " tests passed" << std::endl;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}